@@ -0,0 +1,308 @@
+/*
+	Latency and throughput benchmark for Yellog and the ep_4 Logger
+
+	Build and run (Linux):
+		g++ -std=c++17 -O2 -pthread -Iinclude bench.cpp -o bench
+		./bench [output path] [max threads] [calls per thread] [async | batched]
+
+	Results are written as JSON to the output path (bench_output.txt by default),
+	a short summary goes to stderr. Console scenarios write to stdout, redirect it to measure a pipe or a terminal.
+*/
+
+#include "include/yelloger.h"
+#include "src/ep_4/logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct BenchResult
+{
+	std::string name;
+	std::string output;
+	int threads;
+	std::size_t calls;
+	double p50_ns;
+	double p99_ns;
+	double p999_ns;
+	double max_ns;
+	double calls_per_second;
+};
+
+static std::int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs log_call(thread, i) calls_per_thread times on each thread, measuring every call
+template<typename LogCall>
+static BenchResult run_bench(const char* name, const char* output, int threads, std::size_t calls_per_thread, LogCall log_call)
+{
+	std::vector<std::vector<std::uint32_t>> latencies(threads);
+	std::vector<std::thread> workers;
+
+	std::int64_t begin = now_ns();
+	for (int t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]
+		{
+			std::vector<std::uint32_t>& samples = latencies[t];
+			samples.resize(calls_per_thread);
+
+			for (std::size_t i = 0; i < calls_per_thread; i++)
+			{
+				std::int64_t start = now_ns();
+				log_call(t, (int)i);
+				std::int64_t elapsed = now_ns() - start;
+				samples[i] = (std::uint32_t)std::min<std::int64_t>(elapsed, UINT32_MAX);
+			}
+		});
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	std::int64_t end = now_ns();
+
+	std::vector<std::uint32_t> all;
+	for (const std::vector<std::uint32_t>& samples : latencies)
+	{
+		all.insert(all.end(), samples.begin(), samples.end());
+	}
+	std::sort(all.begin(), all.end());
+
+	auto percentile = [&](double p) { return (double)all[std::min(all.size() - 1, (std::size_t)(p * all.size()))]; };
+
+	BenchResult result;
+	result.name = name;
+	result.output = output;
+	result.threads = threads;
+	result.calls = all.size();
+	result.p50_ns = percentile(0.5);
+	result.p99_ns = percentile(0.99);
+	result.p999_ns = percentile(0.999);
+	result.max_ns = (double)all.back();
+	result.calls_per_second = all.size() * 1e9 / (double)(end - begin);
+
+	std::fprintf(stderr, "%-28s %-8s threads %2d   p50 %8.0f ns   p99 %8.0f ns   p99.9 %8.0f ns   %10.0f calls/s\n",
+		name, output, threads, result.p50_ns, result.p99_ns, result.p999_ns, result.calls_per_second);
+
+	return result;
+}
+
+// Sets the Yellog outputs for the next scenarios
+static void select_output(const char* output)
+{
+	static std::shared_ptr<Yellog::Sink> extra_sink;
+
+	Yellog::Flush();
+	Yellog::DisableFileOutput();
+	Yellog::DisableConsoleOutput();
+	if (extra_sink)
+	{
+		Yellog::RemoveSink(extra_sink);
+		extra_sink.reset();
+	}
+
+	if (std::string(output) == "console")
+	{
+		Yellog::EnableConsoleOutput();
+	}
+	else if (std::string(output) == "file")
+	{
+		Yellog::EnableFileOutput("bench_log.txt");
+	}
+	else if (std::string(output) == "devnull")
+	{
+		Yellog::EnableFileOutput("/dev/null");
+	}
+	else if (std::string(output) == "binary")
+	{
+		extra_sink = std::make_shared<Yellog::BinaryFileSink>("bench_log.bin");
+		Yellog::AddSink(extra_sink);
+	}
+	else if (std::string(output) == "direct")
+	{
+		extra_sink = std::make_shared<Yellog::DirectFileSink>("bench_log.txt");
+		Yellog::AddSink(extra_sink);
+	}
+	else if (std::string(output) == "async_console")
+	{
+		extra_sink = std::make_shared<Yellog::AsyncConsoleSink>();
+		Yellog::AddSink(extra_sink);
+	}
+	else if (std::string(output) == "direct_sync")
+	{
+		extra_sink = std::make_shared<Yellog::DirectFileSink>("bench_log.txt", Yellog::SyncOnError);
+		Yellog::AddSink(extra_sink);
+	}
+}
+
+static void write_json(const char* path, const std::vector<BenchResult>& results)
+{
+	std::FILE* file = std::fopen(path, "w");
+	if (file == 0)
+	{
+		std::fprintf(stderr, "can't open %s\n", path);
+		return;
+	}
+
+	std::fprintf(file, "{\n  \"results\": [\n");
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& r = results[i];
+		std::fprintf(file, "    {\"name\": \"%s\", \"output\": \"%s\", \"threads\": %d, \"calls\": %zu, "
+			"\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, \"max_ns\": %.0f, \"calls_per_second\": %.0f}%s\n",
+			r.name.c_str(), r.output.c_str(), r.threads, r.calls, r.p50_ns, r.p99_ns, r.p999_ns, r.max_ns, r.calls_per_second,
+			i + 1 == results.size() ? "" : ",");
+	}
+	std::fprintf(file, "  ]\n}\n");
+	std::fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+	const char* output_path = argc > 1 ? argv[1] : "bench_output.txt";
+	int max_threads = argc > 2 ? std::atoi(argv[2]) : (int)std::max(1u, std::thread::hardware_concurrency());
+	std::size_t calls = argc > 3 ? (std::size_t)std::atoll(argv[3]) : 100000;
+	bool batched = argc > 4 && std::string(argv[4]) == "batched";
+
+	std::vector<int> thread_counts;
+	for (int threads = 1; threads < max_threads; threads *= 2)
+	{
+		thread_counts.push_back(threads);
+	}
+	thread_counts.push_back(max_threads);
+
+	std::vector<BenchResult> results;
+	const char* text = "request";
+
+	// cost of the measurement itself, subtract it from the other results
+	results.push_back(run_bench("timer_overhead", "none", 1, calls, [&](int, int) {}));
+
+	// filtered out messages, the cost of a disabled Debug call
+	Yellog::SetPriority(Yellog::InfoPriority);
+	select_output("none");
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("yellog_debug_filtered", "none", threads, calls,
+			[&](int t, int i) { Yellog::Debug("thread %d call %d %s", t, i, text); }));
+	}
+
+	// emitted messages per output
+	for (const char* output : { "devnull", "file", "direct", "binary", "console", "async_console" })
+	{
+		select_output(output);
+		for (int threads : thread_counts)
+		{
+			results.push_back(run_bench("yellog_info_3_args", output, threads, calls,
+				[&](int t, int i) { Yellog::Info("thread %d call %d %s", t, i, text); }));
+		}
+	}
+
+	// durable errors, every Error call waits for fdatasync
+	select_output("direct_sync");
+	results.push_back(run_bench("yellog_error_synced", "direct_sync", 1, std::min<std::size_t>(calls, 1000),
+		[&](int t, int i) { Yellog::Error("thread %d call %d %s", t, i, text); }));
+
+	// argument count and types
+	select_output("devnull");
+	results.push_back(run_bench("yellog_info_no_args", "devnull", 1, calls,
+		[&](int, int) { Yellog::Info("request done"); }));
+	results.push_back(run_bench("yellog_info_int", "devnull", 1, calls,
+		[&](int, int i) { Yellog::Info("request %d done", i); }));
+	results.push_back(run_bench("yellog_info_double", "devnull", 1, calls,
+		[&](int, int i) { Yellog::Info("latency %.3f ms", i * 0.001); }));
+	results.push_back(run_bench("yellog_info_string", "devnull", 1, calls,
+		[&](int, int) { Yellog::Info("path %s", "/api/v1/users/42/profile"); }));
+	results.push_back(run_bench("yellog_info_6_args", "devnull", 1, calls,
+		[&](int t, int i) { Yellog::Info("%d %d %s %.2f %p %c", t, i, text, i * 0.5, (void*)text, 'x'); }));
+	results.push_back(run_bench("yellog_info_fmt_3_args", "devnull", 1, calls,
+		[&](int t, int i) { Yellog::Info(YELLOG_FMT("thread {} call {} {}"), t, i, text); }));
+	results.push_back(run_bench("yellog_info_fmt_6_args", "devnull", 1, calls,
+		[&](int t, int i) { Yellog::Info(YELLOG_FMT("{} {} {} {:.2f} {} {}"), t, i, text, i * 0.5, (void*)text, 'x'); }));
+
+	// cost of the stats counters and the call duration measurement
+	Yellog::EnableStats();
+	results.push_back(run_bench("yellog_debug_filtered_stats", "none", 1, calls,
+		[&](int t, int i) { Yellog::Debug("thread %d call %d %s", t, i, text); }));
+	results.push_back(run_bench("yellog_info_3_args_stats", "devnull", 1, calls,
+		[&](int t, int i) { Yellog::Info("thread %d call %d %s", t, i, text); }));
+	Yellog::DisableStats();
+
+	// flight recorder, filtered out messages are still recorded
+	Yellog::EnableFlightRecorder(1024, false);
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("yellog_debug_recorded", "none", threads, calls,
+			[&](int t, int i) { Yellog::Debug("thread %d call %d %s", t, i, text); }));
+	}
+	results.push_back(run_bench("yellog_info_3_args_recorded", "devnull", 1, calls,
+		[&](int t, int i) { Yellog::Info("thread %d call %d %s", t, i, text); }));
+	Yellog::DisableFlightRecorder();
+
+	// ep_4 macros, the tutorial logger always writes to the console
+	Logger::SetPriority(InfoPriority);
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("ep4_log_debug_filtered", "none", threads, calls,
+			[&](int t, int i) { LOG_DEBUG("thread %d call %d %s", t, i, text); }));
+	}
+	// skip path of the sampling macros, a relaxed counter or a thread-local random number
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("ep4_log_info_every_n_skipped", "none", threads, calls,
+			[&](int t, int i) { LOG_INFO_EVERY_N(1 << 30, "thread %d call %d %s", t, i, text); }));
+	}
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("ep4_log_info_sampled_skipped", "none", threads, calls,
+			[&](int t, int i) { LOG_INFO_SAMPLED(0.0, "thread %d call %d %s", t, i, text); }));
+	}
+	// YELLOG_SCOPE while not recording (a relaxed load) and while recording into the thread's span buffer
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("ep4_scope_idle", "none", threads, calls,
+			[&](int, int) { YELLOG_SCOPE("bench"); }));
+	}
+	Logger::EnableSpans();
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("ep4_scope_recorded", "none", threads, calls,
+			[&](int, int) { YELLOG_SCOPE("bench"); }));
+	}
+	Logger::DisableSpans();
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench("ep4_log_info_3_args", "console", threads, calls,
+			[&](int t, int i) { LOG_INFO("thread %d call %d %s", t, i, text); }));
+	}
+
+	// async output with deferred formatting or batched output, they can't be turned off so they go last
+	select_output("devnull");
+	if (batched)
+	{
+		Yellog::EnableBatchedOutput();
+	}
+	else
+	{
+		Yellog::EnableAsyncOutput(1 << 16, Yellog::BlockOnOverflow, true);
+	}
+	for (int threads : thread_counts)
+	{
+		results.push_back(run_bench(batched ? "yellog_batched_info_3_args" : "yellog_async_info_3_args", "devnull", threads, calls,
+			[&](int t, int i) { Yellog::Info("thread %d call %d %s", t, i, text); }));
+	}
+	Yellog::Flush();
+
+	write_json(output_path, results);
+	std::remove("bench_log.txt");
+	std::remove("bench_log.bin");
+
+	return 0;
+}
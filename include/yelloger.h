@@ -65,6 +65,7 @@
 		Yellog::Critical(const char* message, Args... args)	// log a message with critical priority
 
 		As args you can provide primitives and C-strings. Formatting follows printf format.
+		Instead of printf args you can attach typed key/value pairs: Yellog::Info("request done", Yellog::Field("latency_us", us));
 
 	SIMPLE EXAMPLE
 
@@ -90,8 +91,78 @@
 #endif
 
 #include <cstdio>
+#include <cstdlib>
 #include <mutex>
 #include <ctime>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <map>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <optional>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+
+// Define YELLOG_WITH_ZLIB (and link zlib) to get Yellog::RotatingFileSink::GzipCompress
+#if defined(YELLOG_WITH_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define YELLOG_POSIX
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <climits>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+// Format strings are parsed with consteval functions when compiled as C++20
+#if defined(__cpp_consteval)
+#define YELLOG_CONSTEVAL consteval
+#else
+#define YELLOG_CONSTEVAL constexpr
+#endif
+
+// Lowest priority compiled into the program, calls with lower priority are removed at compile time
+// 0 - Trace, 1 - Debug, 2 - Info, 3 - Warn, 4 - Error, 5 - Critical, 6 - nothing is logged
+#ifndef YELLOG_ACTIVE_LEVEL
+#define YELLOG_ACTIVE_LEVEL 0
+#endif
+
+// Initial size of the per-thread buffer a log line is assembled in, it grows if a longer line is logged
+#ifndef YELLOG_LINE_BUFFER_SIZE
+#define YELLOG_LINE_BUFFER_SIZE 1024
+#endif
+
+// Maximum length of a single message in async mode (longer messages are truncated)
+#ifndef YELLOG_ASYNC_MESSAGE_SIZE
+#define YELLOG_ASYNC_MESSAGE_SIZE 256
+#endif
 
 
 class Yellog
@@ -102,198 +173,7220 @@ public:
 		TracePriority, DebugPriority, InfoPriority, WarnPriority, ErrorPriority, CriticalPriority
 	};
 
-private:
-	LogPriority priority = InfoPriority;
-	std::mutex log_mutex;
-	
-	const char* filepath = 0;
-	std::FILE* file = 0;
-	
-	// for timestamp formatting
-	char buffer[80];
-	const char* timestamp_format = "%T  %d-%m-%Y";
+	// Base of the types made by YELLOG_FMT, marks an argument as a {} format string
+	struct FormatString {};
+
+	// Output of {} formatting, writes up to the buffer size and counts the full length like snprintf
+	class FormatBuffer
+	{
+	private:
+		char* pos;
+		char* end;
+		std::size_t length = 0;
+
+	public:
+		// one byte of size is kept for the terminator
+		FormatBuffer(char* out, std::size_t size) : pos(out), end(out + (size == 0 ? 0 : size - 1)) {}
+
+		void Append(const char* data, std::size_t size)
+		{
+			std::size_t room = (std::size_t)(end - pos);
+			std::size_t copied = size < room ? size : room;
+			std::memcpy(pos, data, copied);
+			pos += copied;
+			length += size;
+		}
+
+		void Append(std::string_view text)
+		{
+			Append(text.data(), text.size());
+		}
+
+		void Append(char c)
+		{
+			if (pos != end)
+			{
+				*pos++ = c;
+			}
+			length++;
+		}
+
+		// Length of the whole formatted text, including what didn't fit
+		std::size_t Length() const
+		{
+			return length;
+		}
+
+		// Writes the terminator, returns the full length
+		int Finish()
+		{
+			*pos = '\0';
+			return (int)length;
+		}
+	};
+
+	// Specialize to format your own types in {} messages:
+	//	template<> struct Yellog::ValueFormatter<Point>
+	//	{
+	//		static void Format(Yellog::FormatBuffer& out, const Point& point) { ... }
+	//	};
+	template<typename T, typename Enable = void>
+	struct ValueFormatter;
+
+	class Sink;
+
+	// A named logger (category) with its own optional priority and sinks
+	// Get one with Yellog::Get("name") once and keep the reference, it stays valid until the program stops
+	class Category
+	{
+	private:
+		friend class Yellog;
+
+		std::string name;
+		std::size_t index;	// of the category in Settings::categories
+
+		// Changed with the logger config_mutex held, logging threads read them from the logger settings
+		std::atomic<int> priority{ -1 };	// -1 if the category uses the logger priority
+		std::atomic<bool> additive{ true };		// messages also go to the logger sinks
+		std::vector<std::shared_ptr<Sink>> sinks;	// sinks of this category only
+
+		// Held while writing to the category sinks without concurrent_writes instead of the logger lock
+		mutable std::mutex sinks_mutex;
+
+	public:
+		Category(const std::string& category_name, std::size_t category_index) : name(category_name), index(category_index) {}
+
+		Category(const Category&) = delete;
+		Category& operator= (const Category&) = delete;
+
+		const char* GetName() const
+		{
+			return name.c_str();
+		}
+
+		// Set priority for messages logged through the category, overrides logger priority
+		void SetPriority(LogPriority new_priority)
+		{
+			get_instance().set_category_priority(*this, new_priority);
+		}
+
+		// Remove the category priority override, the category will use the logger priority
+		void ResetPriority()
+		{
+			get_instance().set_category_priority(*this, -1);
+		}
+
+		// Returns the category priority, or the logger priority if the category has no override
+		LogPriority GetPriority() const
+		{
+			int category_priority = priority.load(std::memory_order_relaxed);
+			return category_priority == -1 ? Yellog::GetPriority() : (LogPriority)category_priority;
+		}
+
+		// Add an output for the messages of this category only
+		// Category sinks are written under a lock of the category, so categories with their own sinks don't contend with each other
+		void AddSink(std::shared_ptr<Sink> sink)
+		{
+			get_instance().change_settings([&] { sinks.push_back(std::move(sink)); });
+		}
+
+		// Remove an output added with Category::AddSink
+		void RemoveSink(const std::shared_ptr<Sink>& sink)
+		{
+			get_instance().change_settings([&] { sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end()); });
+		}
+
+		// If false, messages of the category only go to its own sinks and never take the logger lock
+		// Messages also go to the logger sinks by default
+		void SetAdditive(bool new_additive)
+		{
+			get_instance().change_settings([&] { additive.store(new_additive, std::memory_order_relaxed); });
+		}
+
+		bool IsAdditive() const
+		{
+			return additive.load(std::memory_order_relaxed);
+		}
+
+		// Log a message (format + optional args, follow printf specification)
+		// with log priority level Yellog::TracePriority
+		template<typename... Args>
+		void Trace(const char* message, Args... args) const
+		{
+			if constexpr (TracePriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log<TracePriority>(this, "[Trace]    ", message, args...);
+			}
+		}
+
+		// Log a message (format + optional args, follow printf specification)
+		// with log priority level Yellog::DebugPriority
+		template<typename... Args>
+		void Debug(const char* message, Args... args) const
+		{
+			if constexpr (DebugPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log<DebugPriority>(this, "[Debug]    ", message, args...);
+			}
+		}
+
+		// Log a message (format + optional args, follow printf specification)
+		// with log priority level Yellog::InfoPriority
+		template<typename... Args>
+		void Info(const char* message, Args... args) const
+		{
+			if constexpr (InfoPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log<InfoPriority>(this, "[Info]     ", message, args...);
+			}
+		}
+
+		// Log a message (format + optional args, follow printf specification)
+		// with log priority level Yellog::WarnPriority
+		template<typename... Args>
+		void Warn(const char* message, Args... args) const
+		{
+			if constexpr (WarnPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log<WarnPriority>(this, "[Warn]     ", message, args...);
+			}
+		}
+
+		// Log a message (format + optional args, follow printf specification)
+		// with log priority level Yellog::ErrorPriority
+		template<typename... Args>
+		void Error(const char* message, Args... args) const
+		{
+			if constexpr (ErrorPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log<ErrorPriority>(this, "[Error]    ", message, args...);
+			}
+		}
+
+		// Log a message (format + optional args, follow printf specification)
+		// with log priority level Yellog::CriticalPriority
+		template<typename... Args>
+		void Critical(const char* message, Args... args) const
+		{
+			if constexpr (CriticalPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log<CriticalPriority>(this, "[Crit]     ", message, args...);
+			}
+		}
+
+		// Log a message ({} format made with YELLOG_FMT + args)
+		// with log priority level Yellog::TracePriority
+		template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+		void Trace(Format format, const Args&... args) const
+		{
+			if constexpr (TracePriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log_format<TracePriority>(this, "[Trace]    ", format, args...);
+			}
+		}
+
+		// Log a message ({} format made with YELLOG_FMT + args)
+		// with log priority level Yellog::DebugPriority
+		template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+		void Debug(Format format, const Args&... args) const
+		{
+			if constexpr (DebugPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log_format<DebugPriority>(this, "[Debug]    ", format, args...);
+			}
+		}
+
+		// Log a message ({} format made with YELLOG_FMT + args)
+		// with log priority level Yellog::InfoPriority
+		template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+		void Info(Format format, const Args&... args) const
+		{
+			if constexpr (InfoPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log_format<InfoPriority>(this, "[Info]     ", format, args...);
+			}
+		}
+
+		// Log a message ({} format made with YELLOG_FMT + args)
+		// with log priority level Yellog::WarnPriority
+		template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+		void Warn(Format format, const Args&... args) const
+		{
+			if constexpr (WarnPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log_format<WarnPriority>(this, "[Warn]     ", format, args...);
+			}
+		}
+
+		// Log a message ({} format made with YELLOG_FMT + args)
+		// with log priority level Yellog::ErrorPriority
+		template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+		void Error(Format format, const Args&... args) const
+		{
+			if constexpr (ErrorPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log_format<ErrorPriority>(this, "[Error]    ", format, args...);
+			}
+		}
+
+		// Log a message ({} format made with YELLOG_FMT + args)
+		// with log priority level Yellog::CriticalPriority
+		template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+		void Critical(Format format, const Args&... args) const
+		{
+			if constexpr (CriticalPriority >= YELLOG_ACTIVE_LEVEL)
+			{
+				get_instance().log_format<CriticalPriority>(this, "[Crit]     ", format, args...);
+			}
+		}
+	};
+
+	// Type of a structured field value
+	enum FieldType
+	{
+		IntField, UnsignedField, DoubleField, BoolField, StringField
+	};
+
+	// A typed key/value pair attached to a message
+	//	Yellog::Info("request done", Yellog::Field("latency_us", us), Yellog::Field("path", path));
+	// The key and string values are not copied, they must stay valid until the log call returns
+	struct Field
+	{
+		const char* key;
+		FieldType type;
+		union
+		{
+			std::int64_t int_value;
+			std::uint64_t unsigned_value;
+			double double_value;
+			bool bool_value;
+		};
+		std::string_view string_value;
+
+		Field() : key(""), type(IntField), int_value(0) {}
+
+		Field(const char* field_key, bool value) : key(field_key), type(BoolField), int_value(0)
+		{
+			bool_value = value;
+		}
+
+		Field(const char* field_key, const char* value) : key(field_key), type(StringField), int_value(0), string_value(value ? value : "") {}
+		Field(const char* field_key, std::string_view value) : key(field_key), type(StringField), int_value(0), string_value(value) {}
+		Field(const char* field_key, const std::string& value) : key(field_key), type(StringField), int_value(0), string_value(value) {}
+
+		template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> || std::is_enum_v<T>>>
+		Field(const char* field_key, T value) : key(field_key), type(IntField), int_value(0)
+		{
+			if constexpr (std::is_enum_v<T>)
+			{
+				*this = Field(field_key, (std::underlying_type_t<T>)value);
+			}
+			else if constexpr (std::is_floating_point_v<T>)
+			{
+				type = DoubleField;
+				double_value = (double)value;
+			}
+			else if constexpr (std::is_signed_v<T>)
+			{
+				int_value = (std::int64_t)value;
+			}
+			else
+			{
+				type = UnsignedField;
+				unsigned_value = (std::uint64_t)value;
+			}
+		}
+	};
+
+	// Appends the printf arguments of a message to out, each one as a type tag followed by the value (see BinaryFileSink)
+	// C-strings are stored as strings only if the format prints them with %s
+	typedef void (*ArgumentEncoder)(const char* format, const void* arguments, std::string& out);
+
+	// A message as it is handed to sinks
+	struct Record
+	{
+		LogPriority priority;
+		std::int64_t time;				// nanoseconds since epoch
+		const char* timestamp;			// formatted with the timestamp format
+		const char* priority_str;		// e.g. "[Info]     "
+		const char* category;			// category name, or NULL for messages logged through Yellog directly
+		const char* message;			// formatted message (without the fields for messages with fields), not null-terminated
+		std::size_t message_length;
+		const char* line;				// default line "timestamp    [Priority] message\n", not null-terminated
+		std::size_t line_length;
+		const Field* fields;			// structured fields, NULL for printf messages (the line has them as " key=value" after the message)
+		std::size_t field_count;
+		const char* format;				// printf format string, NULL unless the arguments are available through encode_arguments
+		ArgumentEncoder encode_arguments;	// appends the printf arguments to out in the BinaryFileSink encoding
+		const void* arguments;			// passed to encode_arguments
+	};
+
+	// Replaces the default line format of a sink, appends the text to write for the record to out
+	typedef std::function<void(const Record& record, std::string& out)> Formatter;
+
+	// Formatter writing newline-delimited JSON, one object per message:
+	//	{"time":<ns since epoch>,"timestamp":"...","priority":"info","category":"db","message":"...","<field>":<value>,...}
+	// category is left out for messages logged through Yellog directly, the message doesn't repeat the fields
+	static void JsonFormat(const Record& record, std::string& out)
+	{
+		out += "{\"time\":";
+		append_number(out, record.time);
+		out += ",\"timestamp\":\"";
+		append_json_escaped(out, record.timestamp, std::strlen(record.timestamp));
+		out += "\",\"priority\":\"";
+		out += priority_name(record.priority);
+		if (record.category)
+		{
+			out += "\",\"category\":\"";
+			append_json_escaped(out, record.category, std::strlen(record.category));
+		}
+		out += "\",\"message\":\"";
+		append_json_escaped(out, record.message, record.message_length);
+		out += '"';
+
+		for (std::size_t i = 0; i < record.field_count; i++)
+		{
+			const Field& field = record.fields[i];
+			out += ",\"";
+			append_json_escaped(out, field.key, std::strlen(field.key));
+			out += "\":";
+
+			switch (field.type)
+			{
+			case IntField:
+				append_number(out, field.int_value);
+				break;
+			case UnsignedField:
+				append_number(out, field.unsigned_value);
+				break;
+			case DoubleField:
+				append_number(out, field.double_value);
+				break;
+			case BoolField:
+				out += field.bool_value ? "true" : "false";
+				break;
+			case StringField:
+				out += '"';
+				append_json_escaped(out, field.string_value.data(), field.string_value.size());
+				out += '"';
+				break;
+			}
+		}
+
+		out += "}\n";
+	}
+
+	// Formatter writing a compact length-prefixed binary record per message, all integers little-endian:
+	//	u32 length of the rest of the record
+	//	i64 time (nanoseconds since epoch), u8 priority
+	//	u16 category length, category (empty for messages logged through Yellog directly)
+	//	u32 message length, message
+	//	u16 field count, then per field: u8 FieldType, u16 key length, key, value
+	//	value is 8 bytes for IntField, UnsignedField and DoubleField (IEEE 754 bits), 1 byte for BoolField,
+	//	u32 length followed by the bytes for StringField
+	static void BinaryFormat(const Record& record, std::string& out)
+	{
+		std::size_t category_length = record.category ? std::strlen(record.category) : 0;
+		std::size_t message_length = record.message_length;
+
+		std::size_t size = 4 + 8 + 1 + 2 + category_length + 4 + message_length + 2;
+		for (std::size_t i = 0; i < record.field_count; i++)
+		{
+			size += binary_field_size(record.fields[i]);
+		}
+
+		std::size_t start = out.size();
+		out.resize(start + size);
+		char* pos = &out[start];
+
+		pos = put_integer(pos, size - 4, 4);
+		pos = put_integer(pos, (std::uint64_t)record.time, 8);
+		pos = put_integer(pos, (std::uint64_t)record.priority, 1);
+		pos = put_integer(pos, category_length, 2);
+		std::memcpy(pos, record.category ? record.category : "", category_length);
+		pos += category_length;
+		pos = put_integer(pos, message_length, 4);
+		std::memcpy(pos, record.message, message_length);
+		pos += message_length;
+		pos = put_integer(pos, record.field_count, 2);
+
+		for (std::size_t i = 0; i < record.field_count; i++)
+		{
+			pos = encode_field(pos, record.fields[i]);
+		}
+	}
+
+	// How stdio-based sinks buffer their output
+	enum BufferingPolicy
+	{
+		DefaultBuffering, NoBuffering, LineBuffering, FullBuffering
+	};
+
+	// When a Yellog::DirectFileSink forces written messages to disk
+	enum SyncPolicy
+	{
+		NoSync,			// leave it to the system
+		PeriodicSync,	// fdatasync every interval
+		SyncOnError		// fdatasync before an Error or Critical logging call returns
+	};
+
+	// What a logging thread does in async mode when the queue is full (or when the buffer of a Yellog::AsyncConsoleSink is full)
+	enum OverflowPolicy
+	{
+		BlockOnOverflow, DropNewestOnOverflow, DropOldestOnOverflow
+	};
+
+	// Whether a Yellog::AsyncConsoleSink colors lines by priority
+	enum ColorMode
+	{
+		NoColor,
+		AutoColor,		// only if the output is a terminal, TERM isn't "dumb" and NO_COLOR isn't set
+		AlwaysColor
+	};
+
+	// An output the logger writes messages to
+	// Derive from it and implement write() (and flush() if the output is buffered) to add a custom output
+	// write() and flush() are called with the sink lock held, so they are never called concurrently,
+	// unless the sink sets concurrent_writes
+	class Sink
+	{
+	private:
+		friend class Yellog;
+
+		std::atomic<int> priority{ TracePriority };
+		std::atomic<int> flush_priority{ CriticalPriority + 1 };
+		std::atomic<std::uint64_t> bytes_written{ 0 };
+		Formatter formatter;
+
+		// A sink can be written under different locks (e.g. when it is added to the logger and to a category),
+		// so sinks without concurrent_writes are also written with write_mutex held
+		std::mutex write_mutex;
+		std::string formatted;	// guarded by write_mutex
+
+		static std::string& thread_formatted()
+		{
+			static thread_local std::string buffer;
+			return buffer;
+		}
+
+		void consume(const Record& record)
+		{
+			if (record.priority < priority.load(std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			if (concurrent_writes)
+			{
+				consume(record, thread_formatted());
+				return;
+			}
+
+			std::scoped_lock lock(write_mutex);
+			consume(record, formatted);
+		}
+
+		void consume(const Record& record, std::string& buffer)
+		{
+			if (formatter)
+			{
+				buffer.clear();
+				formatter(record, buffer);
+				write(record, buffer.data(), buffer.size());
+				count_bytes(buffer.size());
+			}
+			else
+			{
+				write(record, record.line, record.line_length);
+				count_bytes(record.line_length);
+			}
+
+			if (record.priority >= flush_priority.load(std::memory_order_relaxed))
+			{
+				flush();
+			}
+		}
+
+		void flush_output()
+		{
+			if (concurrent_writes)
+			{
+				flush();
+				return;
+			}
+
+			std::scoped_lock lock(write_mutex);
+			flush();
+		}
+
+		void count_bytes(std::size_t length)
+		{
+			// only concurrent sinks are written by more than one thread at a time
+			if (concurrent_writes)
+			{
+				bytes_written.fetch_add(length, std::memory_order_relaxed);
+			}
+			else
+			{
+				bytes_written.store(bytes_written.load(std::memory_order_relaxed) + length, std::memory_order_relaxed);
+			}
+		}
+
+	protected:
+		// Set to true in the constructor of a sink whose write() and flush() are safe to call from many threads at once,
+		// the logger then calls them without taking its lock
+		// Removing a concurrent sink waits until no thread is still writing to it
+		bool concurrent_writes = false;
+
+		// Write a formatted message, data is the text produced by the sink formatter or the default line
+		virtual void write(const Record& record, const char* data, std::size_t length) = 0;
+
+		// Push buffered output to its destination
+		virtual void flush() {}
+
+		// Applies a buffering policy to a stream, must be called before anything is written to it
+		static void set_buffering(std::FILE* stream, BufferingPolicy buffering, std::size_t buffer_size)
+		{
+			if (buffering == NoBuffering)
+			{
+				std::setvbuf(stream, 0, _IONBF, 0);
+			}
+			else if (buffering == LineBuffering)
+			{
+				std::setvbuf(stream, 0, _IOLBF, buffer_size);
+			}
+			else if (buffering == FullBuffering)
+			{
+				std::setvbuf(stream, 0, _IOFBF, buffer_size);
+			}
+		}
+
+	public:
+		Sink() {}
+		virtual ~Sink() {}
+
+		Sink(const Sink&) = delete;
+		Sink& operator= (const Sink&) = delete;
+
+		// Messages with lower priority are not written to this sink
+		// The default priority is Yellog::TracePriority (the sink writes everything the logger lets through)
+		void SetPriority(LogPriority new_priority)
+		{
+			priority.store(new_priority, std::memory_order_relaxed);
+		}
+
+		LogPriority GetPriority() const
+		{
+			return (LogPriority)priority.load(std::memory_order_relaxed);
+		}
+
+		// Bytes passed to write() so far
+		std::uint64_t GetBytesWritten() const
+		{
+			return bytes_written.load(std::memory_order_relaxed);
+		}
+
+		// The sink is flushed after every message with this or higher priority
+		// By default the sink is flushed only by Yellog::Flush and when program stops
+		void SetFlushPriority(LogPriority new_flush_priority)
+		{
+			flush_priority.store(new_flush_priority, std::memory_order_relaxed);
+		}
+
+		// Replace the default line format for this sink
+		// Should be called before the sink is added to the logger
+		void SetFormatter(Formatter new_formatter)
+		{
+			formatter = std::move(new_formatter);
+		}
+	};
+
+	// Writes to stdout (or another stream, e.g. stderr)
+	class ConsoleSink : public Sink
+	{
+	private:
+		std::FILE* stream;
+
+	public:
+		explicit ConsoleSink(std::FILE* output_stream = stdout, BufferingPolicy buffering = DefaultBuffering, std::size_t buffer_size = BUFSIZ)
+			: stream(output_stream)
+		{
+			set_buffering(stream, buffering, buffer_size);
+		}
+
+	protected:
+		void write(const Record&, const char* data, std::size_t length) override
+		{
+			std::fwrite(data, 1, length, stream);
+		}
+
+		void flush() override
+		{
+			std::fflush(stream);
+		}
+	};
+
+	// Appends to a file, the file is closed when the sink is destroyed
+	class FileSink : public Sink
+	{
+	private:
+		std::FILE* file;
+
+	public:
+		explicit FileSink(const char* filepath, BufferingPolicy buffering = DefaultBuffering, std::size_t buffer_size = BUFSIZ)
+		{
+			file = std::fopen(filepath, "a");
+			if (file)
+			{
+				set_buffering(file, buffering, buffer_size);
+			}
+		}
+
+		~FileSink()
+		{
+			if (file)
+			{
+				std::fclose(file);
+			}
+		}
+
+		// Returns true if the file was successfully opened
+		bool IsOpen() const
+		{
+			return file != 0;
+		}
+
+		// Returns the descriptor of the file, -1 if it isn't open
+		int GetDescriptor() const
+		{
+#if defined(_MSC_VER)
+			return file ? _fileno(file) : -1;
+#else
+			return file ? fileno(file) : -1;
+#endif
+		}
+
+	protected:
+		void write(const Record&, const char* data, std::size_t length) override
+		{
+			if (file)
+			{
+				std::fwrite(data, 1, length, file);
+			}
+		}
+
+		void flush() override
+		{
+			if (file)
+			{
+				std::fflush(file);
+			}
+		}
+	};
+
+	// Writes a compact binary log, decode it with the yellog-decode tool
+	// The file starts with "YELLOGB1" and the time the sink was created (i64 nanoseconds since epoch),
+	// then each entry starts with a kind byte:
+	//	0-5		a message with that priority: varint format id, varint zigzag time delta from the previous message,
+	//			varint category id (0 if none), varint length of the arguments, then the arguments (see ArgumentEncoder)
+	//	0x10	a new format string, ids are given in order from 0: varint length, then the bytes
+	//	0x11	a new category name, ids are given in order from 1: varint length, then the bytes
+	// Every format string and category name is written once, the first time it is used
+	// Messages whose arguments are not available (e.g. {} and field messages) are stored as "%s" with the formatted text
+	// The file is overwritten when the sink is created, all integers are little-endian
+	class BinaryFileSink : public Sink
+	{
+	private:
+		static constexpr std::uint8_t format_entry = 0x10;
+		static constexpr std::uint8_t category_entry = 0x11;
+
+		std::FILE* file;
+		std::int64_t last_time;
+		std::string buffer;
+		std::string arguments;
+		std::deque<std::string> formats;
+		std::unordered_map<std::string_view, std::uint64_t> format_ids;
+		// format strings are usually literals, looking them up by address skips hashing the text
+		std::unordered_map<const char*, std::uint64_t> format_addresses;
+		std::unordered_map<const char*, std::uint64_t> category_ids;
+
+		std::uint64_t format_id(const char* format)
+		{
+			auto address = format_addresses.find(format);
+			if (address != format_addresses.end() && std::strcmp(formats[address->second].c_str(), format) == 0)
+			{
+				return address->second;
+			}
+
+			std::uint64_t id;
+			auto it = format_ids.find(std::string_view(format));
+			if (it != format_ids.end())
+			{
+				id = it->second;
+				format_addresses[format] = id;
+				return id;
+			}
+
+			id = formats.size();
+			formats.emplace_back(format);
+			format_ids.emplace(std::string_view(formats.back()), id);
+			format_addresses[format] = id;
+
+			buffer += (char)format_entry;
+			put_varint(buffer, formats.back().size());
+			buffer += formats.back();
+			return id;
+		}
+
+		std::uint64_t category_id(const char* category)
+		{
+			if (category == 0)
+			{
+				return 0;
+			}
+
+			// category names are never freed
+			auto it = category_ids.find(category);
+			if (it != category_ids.end())
+			{
+				return it->second;
+			}
+
+			std::uint64_t id = category_ids.size() + 1;
+			category_ids.emplace(category, id);
+
+			std::size_t length = std::strlen(category);
+			buffer += (char)category_entry;
+			put_varint(buffer, length);
+			buffer.append(category, length);
+			return id;
+		}
+
+	public:
+		explicit BinaryFileSink(const char* filepath, std::size_t buffer_size = BUFSIZ)
+		{
+			file = std::fopen(filepath, "wb");
+			last_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+			if (file)
+			{
+				set_buffering(file, FullBuffering, buffer_size);
+				char header[16];
+				std::memcpy(header, "YELLOGB1", 8);
+				put_integer(header + 8, (std::uint64_t)last_time, 8);
+				std::fwrite(header, 1, sizeof(header), file);
+			}
+		}
+
+		~BinaryFileSink()
+		{
+			if (file)
+			{
+				std::fclose(file);
+			}
+		}
+
+		// Returns true if the file was successfully opened
+		bool IsOpen() const
+		{
+			return file != 0;
+		}
+
+	protected:
+		void write(const Record& record, const char*, std::size_t) override
+		{
+			if (file == 0)
+			{
+				return;
+			}
+
+			buffer.clear();
+			std::uint64_t format = format_id(record.format ? record.format : "%s");
+			std::uint64_t category = category_id(record.category);
+
+			std::int64_t delta = record.time - last_time;
+			last_time = record.time;
+
+			buffer += (char)record.priority;
+			put_varint(buffer, format);
+			put_varint(buffer, ((std::uint64_t)delta << 1) ^ (std::uint64_t)(delta >> 63));
+			put_varint(buffer, category);
+
+			arguments.clear();
+			if (record.format)
+			{
+				record.encode_arguments(record.format, record.arguments, arguments);
+			}
+			else
+			{
+				// the whole formatted text, fields included, is between the message and the newline
+				std::size_t length = (std::size_t)(record.line + record.line_length - 1 - record.message);
+				arguments += 's';
+				put_varint(arguments, length);
+				arguments.append(record.message, length);
+			}
+
+			put_varint(buffer, arguments.size());
+			buffer += arguments;
+
+			std::fwrite(buffer.data(), 1, buffer.size(), file);
+		}
+
+		void flush() override
+		{
+			if (file)
+			{
+				std::fflush(file);
+			}
+		}
+	};
+
+	// Appends to a file and moves it to an archive when it gets too big or too old
+	// Archives are named filepath.1 (the newest) to filepath.N, optionally compressed on a background thread
+	// Renaming, opening, closing and compressing files happens on the background thread,
+	// the logging path only swaps the file pointer once the new file is ready
+	// Relies on an open file being renameable (POSIX)
+	class RotatingFileSink : public Sink
+	{
+	public:
+		// Compresses source into target, returns true on success (source is removed afterwards)
+		typedef std::function<bool(const std::string& source_path, const std::string& target_path)> Compressor;
+
+	private:
+		std::string path;
+		std::size_t max_size;
+		std::size_t max_files;
+		std::int64_t interval;				// nanoseconds, 0 if the file is not rotated by time
+		BufferingPolicy buffering;
+		std::size_t buffer_size;
+
+		Compressor compressor;
+		std::string compressed_extension;
+
+		// used only by the logging path
+		std::FILE* file = 0;
+		std::size_t written = 0;
+		std::int64_t next_rotation = 0;
+		bool rotation_pending = false;
+
+		// the new file opened by the background thread, picked up by the next write
+		std::atomic<std::FILE*> ready_file{ 0 };
+		std::atomic<bool> rotation_failed{ false };
+
+		std::mutex worker_mutex;
+		std::condition_variable worker_wake;
+		std::vector<std::FILE*> to_close;
+		bool rotate_requested = false;
+		bool stop = false;
+		std::thread worker;
+
+	public:
+		// max_size - rotate when the file reaches this many bytes (0 - no size limit)
+		// max_files - number of archives to keep
+		// interval_seconds - rotate at multiples of this interval of wall clock time (e.g. 3600 - every hour, 0 - no time limit)
+		RotatingFileSink(const char* filepath, std::size_t max_file_size, std::size_t max_archives = 5, std::int64_t interval_seconds = 0,
+			BufferingPolicy file_buffering = DefaultBuffering, std::size_t file_buffer_size = BUFSIZ)
+			: path(filepath), max_size(max_file_size), max_files(max_archives), interval(interval_seconds * 1000000000),
+			buffering(file_buffering), buffer_size(file_buffer_size)
+		{
+			file = open_file();
+			if (file)
+			{
+				std::fseek(file, 0, SEEK_END);
+				long size = std::ftell(file);
+				written = size > 0 ? (std::size_t)size : 0;
+			}
+
+			worker = std::thread([this] { run_worker(); });
+		}
+
+		~RotatingFileSink()
+		{
+			{
+				std::scoped_lock lock(worker_mutex);
+				stop = true;
+				worker_wake.notify_one();
+			}
+			worker.join();
+
+			if (file)
+			{
+				std::fclose(file);
+			}
+			// a rotation finished after the last message, the file closed above is already the newest archive
+			if (std::FILE* next = ready_file.exchange(0))
+			{
+				std::fclose(next);
+				archive_closed_file(compressor);
+			}
+		}
+
+		// Returns true if the file was successfully opened
+		bool IsOpen() const
+		{
+			return file != 0;
+		}
+
+		// Compress archives with the given function, extension is appended to compressed archive names (e.g. ".gz")
+		// Should be called before the sink is added to the logger
+		void SetCompressor(Compressor new_compressor, const char* extension)
+		{
+			std::scoped_lock lock(worker_mutex);
+			compressor = std::move(new_compressor);
+			compressed_extension = extension;
+		}
+
+#if defined(YELLOG_WITH_ZLIB)
+		// Gzip compressor for SetCompressor(Yellog::RotatingFileSink::GzipCompress, ".gz")
+		static bool GzipCompress(const std::string& source_path, const std::string& target_path)
+		{
+			std::FILE* source = std::fopen(source_path.c_str(), "rb");
+			if (source == 0)
+			{
+				return false;
+			}
+
+			gzFile target = gzopen(target_path.c_str(), "wb");
+			if (target == 0)
+			{
+				std::fclose(source);
+				return false;
+			}
+
+			bool success = true;
+			char chunk[1 << 16];
+			std::size_t length;
+			while ((length = std::fread(chunk, 1, sizeof(chunk), source)) != 0)
+			{
+				if (gzwrite(target, chunk, (unsigned)length) != (int)length)
+				{
+					success = false;
+					break;
+				}
+			}
+
+			std::fclose(source);
+			return gzclose(target) == Z_OK && success;
+		}
+#endif
+
+	protected:
+		void write(const Record& record, const char* data, std::size_t length) override
+		{
+			if (ready_file.load(std::memory_order_relaxed) != 0)
+			{
+				switch_file(ready_file.exchange(0, std::memory_order_acquire), record.time);
+			}
+			else if (rotation_pending && rotation_failed.exchange(false, std::memory_order_relaxed))
+			{
+				// keep writing to the current file and try again at the next limit
+				rotation_done(record.time);
+			}
+
+			if (file == 0)
+			{
+				return;
+			}
+
+			if (interval != 0 && next_rotation == 0)
+			{
+				next_rotation = (record.time / interval + 1) * interval;
+			}
+
+			std::fwrite(data, 1, length, file);
+			written += length;
+
+			if (!rotation_pending && ((max_size != 0 && written >= max_size) || (interval != 0 && record.time >= next_rotation)))
+			{
+				rotation_pending = true;
+
+				std::scoped_lock lock(worker_mutex);
+				rotate_requested = true;
+				worker_wake.notify_one();
+			}
+		}
+
+		void flush() override
+		{
+			if (file)
+			{
+				std::fflush(file);
+			}
+		}
+
+	private:
+		std::FILE* open_file()
+		{
+			std::FILE* new_file = std::fopen(path.c_str(), "a");
+			if (new_file)
+			{
+				set_buffering(new_file, buffering, buffer_size);
+			}
+			return new_file;
+		}
+
+		// Called from write(), hands the old file to the background thread to be closed and compressed
+		void switch_file(std::FILE* next, std::int64_t time)
+		{
+			std::FILE* old = file;
+			file = next;
+			rotation_done(time);
+
+			std::scoped_lock lock(worker_mutex);
+			to_close.push_back(old);
+			worker_wake.notify_one();
+		}
+
+		// Resets the limits, time is the time of the message being written
+		void rotation_done(std::int64_t time)
+		{
+			written = 0;
+			if (interval != 0)
+			{
+				next_rotation = (time / interval + 1) * interval;
+			}
+			rotation_pending = false;
+		}
+
+		std::string archive_path(std::size_t index, bool compressed) const
+		{
+			std::string archive = path + "." + std::to_string(index);
+			if (compressed)
+			{
+				archive += compressed_extension;
+			}
+			return archive;
+		}
+
+		// Body of the background thread
+		void run_worker()
+		{
+			for (;;)
+			{
+				std::vector<std::FILE*> closing;
+				bool rotate;
+				Compressor current_compressor;
+				{
+					std::unique_lock lock(worker_mutex);
+					worker_wake.wait(lock, [this] { return stop || rotate_requested || !to_close.empty(); });
+
+					if (stop && to_close.empty())
+					{
+						return;
+					}
+
+					closing.swap(to_close);
+					rotate = rotate_requested && !stop;
+					rotate_requested = false;
+					current_compressor = compressor;
+				}
+
+				// a closed file is the newest archive, it is not written to anymore
+				for (std::FILE* old : closing)
+				{
+					std::fclose(old);
+					archive_closed_file(current_compressor);
+				}
+
+				if (rotate)
+				{
+					rotate_file();
+				}
+			}
+		}
+
+		// Removes or compresses the newest archive once its file is closed
+		void archive_closed_file(const Compressor& current_compressor)
+		{
+			if (max_files == 0)
+			{
+				std::remove(archive_path(1, false).c_str());
+			}
+			else if (current_compressor && current_compressor(archive_path(1, false), archive_path(1, true)))
+			{
+				std::remove(archive_path(1, false).c_str());
+			}
+		}
+
+		// Shifts archives, moves the current file to filepath.1 and opens a new one
+		void rotate_file()
+		{
+			std::size_t last = max_files == 0 ? 1 : max_files;
+			std::remove(archive_path(last, false).c_str());
+			std::remove(archive_path(last, true).c_str());
+
+			for (std::size_t index = last - 1; index >= 1; index--)
+			{
+				std::rename(archive_path(index, false).c_str(), archive_path(index + 1, false).c_str());
+				std::rename(archive_path(index, true).c_str(), archive_path(index + 1, true).c_str());
+			}
+
+			// the logging path keeps writing to the renamed file until it picks up the new one
+			std::FILE* next = 0;
+			if (std::rename(path.c_str(), archive_path(1, false).c_str()) == 0)
+			{
+				next = open_file();
+			}
+
+			if (next)
+			{
+				ready_file.store(next, std::memory_order_release);
+			}
+			else
+			{
+				rotation_failed.store(true, std::memory_order_relaxed);
+			}
+		}
+	};
+
+#if defined(YELLOG_POSIX)
+	// Writes to a memory-mapped file without locking
+	// The file is extended and mapped in preallocated segments, each writer reserves its byte range with an atomic add
+	// and copies the message straight into the mapping, so written messages survive a crash of the process
+	// While the sink is open the file has trailing zero bytes up to the end of the current segment,
+	// it is truncated to the written length when the sink is destroyed
+	// A message longer than a segment is cut to the segment size, so segment_bytes should exceed the longest message
+	// If a segment can't be allocated or mapped (e.g. the disk is full), the messages reserved in it are dropped
+	// and their byte range stays zero in the file
+	class MappedFileSink : public Sink
+	{
+	private:
+		static constexpr std::size_t slot_count = 4;
+		static constexpr std::int64_t free_slot = -1;
+		static constexpr std::int64_t mapping_slot = -2;
+
+		// A mapped segment, segment i is kept in slots[i % slot_count]
+		struct Slot
+		{
+			std::atomic<std::int64_t> index{ free_slot };
+			std::atomic<std::size_t> committed{ 0 };	// bytes written to the segment so far
+			char* mapping = 0;
+			std::size_t mapping_size = 0;
+			char* data = 0;
+		};
+
+		int fd = -1;
+		std::size_t segment_size;
+		std::uint64_t start;							// file length when the sink was created
+		alignas(64) std::atomic<std::uint64_t> reserved{ 0 };	// bytes reserved after start
+		Slot slots[slot_count];
+
+	public:
+		// segment_size is rounded up to a multiple of the page size
+		explicit MappedFileSink(const char* filepath, std::size_t segment_bytes = 64 << 20)
+		{
+			concurrent_writes = true;
+
+			std::size_t page_size = (std::size_t)sysconf(_SC_PAGESIZE);
+			segment_size = (segment_bytes + page_size - 1) / page_size * page_size;
+			if (segment_size == 0)
+			{
+				segment_size = page_size;
+			}
+
+			fd = open(filepath, O_RDWR | O_CREAT, 0644);
+			off_t size = fd < 0 ? 0 : lseek(fd, 0, SEEK_END);
+			start = size > 0 ? (std::uint64_t)size : 0;
+		}
+
+		~MappedFileSink()
+		{
+			if (fd < 0)
+			{
+				return;
+			}
+
+			for (Slot& slot : slots)
+			{
+				if (slot.index.load(std::memory_order_acquire) >= 0 && slot.mapping)
+				{
+					munmap(slot.mapping, slot.mapping_size);
+				}
+			}
+
+			if (ftruncate(fd, (off_t)(start + reserved.load(std::memory_order_acquire))) != 0)
+			{
+				// the file keeps its trailing zero bytes
+			}
+			close(fd);
+		}
+
+		// Returns true if the file was successfully opened
+		bool IsOpen() const
+		{
+			return fd >= 0;
+		}
+
+	protected:
+		void write(const Record&, const char* data, std::size_t length) override
+		{
+			if (fd < 0 || length == 0)
+			{
+				return;
+			}
+
+			// a message can span at most two segments, a longer one is cut to the segment size
+			if (length > segment_size)
+			{
+				length = segment_size;
+			}
+
+			std::uint64_t position = reserved.fetch_add(length, std::memory_order_relaxed);
+
+			while (length != 0)
+			{
+				std::uint64_t index = position / segment_size;
+				std::size_t offset = (std::size_t)(position % segment_size);
+				std::size_t part = std::min(length, segment_size - offset);
+
+				// the bytes of a segment that failed to map are still counted so the slot gets freed
+				Slot& slot = acquire_segment((std::int64_t)index);
+				if (slot.data)
+				{
+					std::memcpy(slot.data + offset, data, part);
+				}
+				release_segment(slot, part);
+
+				data += part;
+				position += part;
+				length -= part;
+			}
+		}
+
+		void flush() override
+		{
+			for (Slot& slot : slots)
+			{
+				if (slot.index.load(std::memory_order_acquire) >= 0 && slot.mapping)
+				{
+					msync(slot.mapping, slot.mapping_size, MS_ASYNC);
+				}
+			}
+		}
+
+	private:
+		// Returns the slot holding the segment, mapping it first if no other writer did
+		// The slot has no data if the segment couldn't be mapped, it is only tried once
+		Slot& acquire_segment(std::int64_t index)
+		{
+			Slot& slot = slots[index % slot_count];
+
+			for (;;)
+			{
+				std::int64_t current = slot.index.load(std::memory_order_acquire);
+				if (current == index)
+				{
+					return slot;
+				}
+
+				// the slot is free once every byte of its previous segment is written
+				if (current == free_slot && slot.index.compare_exchange_weak(current, mapping_slot, std::memory_order_acquire))
+				{
+					if (!map_segment(slot, index))
+					{
+						slot.mapping = 0;
+						slot.mapping_size = 0;
+						slot.data = 0;
+						slot.committed.store(0, std::memory_order_relaxed);
+					}
+
+					slot.index.store(index, std::memory_order_release);
+					return slot;
+				}
+
+				std::this_thread::yield();
+			}
+		}
+
+		bool map_segment(Slot& slot, std::int64_t index)
+		{
+			std::uint64_t begin = start + (std::uint64_t)index * segment_size;
+			std::uint64_t page_size = (std::uint64_t)sysconf(_SC_PAGESIZE);
+			std::uint64_t map_begin = begin / page_size * page_size;
+
+#if defined(__linux__)
+			if (fallocate(fd, 0, (off_t)begin, (off_t)segment_size) != 0)
+#else
+			if (ftruncate(fd, (off_t)(begin + segment_size)) != 0)
+#endif
+			{
+				return false;
+			}
+
+			std::size_t mapping_size = (std::size_t)(begin - map_begin) + segment_size;
+			void* mapping = mmap(0, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)map_begin);
+			if (mapping == MAP_FAILED)
+			{
+				return false;
+			}
+
+			slot.mapping = (char*)mapping;
+			slot.mapping_size = mapping_size;
+			slot.data = slot.mapping + (begin - map_begin);
+			slot.committed.store(0, std::memory_order_relaxed);
+			return true;
+		}
+
+		// The writer that completes a segment unmaps it and frees the slot
+		void release_segment(Slot& slot, std::size_t written)
+		{
+			if (slot.committed.fetch_add(written, std::memory_order_acq_rel) + written == segment_size)
+			{
+				if (slot.mapping)
+				{
+					munmap(slot.mapping, slot.mapping_size);
+				}
+				slot.index.store(free_slot, std::memory_order_release);
+			}
+		}
+	};
+
+	// Appends to a file through a raw descriptor, messages are copied into chunks in memory
+	// and a background thread writes all pending chunks with one writev call
+	// Chunks are written when one fills up, every interval_ms milliseconds and on flush
+	// sync_policy decides when the written data is forced to disk with fdatasync (fsync where it isn't available),
+	// with SyncOnError an Error or Critical logging call returns once its message and every message before it are on disk,
+	// or once writing or syncing them failed
+	// The sink is written without the logger lock, so a call waiting for the writer (or for fdatasync) doesn't stall the other logging threads
+	// A failed writev drops the rest of the chunks it was writing, failures are counted by GetFailedWrites()
+	// and GetLastError() keeps the error of the last one, check them to know whether the messages reached the file
+	// A logging call waits for the writer when max_pending_chunks chunks are waiting to be written
+	class DirectFileSink : public Sink
+	{
+	private:
+		int fd = -1;
+		SyncPolicy sync_policy;
+		std::chrono::milliseconds interval;
+		std::size_t chunk_size;
+		std::size_t max_pending_chunks;
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable written;
+		std::string current;						// chunk being filled
+		std::vector<std::string> pending;			// full chunks waiting for the writer
+		std::vector<std::string> spare;				// written chunks kept for reuse
+		std::uint64_t write_requests = 0;			// flush and sync requests, the writer handles all requests up to it
+		std::uint64_t writes_done = 0;
+		std::uint64_t sync_requests = 0;			// the request number of the last SyncOnError message
+		bool stop = false;
+
+		std::atomic<std::uint64_t> failed_writes{ 0 };
+		std::atomic<int> last_error{ 0 };
+
+		std::thread thread;
+
+	public:
+		explicit DirectFileSink(const char* filepath, SyncPolicy sync = NoSync, int interval_ms = 100,
+			std::size_t chunk_bytes = 64 * 1024, std::size_t max_pending = 64)
+			: sync_policy(sync), interval(interval_ms), chunk_size(chunk_bytes == 0 ? 1 : chunk_bytes), max_pending_chunks(max_pending == 0 ? 1 : max_pending)
+		{
+			// every member used by write() and flush() is guarded by mutex, which waiting for the writer releases
+			concurrent_writes = true;
+
+			fd = open(filepath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+			if (fd >= 0)
+			{
+				current.reserve(chunk_size);
+				thread = std::thread([this] { run_writer(); });
+			}
+		}
+
+		~DirectFileSink()
+		{
+			if (fd < 0)
+			{
+				return;
+			}
+
+			{
+				std::scoped_lock lock(mutex);
+				stop = true;
+			}
+			wake.notify_one();
+			thread.join();
+			close(fd);
+		}
+
+		// Returns true if the file was successfully opened
+		bool IsOpen() const
+		{
+			return fd >= 0;
+		}
+
+		// Returns the number of failed writev and fdatasync calls, the messages of a failed call may be lost
+		std::uint64_t GetFailedWrites() const
+		{
+			return failed_writes.load(std::memory_order_acquire);
+		}
+
+		// Returns the errno of the last failed writev or fdatasync call (e.g. ENOSPC or EIO), 0 if none failed
+		int GetLastError() const
+		{
+			return last_error.load(std::memory_order_relaxed);
+		}
+
+	protected:
+		void write(const Record& record, const char* data, std::size_t length) override
+		{
+			if (fd < 0)
+			{
+				return;
+			}
+
+			std::unique_lock lock(mutex);
+
+			if (!current.empty() && current.size() + length > chunk_size)
+			{
+				written.wait(lock, [&] { return pending.size() < max_pending_chunks; });
+
+				pending.push_back(std::move(current));
+				current = take_spare();
+				wake.notify_one();
+			}
+			current.append(data, length);
+
+			if (sync_policy == SyncOnError && record.priority >= ErrorPriority)
+			{
+				std::uint64_t request = ++write_requests;
+				sync_requests = request;
+				wake.notify_one();
+				written.wait(lock, [&] { return writes_done >= request; });
+			}
+		}
+
+		void flush() override
+		{
+			if (fd < 0)
+			{
+				return;
+			}
+
+			std::unique_lock lock(mutex);
+			std::uint64_t request = ++write_requests;
+			wake.notify_one();
+			written.wait(lock, [&] { return writes_done >= request; });
+		}
+
+	private:
+		// Called with mutex held
+		std::string take_spare()
+		{
+			std::string chunk;
+			if (!spare.empty())
+			{
+				chunk = std::move(spare.back());
+				spare.pop_back();
+			}
+			chunk.clear();
+			chunk.reserve(chunk_size);
+			return chunk;
+		}
+
+		void run_writer()
+		{
+			std::vector<std::string> batch;
+			std::vector<iovec> vectors;
+			auto last_sync = std::chrono::steady_clock::now();
+			bool unsynced = false;
+
+			std::unique_lock lock(mutex);
+			for (;;)
+			{
+				wake.wait_for(lock, interval, [&] { return stop || !pending.empty() || write_requests != writes_done; });
+
+				batch.swap(pending);
+				if (!current.empty())
+				{
+					batch.push_back(std::move(current));
+					current = take_spare();
+				}
+				std::uint64_t requests = write_requests;
+				bool sync = sync_requests > writes_done;
+				bool stopping = stop;
+				lock.unlock();
+
+				// the logging threads may fill new chunks while these are written
+				written.notify_all();
+				write_chunks(batch, vectors);
+				unsynced = unsynced || !batch.empty();
+
+				auto now = std::chrono::steady_clock::now();
+				if (unsynced && (sync || (sync_policy == PeriodicSync && now - last_sync >= interval)))
+				{
+					sync_file();
+					last_sync = now;
+					unsynced = false;
+				}
+
+				lock.lock();
+				for (std::string& chunk : batch)
+				{
+					if (spare.size() < max_pending_chunks)
+					{
+						spare.push_back(std::move(chunk));
+					}
+				}
+				batch.clear();
+				writes_done = requests;
+				written.notify_all();
+
+				if (stopping)
+				{
+					break;
+				}
+			}
+		}
+
+		// Writes the chunks in order with as few writev calls as possible, retrying partial writes and EINTR
+		// Any other error (or a write of nothing) gives up on the remaining chunks
+		void write_chunks(const std::vector<std::string>& chunks, std::vector<iovec>& vectors)
+		{
+			vectors.clear();
+			for (const std::string& chunk : chunks)
+			{
+				vectors.push_back({ (void*)chunk.data(), chunk.size() });
+			}
+
+			std::size_t next = 0;
+			while (next < vectors.size())
+			{
+				int count = (int)std::min<std::size_t>(vectors.size() - next, IOV_MAX);
+				ssize_t result = writev(fd, &vectors[next], count);
+				if (result < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (result <= 0)
+				{
+					record_failure(result < 0 ? errno : EIO);
+					return;
+				}
+
+				std::size_t done = (std::size_t)result;
+				while (next < vectors.size() && done >= vectors[next].iov_len)
+				{
+					done -= vectors[next].iov_len;
+					next++;
+				}
+				if (done != 0)
+				{
+					vectors[next].iov_base = (char*)vectors[next].iov_base + done;
+					vectors[next].iov_len -= done;
+				}
+			}
+		}
+
+		void sync_file()
+		{
+#if defined(__linux__)
+			if (fdatasync(fd) != 0)
+#else
+			if (fsync(fd) != 0)
+#endif
+			{
+				record_failure(errno);
+			}
+		}
+
+		void record_failure(int error)
+		{
+			last_error.store(error, std::memory_order_relaxed);
+			failed_writes.fetch_add(1, std::memory_order_release);
+		}
+	};
+
+	// Writes to the console (stdout or stderr descriptor) from a background thread, logging calls never write to it
+	// Lines are appended to a buffer in memory, the writer thread writes everything buffered with one write call
+	// every interval_ms milliseconds, when half of buffer_bytes is used and on flush
+	// When buffer_bytes are waiting, overflow decides whether the logging call waits (BlockOnOverflow),
+	// the new message is dropped (DropNewestOnOverflow) or the buffered messages are dropped (DropOldestOnOverflow),
+	// dropped messages are counted and reported in the output
+	// With the drop policies, flush only wakes the writer, so a slow reader never stalls the logging threads
+	// If non_blocking is true, the descriptor is in non-blocking mode while the sink lives, so the writer can stop
+	// even if nobody reads, but other writes to it (e.g. printf to stdout) may then fail, use it instead of the default console output
+	// The sink is written without the logger lock
+	class AsyncConsoleSink : public Sink
+	{
+	private:
+		static constexpr const char* color_end = "\x1b[0m";
+
+		int fd;
+		int original_flags = -1;	// restored when the sink is destroyed, -1 if they weren't changed
+		OverflowPolicy overflow;
+		std::size_t max_buffered;
+		std::chrono::milliseconds interval;
+		std::string color_start[CriticalPriority + 1];	// escape sequence of each priority, empty if the priority isn't colored
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable written;
+		std::string buffered;				// waiting for the writer
+		std::uint64_t unreported_drops = 0;	// dropped since the last report in the output
+		std::uint64_t flush_requests = 0;
+		std::uint64_t flushes_done = 0;
+		std::atomic<std::uint64_t> dropped{ 0 };
+		std::atomic<bool> stop{ false };
+
+		std::thread thread;
+
+	public:
+		explicit AsyncConsoleSink(int descriptor = STDOUT_FILENO, ColorMode color = AutoColor, OverflowPolicy overflow_policy = DropNewestOnOverflow,
+			std::size_t buffer_bytes = 1 << 20, int interval_ms = 20, bool non_blocking = false)
+			: fd(descriptor), overflow(overflow_policy), max_buffered(buffer_bytes == 0 ? 1 : buffer_bytes), interval(interval_ms)
+		{
+			concurrent_writes = true;
+
+			const char* term = std::getenv("TERM");
+			if (color == AlwaysColor || (color == AutoColor && isatty(fd) && !std::getenv("NO_COLOR") && !(term && std::strcmp(term, "dumb") == 0)))
+			{
+				color_start[TracePriority] = "\x1b[2m";
+				color_start[DebugPriority] = "\x1b[36m";
+				color_start[WarnPriority] = "\x1b[33m";
+				color_start[ErrorPriority] = "\x1b[31m";
+				color_start[CriticalPriority] = "\x1b[1;31m";
+			}
+
+			if (non_blocking)
+			{
+				int flags = fcntl(fd, F_GETFL);
+				if (flags >= 0 && !(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0)
+				{
+					original_flags = flags;
+				}
+			}
+
+			buffered.reserve(max_buffered);
+			thread = std::thread([this] { run_writer(); });
+		}
+
+		~AsyncConsoleSink()
+		{
+			{
+				std::scoped_lock lock(mutex);
+				stop.store(true, std::memory_order_relaxed);
+			}
+			wake.notify_one();
+			written.notify_all();
+			thread.join();
+
+			if (original_flags >= 0)
+			{
+				fcntl(fd, F_SETFL, original_flags);
+			}
+		}
+
+		// Number of messages dropped because the buffer was full
+		std::uint64_t GetDroppedCount() const
+		{
+			return dropped.load(std::memory_order_relaxed);
+		}
+
+	protected:
+		void write(const Record& record, const char* data, std::size_t length) override
+		{
+			const std::string& start = color_start[record.priority];
+			std::size_t size = length + (start.empty() ? 0 : start.size() + std::strlen(color_end));
+
+			std::unique_lock lock(mutex);
+			if (buffered.size() + size > max_buffered)
+			{
+				if (overflow == BlockOnOverflow)
+				{
+					wake.notify_one();
+					written.wait(lock, [&] { return buffered.empty() || buffered.size() + size <= max_buffered || stop.load(std::memory_order_relaxed); });
+				}
+				else if (overflow == DropNewestOnOverflow)
+				{
+					unreported_drops++;
+					dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				else
+				{
+					std::uint64_t lines = (std::uint64_t)std::count(buffered.begin(), buffered.end(), '\n');
+					unreported_drops += lines;
+					dropped.fetch_add(lines, std::memory_order_relaxed);
+					buffered.clear();
+				}
+			}
+
+			if (start.empty())
+			{
+				buffered.append(data, length);
+			}
+			else
+			{
+				// the reset goes before the newline, so a terminal that wraps the line doesn't color the next one
+				bool newline = length > 0 && data[length - 1] == '\n';
+				buffered += start;
+				buffered.append(data, newline ? length - 1 : length);
+				buffered += color_end;
+				if (newline)
+				{
+					buffered += '\n';
+				}
+			}
+
+			if (buffered.size() >= max_buffered / 2 && buffered.size() - size < max_buffered / 2)
+			{
+				wake.notify_one();
+			}
+		}
+
+		void flush() override
+		{
+			std::unique_lock lock(mutex);
+			std::uint64_t request = ++flush_requests;
+			wake.notify_one();
+			if (overflow == BlockOnOverflow)
+			{
+				written.wait(lock, [&] { return flushes_done >= request || stop.load(std::memory_order_relaxed); });
+			}
+		}
+
+	private:
+		void run_writer()
+		{
+			std::string batch;
+			batch.reserve(max_buffered);
+
+			std::unique_lock lock(mutex);
+			for (;;)
+			{
+				wake.wait_for(lock, interval, [&]
+					{
+						return stop.load(std::memory_order_relaxed) || flush_requests != flushes_done || buffered.size() >= max_buffered / 2;
+					});
+
+				batch.swap(buffered);
+				if (unreported_drops)
+				{
+					char report[64];
+					int report_length = std::snprintf(report, sizeof(report), "%llu messages dropped by the console sink\n", (unsigned long long)unreported_drops);
+					batch.append(report, (std::size_t)report_length);
+					unreported_drops = 0;
+				}
+				std::uint64_t requests = flush_requests;
+				bool stopping = stop.load(std::memory_order_relaxed);
+				lock.unlock();
+
+				// the logging threads fill the other buffer while this one is written
+				written.notify_all();
+				write_all(batch.data(), batch.size());
+				batch.clear();
+
+				lock.lock();
+				flushes_done = requests;
+				written.notify_all();
+
+				if (stopping)
+				{
+					break;
+				}
+			}
+		}
+
+		// In non-blocking mode, waits for the reader and gives up after a second without progress once the sink is stopping
+		void write_all(const char* data, std::size_t length)
+		{
+			int idle_ms = 0;
+			while (length > 0)
+			{
+				ssize_t result = ::write(fd, data, length);
+				if (result > 0)
+				{
+					data += result;
+					length -= (std::size_t)result;
+					idle_ms = 0;
+				}
+				else if (result < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					pollfd output = { fd, POLLOUT, 0 };
+					::poll(&output, 1, 100);
+					idle_ms += 100;
+					if (idle_ms >= 1000 && stop.load(std::memory_order_relaxed))
+					{
+						return;
+					}
+				}
+				else
+				{
+					// the console is gone (e.g. a closed pipe), the rest is lost
+					return;
+				}
+			}
+		}
+	};
+#endif
+
+	// Keeps the last written lines in memory
+	class MemorySink : public Sink
+	{
+	private:
+		mutable std::mutex lines_mutex;
+		std::vector<std::string> lines;
+		std::size_t next = 0;
+		bool full = false;
+
+	public:
+		explicit MemorySink(std::size_t capacity = 1024) : lines(capacity == 0 ? 1 : capacity) {}
+
+		// Returns the stored lines, oldest first
+		std::vector<std::string> GetLines() const
+		{
+			std::scoped_lock lock(lines_mutex);
+
+			std::vector<std::string> result;
+			if (full)
+			{
+				result.insert(result.end(), lines.begin() + next, lines.end());
+			}
+			result.insert(result.end(), lines.begin(), lines.begin() + next);
+			return result;
+		}
+
+		void Clear()
+		{
+			std::scoped_lock lock(lines_mutex);
+			next = 0;
+			full = false;
+		}
+
+	protected:
+		void write(const Record&, const char* data, std::size_t length) override
+		{
+			std::scoped_lock lock(lines_mutex);
+
+			// the slot string keeps its capacity, so after warm-up no memory is allocated
+			lines[next].assign(data, length);
+			if (++next == lines.size())
+			{
+				next = 0;
+				full = true;
+			}
+		}
+	};
+
+	// Passes every message to a function
+	class CallbackSink : public Sink
+	{
+	public:
+		typedef std::function<void(const Record& record, const char* data, std::size_t length)> Callback;
+
+	private:
+		Callback callback;
+
+	public:
+		explicit CallbackSink(Callback new_callback) : callback(std::move(new_callback)) {}
+
+	protected:
+		void write(const Record& record, const char* data, std::size_t length) override
+		{
+			callback(record, data, length);
+		}
+	};
+
+	// Number of sub-second digits written in place of %f in the timestamp format
+	enum TimestampPrecision
+	{
+		MillisecondPrecision = 3, MicrosecondPrecision = 6, NanosecondPrecision = 9
+	};
+
+	// Snapshot of the logger counters, see Yellog::GetStats
+	// Everything except the sink byte counts is counted only while stats are enabled
+	struct Stats
+	{
+		struct SinkStats
+		{
+			std::shared_ptr<Sink> sink;
+			std::uint64_t bytes_written;
+		};
+
+		std::uint64_t emitted[CriticalPriority + 1] = {};	// messages that passed the priority check
+		std::uint64_t filtered[CriticalPriority + 1] = {};	// messages stopped by the runtime priority check
+		std::uint64_t dropped[CriticalPriority + 1] = {};	// messages dropped because the async queue was full
+		std::uint64_t async_queue_high_water = 0;	// most records queued or being written after a push in async mode
+		std::uint64_t batch_buffer_high_water = 0;	// most bytes in a thread buffer in batched mode
+		std::int64_t lock_wait_ns = 0;	// time logging calls waited for the logger lock
+		std::int64_t queue_wait_ns = 0;	// time logging calls waited for a full async queue or batch buffer
+		std::vector<SinkStats> sinks;	// the current sinks
+		std::vector<std::uint64_t> latency;	// histogram of the duration of emitting calls, see LatencyPercentile
+
+		// Sum of a counter over all priorities
+		static std::uint64_t Total(const std::uint64_t (&counts)[CriticalPriority + 1])
+		{
+			std::uint64_t total = 0;
+			for (std::uint64_t count : counts)
+			{
+				total += count;
+			}
+			return total;
+		}
+
+		// Nanoseconds that the given fraction (e.g. 0.99) of emitting calls took at most, rounded up by less than 1/8
+		std::uint64_t LatencyPercentile(double fraction) const
+		{
+			std::uint64_t count = 0;
+			for (std::uint64_t bucket_count : latency)
+			{
+				count += bucket_count;
+			}
+			if (count == 0)
+			{
+				return 0;
+			}
+
+			std::uint64_t rank = (std::uint64_t)(fraction * (double)count);
+			std::uint64_t seen = 0;
+			for (std::size_t i = 0; i < latency.size(); i++)
+			{
+				seen += latency[i];
+				if (seen > rank)
+				{
+					return latency_bucket_limit(i);
+				}
+			}
+			return latency_bucket_limit(latency.size() - 1);
+		}
+	};
+
+private:
+	// Formats packed arguments of a deferred record, follows snprintf return value convention
+	typedef int (*DeferredFormatter)(char* out, std::size_t size, const char* format, const char* packed_args);
+
+	// A single message queued for the background writer
+	// If format is null, text holds the formatted message,
+	// otherwise text holds the null-terminated printf format followed by the packed arguments (see pack_deferred)
+	// and the writer thread formats them with format(...)
+	// If field_count is not 0, text holds the null-terminated message followed by the fields in the binary format
+	struct AsyncRecord
+	{
+		LogPriority priority;
+		std::uint32_t field_count;
+		const char* priority_str;
+		const Category* category;
+		std::int64_t time;	// nanoseconds since epoch
+		DeferredFormatter format;
+		ArgumentEncoder encode;	// set with format
+		char text[YELLOG_ASYNC_MESSAGE_SIZE];
+	};
+
+	// Bounded lock-free queue (Vyukov), many logging threads push, the writer thread pops
+	// Producers may also pop to discard the oldest record when DropOldestOnOverflow is used
+	class RingBuffer
+	{
+	private:
+		struct Slot
+		{
+			std::atomic<std::size_t> sequence;
+			AsyncRecord record;
+		};
+
+		std::unique_ptr<Slot[]> slots;
+		std::size_t mask;
+
+		alignas(64) std::atomic<std::size_t> enqueue_pos{ 0 };
+		alignas(64) std::atomic<std::size_t> dequeue_pos{ 0 };
+
+	public:
+		// capacity is rounded up to a power of two
+		explicit RingBuffer(std::size_t capacity)
+		{
+			std::size_t size = 2;
+			while (size < capacity)
+			{
+				size <<= 1;
+			}
+
+			slots.reset(new Slot[size]);
+			mask = size - 1;
+
+			for (std::size_t i = 0; i < size; i++)
+			{
+				slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		std::size_t slot_count() const
+		{
+			return mask + 1;
+		}
+
+		// Reserves a slot and lets fill() write the record in place
+		// Returns false if the queue is full
+		template<typename Fill>
+		bool try_push(Fill&& fill)
+		{
+			Slot* slot;
+			std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+
+			for (;;)
+			{
+				slot = &slots[pos & mask];
+				std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+				std::intptr_t diff = (std::intptr_t)sequence - (std::intptr_t)pos;
+
+				if (diff == 0)
+				{
+					if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						break;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = enqueue_pos.load(std::memory_order_relaxed);
+				}
+			}
+
+			fill(slot->record);
+			slot->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Takes the oldest record and hands it to consume()
+		// Returns false if the queue is empty
+		template<typename Consume>
+		bool try_pop(Consume&& consume)
+		{
+			Slot* slot;
+			std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+
+			for (;;)
+			{
+				slot = &slots[pos & mask];
+				std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+				std::intptr_t diff = (std::intptr_t)sequence - (std::intptr_t)(pos + 1);
+
+				if (diff == 0)
+				{
+					if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						break;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = dequeue_pos.load(std::memory_order_relaxed);
+				}
+			}
+
+			consume(slot->record);
+			slot->sequence.store(pos + mask + 1, std::memory_order_release);
+			return true;
+		}
+	};
+
+	// Owns the queue and the background thread that drains it to the outputs
+	struct AsyncWriter
+	{
+		RingBuffer queue;
+		OverflowPolicy policy;
+		bool deferred_formatting;
+
+		std::atomic<std::uint64_t> pushed{ 0 };		// records successfully queued
+		std::atomic<std::uint64_t> done{ 0 };		// records written or discarded
+		std::atomic<std::uint64_t> dropped{ 0 };
+		std::atomic<bool> writer_waiting{ false };
+		std::atomic<bool> stop{ false };
+
+		std::mutex wake_mutex;
+		std::condition_variable wake;
+		std::condition_variable drained;
+
+		std::thread thread;
+
+		AsyncWriter(std::size_t capacity, OverflowPolicy overflow_policy, bool deferred)
+			: queue(capacity), policy(overflow_policy), deferred_formatting(deferred)
+		{}
+
+		void wake_writer()
+		{
+			if (writer_waiting.load(std::memory_order_seq_cst))
+			{
+				std::scoped_lock lock(wake_mutex);
+				wake.notify_one();
+			}
+		}
+	};
+
+	// A message waiting in a thread buffer in batched mode
+	struct BufferedRecord
+	{
+		std::int64_t time;	// nanoseconds since epoch
+		LogPriority priority;
+		std::uint32_t field_count;
+		const char* priority_str;
+		const Category* category;
+		std::size_t offset;	// of the null-terminated message in the buffer data, packed fields follow it
+	};
+
+	// Messages logged by one thread in batched mode
+	// Only the owning thread appends, the collector takes everything at once, so the mutex is almost never contended
+	struct ThreadBuffer
+	{
+		std::mutex mutex;
+		std::vector<BufferedRecord> records;
+		std::string data;
+		bool exited = false;		// the thread has exited, no more messages will be appended
+		bool wake_sent = false;		// the collector was woken because the buffer reached the batch size
+		std::atomic<std::size_t> size{ 0 };	// bytes in data, readable without the mutex
+	};
+
+	// Owned by a thread_local, marks the buffer when its thread exits, the collector writes what is left and drops it
+	struct ThreadBufferHandle
+	{
+		std::shared_ptr<ThreadBuffer> buffer;
+
+		~ThreadBufferHandle()
+		{
+			if (buffer)
+			{
+				std::scoped_lock lock(buffer->mutex);
+				buffer->exited = true;
+			}
+		}
+	};
+
+	// State of batched output, a background collector merges thread buffers and writes them to the sinks
+	struct BatchCollector
+	{
+		std::size_t batch_size;
+		std::chrono::milliseconds interval;
+
+		std::mutex buffers_mutex;
+		std::vector<std::shared_ptr<ThreadBuffer>> buffers;	// guarded by buffers_mutex
+
+		// used only by the collector thread
+		std::vector<std::shared_ptr<ThreadBuffer>> collected;
+		std::vector<ThreadBuffer> batches;
+		std::vector<Field> fields;
+
+		std::atomic<std::uint64_t> flush_requests{ 0 };
+		std::atomic<std::uint64_t> flushes_done{ 0 };
+		std::atomic<bool> wake_requested{ false };
+		std::atomic<bool> collector_waiting{ false };
+		std::atomic<bool> stop{ false };
+
+		std::mutex wake_mutex;
+		std::condition_variable wake;
+		std::condition_variable drained;
+
+		std::thread thread;
+
+		BatchCollector(std::size_t max_batch_size, int interval_ms)
+			: batch_size(max_batch_size), interval(interval_ms)
+		{}
+
+		// The collector checks wake_requested before it waits, so a request is never missed
+		void wake_collector()
+		{
+			wake_requested.store(true, std::memory_order_seq_cst);
+			if (collector_waiting.load(std::memory_order_seq_cst))
+			{
+				std::scoped_lock lock(wake_mutex);
+				wake.notify_one();
+			}
+		}
+	};
+
+	// How the data of a flight recorder slot is stored
+	enum RecentKind
+	{
+		RecentText,		// the message itself (printf messages without arguments)
+		RecentPrintf,	// the null-terminated format of a printf message followed by its arguments, see ArgumentEncoder
+		RecentBraces,	// arguments of a {} message, see encode_recent
+		RecentFields	// the null-terminated message followed by the packed fields
+	};
+
+	static constexpr std::uint64_t recent_writing = (std::uint64_t)-1;
+
+	// A message kept by the flight recorder, formatted only when it is dumped
+	struct alignas(64) RecentRecord
+	{
+		std::atomic<std::uint64_t> sequence{ 0 };	// message number + 1, recent_writing while the slot is being written, 0 if never written
+		std::int64_t time;	// nanoseconds since epoch
+		LogPriority priority;
+		RecentKind kind;
+		std::uint32_t field_count;
+		std::uint32_t length;	// bytes used in data
+		const char* priority_str;
+		const char* message;	// format string of a {} message, only used by RecentBraces
+		char data[YELLOG_ASYNC_MESSAGE_SIZE];
+	};
+
+	// Ring of the most recent messages of all priorities, every logging call takes the next slot and overwrites it
+	// A slot that is overwritten while it is dumped is skipped
+	struct FlightRecorder
+	{
+		std::unique_ptr<RecentRecord[]> slots;
+		std::size_t mask;
+
+		alignas(64) std::atomic<std::uint64_t> next{ 0 };
+		std::atomic<bool> dumping{ false };
+		bool handles_signals = false;
+
+		// capacity is rounded up to a power of two
+		explicit FlightRecorder(std::size_t capacity)
+		{
+			std::size_t size = 2;
+			while (size < capacity)
+			{
+				size <<= 1;
+			}
+
+			slots.reset(new RecentRecord[size]);
+			mask = size - 1;
+		}
+	};
+
+	// Writes encoded arguments into a flight recorder slot
+	// An argument that doesn't fit is left out with the ones after it, C-strings are truncated to fit instead
+	struct RecentWriter
+	{
+		char* pos;
+		char* end;
+		char* complete;	// end of the last argument written whole
+		bool full = false;
+
+		RecentWriter(char* out, std::size_t size) : pos(out), end(out + size), complete(out) {}
+
+		void operator+=(char c)
+		{
+			if (pos == end)
+			{
+				full = true;
+			}
+			else
+			{
+				*pos++ = c;
+			}
+		}
+
+		void append(const char* data, std::size_t size)
+		{
+			if (size > (std::size_t)(end - pos))
+			{
+				full = true;
+				pos = end;
+			}
+			else
+			{
+				std::memcpy(pos, data, size);
+				pos += size;
+			}
+		}
+
+		// Called after each argument
+		void commit()
+		{
+			if (!full)
+			{
+				complete = pos;
+			}
+		}
+
+		// Longest string that fits with its tag and length
+		std::size_t room_for_string() const
+		{
+			std::size_t room = (std::size_t)(end - pos);
+			return room > 11 ? room - 11 : 0;
+		}
+	};
+
+	// Latency histogram buckets, values below 8 ns get a bucket each,
+	// then every power of two is split into 8 buckets (like an HDR histogram with 3 bits of precision)
+	static constexpr std::size_t latency_bucket_count = 8 + 61 * 8;
+
+	static std::size_t latency_bucket(std::uint64_t nanoseconds)
+	{
+		if (nanoseconds < 8)
+		{
+			return (std::size_t)nanoseconds;
+		}
+
+		int exponent = 63;
+		while (!(nanoseconds >> exponent))
+		{
+			exponent--;
+		}
+		return (std::size_t)(exponent - 2) * 8 + (std::size_t)((nanoseconds >> (exponent - 3)) & 7);
+	}
+
+	// Largest value that goes to a bucket
+	static std::uint64_t latency_bucket_limit(std::size_t bucket)
+	{
+		if (bucket < 8)
+		{
+			return bucket;
+		}
+
+		int exponent = (int)(bucket / 8) + 2;
+		std::uint64_t base = ((std::uint64_t)8 + bucket % 8) << (exponent - 3);
+		return base + ((std::uint64_t)1 << (exponent - 3)) - 1;
+	}
+
+	// Counters of one thread, only the owning thread writes them (relaxed load and store, no atomic read-modify-write),
+	// GetStats reads all of them
+	struct alignas(64) StatsShard
+	{
+		std::atomic<std::uint64_t> emitted[CriticalPriority + 1] = {};
+		std::atomic<std::uint64_t> filtered[CriticalPriority + 1] = {};
+		std::atomic<std::uint64_t> dropped[CriticalPriority + 1] = {};
+		std::atomic<std::uint64_t> async_queue_high_water{ 0 };
+		std::atomic<std::uint64_t> batch_buffer_high_water{ 0 };
+		std::atomic<std::int64_t> lock_wait{ 0 };
+		std::atomic<std::int64_t> queue_wait{ 0 };
+		std::atomic<std::uint64_t> latency[latency_bucket_count] = {};
+		std::atomic<bool> exited{ false };	// the thread has exited, the counters are moved to the totals by the next GetStats
+
+		template<typename T>
+		static void add(std::atomic<T>& counter, T value)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		static void raise_to(std::atomic<std::uint64_t>& high_water, std::uint64_t value)
+		{
+			if (value > high_water.load(std::memory_order_relaxed))
+			{
+				high_water.store(value, std::memory_order_relaxed);
+			}
+		}
+	};
+
+	// Owned by a thread_local, marks the shard when its thread exits
+	struct ThreadStatsHandle
+	{
+		std::shared_ptr<StatsShard> shard;
+
+		~ThreadStatsHandle()
+		{
+			if (shard)
+			{
+				shard->exited.store(true, std::memory_order_release);
+			}
+		}
+	};
+
+#if defined(YELLOG_DISABLE_RUNTIME_PRIORITY)
+	static constexpr bool runtime_priority = false;
+#else
+	static constexpr bool runtime_priority = true;
+#endif
+
+	std::atomic<LogPriority> priority{ InfoPriority };	// changed with config_mutex held, logging threads read Settings::priority
+	std::mutex log_mutex;
+
+	// Lowest priority that the logger priority or any thread or category override lets through,
+	// plus has_overrides_flag if any override is set, so that most messages are resolved by a single relaxed load
+	static constexpr int has_overrides_flag = 0x100;
+	std::atomic<int> priority_state{ InfoPriority };
+
+	// guards categories, override_counts and the sources of the published Settings, never taken when logging
+	std::mutex config_mutex;
+	std::map<std::string, std::unique_ptr<Category>> categories;
+	int override_counts[CriticalPriority + 1] = {};
+
+	std::unique_ptr<AsyncWriter> async_writer;
+	std::atomic<bool> async_enabled{ false };
+
+	std::unique_ptr<BatchCollector> batch_collector;
+	std::atomic<bool> batched_enabled{ false };
+
+	// guarded by config_mutex, never freed once created
+	std::unique_ptr<FlightRecorder> flight_recorder;
+	std::atomic<bool> recorder_enabled{ false };
+	// where the flight recorder is dumped, the descriptor of the file output or -1 for stderr
+	std::atomic<int> dump_descriptor{ -1 };
+	// local time minus UTC in seconds, the dump can't call localtime
+	std::atomic<std::int64_t> utc_offset{ 0 };
+
+	// Sinks and settings of the configuration file, guarded by config_file_mutex (taken before log_mutex and config_mutex)
+	struct ConfigSink
+	{
+		std::string definition;	// the value of the sink line, the sink is reopened only when it changes
+		std::string category;	// empty for a logger sink
+		std::shared_ptr<Sink> sink;
+	};
+	std::mutex config_file_mutex;
+	std::map<std::string, ConfigSink> config_sinks;	// by name
+	std::set<std::string> config_categories;	// categories whose priority or additivity the last file set
+	std::deque<std::string> config_strings;	// strings given to the logger without copying, kept while it lives
+	std::thread config_watcher;
+	std::atomic<bool> stop_config_watcher{ false };
+
+	std::atomic<bool> stats_enabled{ false };
+	std::atomic<std::int64_t> stats_report_interval{ 0 };	// nanoseconds, 0 if there is no report
+	std::atomic<std::int64_t> next_stats_report{ 0 };
+	// guarded by stats_mutex
+	std::mutex stats_mutex;
+	std::vector<std::shared_ptr<StatsShard>> stats_shards;
+	Stats exited_stats;	// counters of exited threads
+	
+	// Logger sinks, settings and the file output, guarded by config_mutex
+	// Logging threads don't read them, they read the published Settings
+	std::vector<std::shared_ptr<Sink>> sinks;
+	std::shared_ptr<ConsoleSink> console_sink;
+	std::shared_ptr<FileSink> file_sink;
+	const char* filepath = 0;
+	std::atomic<const char*> timestamp_format{ "%T  %d-%m-%Y" };	// also read by the flight recorder dump
+	std::atomic<int> timestamp_digits{ MillisecondPrecision };
+
+	typedef std::vector<std::shared_ptr<Sink>> SinkList;
+
+	// Everything a logging call reads besides the thread override, an immutable snapshot of the settings above,
+	// so that a change of several of them (e.g. a configuration reload) is seen all at once
+	struct Settings
+	{
+		struct CategorySettings
+		{
+			const Category* category = 0;
+			int priority = -1;
+			bool additive = true;
+			SinkList sinks;
+		};
+
+		LogPriority priority = InfoPriority;
+		const char* timestamp_format = 0;
+		int timestamp_digits = MillisecondPrecision;
+		SinkList concurrent_sinks;	// sinks with concurrent_writes, written without log_mutex
+		SinkList locked_sinks;		// written with log_mutex held
+		std::vector<CategorySettings> categories;	// by Category::index, categories created later have the defaults
+
+		const CategorySettings* find(const Category* category) const
+		{
+			return category && category->index < categories.size() ? &categories[category->index] : 0;
+		}
+	};
+
+	// The current settings, replaced with a single store by publish_settings (with config_mutex held),
+	// a replaced snapshot is freed only when no thread is reading it
+	std::atomic<const Settings*> settings{ 0 };
+	std::unique_ptr<Settings> published_settings;	// guarded by config_mutex
+
+	// The settings a thread is reading, 0 when it isn't (a hazard pointer)
+	struct alignas(64) SettingsReader
+	{
+		std::atomic<const Settings*> settings{ 0 };
+		std::atomic<bool> exited{ false };
+	};
+
+	// Owned by a thread_local, marks the reader when its thread exits
+	struct ThreadSettingsReaderHandle
+	{
+		std::shared_ptr<SettingsReader> reader;
+
+		~ThreadSettingsReaderHandle()
+		{
+			if (reader)
+			{
+				reader->exited.store(true, std::memory_order_release);
+			}
+		}
+	};
+
+	// guarded by settings_readers_mutex
+	std::mutex settings_readers_mutex;
+	std::vector<std::shared_ptr<SettingsReader>> settings_readers;
+
+	// Keeps the settings it returns from being freed while the calling thread uses them
+	// A nested guard on the same thread returns the settings of the outer one
+	struct SettingsGuard
+	{
+		Yellog& logger;
+		SettingsReader* reader = 0;
+		const Settings* current = 0;
+		bool outermost = false;
+
+		explicit SettingsGuard(Yellog& logger_instance) : logger(logger_instance) {}
+
+		~SettingsGuard()
+		{
+			if (outermost)
+			{
+				reader->settings.store(0, std::memory_order_release);
+			}
+		}
+
+		// Reads the current settings on the first call, later calls return the same snapshot
+		const Settings& get()
+		{
+			if (!current)
+			{
+				reader = &logger.settings_reader();
+				current = reader->settings.load(std::memory_order_relaxed);
+				outermost = current == 0;
+				if (outermost)
+				{
+					current = logger.read_settings(*reader);
+				}
+			}
+			return *current;
+		}
+
+		SettingsGuard(const SettingsGuard&) = delete;
+		SettingsGuard& operator= (const SettingsGuard&) = delete;
+	};
+
+	// Timestamps are taken from steady_clock and shifted by clock_offset to wall clock time,
+	// the offset is recalculated at most once per clock_sync_interval
+	static constexpr std::int64_t clock_sync_interval = 60000000000;
+	std::atomic<std::int64_t> clock_offset{ 0 };
+	std::atomic<std::int64_t> clock_synced_at{ 0 };
+
+	static constexpr std::size_t timestamp_size = 96;
+	static constexpr std::size_t no_fraction = (std::size_t)-1;
+
+	// Formatted timestamp of the last second seen by a thread,
+	// strftime runs only when the second (or the format) changes, sub-second digits are patched in place
+	struct TimestampCache
+	{
+		std::int64_t second = -1;
+		const char* format = 0;
+		int digits = 0;
+		std::size_t fraction_offset = no_fraction;
+		char text[timestamp_size] = {};
+	};
+
+public:
+	// Set desired priority for the logger (messages with lower priority will not be recorded)
+	// The default priority is Yellog::InfoPriority
+	// Has no effect if YELLOG_DISABLE_RUNTIME_PRIORITY is defined
+	static void SetPriority(LogPriority new_priority)
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.priority.store(new_priority, std::memory_order_relaxed); });
+	}
+
+	// Get the current logger priority (messages with lower priority will not be recorded)
+	// The default priority is Yellog::InfoPriority
+	static LogPriority GetPriority()
+	{
+		return get_instance().priority.load(std::memory_order_relaxed);
+	}
+
+	// Set priority for messages logged from the calling thread, overrides category and logger priority
+	static void SetThreadPriority(LogPriority new_priority)
+	{
+		get_instance().set_thread_priority(thread_override().priority, new_priority);
+	}
+
+	// Remove the calling thread priority override
+	static void ResetThreadPriority()
+	{
+		get_instance().set_thread_priority(thread_override().priority, -1);
+	}
+
+	// Returns the category with the given name, creating it if it doesn't exist
+	// Lookup takes a lock, so get the category once and keep the reference
+	static Category& GetCategory(const char* name)
+	{
+		Yellog& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.config_mutex);
+		return logger_instance.get_category(name);
+	}
+
+	// Returns the named logger, the same as Yellog::GetCategory
+	// Get it once and keep the reference, logging through it involves no lookup
+	static Category& Get(const char* name)
+	{
+		return GetCategory(name);
+	}
+
+	// Set priority for messages logged through the category, overrides logger priority
+	static void SetCategoryPriority(const char* name, LogPriority new_priority)
+	{
+		GetCategory(name).SetPriority(new_priority);
+	}
+
+	// Remove the category priority override, the category will use the logger priority
+	static void ResetCategoryPriority(const char* name)
+	{
+		GetCategory(name).ResetPriority();
+	}
+
+	// Enable file output
+	// Logs will be written to /log.txt
+	// If the file doesn't exist, it will create it automatically
+	// File will be closed when program stops
+	// Returns true if a file was successfully opened, false otherwise
+	static bool EnableFileOutput()
+	{
+		return get_instance().enable_file_output("log.txt");
+	}
+
+	// Enable file output
+	// Logs will be written to /filepath, provided the filepath is valid
+	// If the file doesn't exist, it will create it automatically
+	// File will be closed when program stops
+	// Returns true if a file was successfully opened, false otherwise
+	static bool EnableFileOutput(const char* new_filepath)
+	{
+		return get_instance().enable_file_output(new_filepath);
+	}
+
+	// Returns the current filepath for file logging
+	// if Yellog::EnableFileOutput was called without specifying a filepath, the filepath will be "log.txt"
+	// if file output was not enabled, the filepath will contain NULL
+	static const char* GetFilepath()
+	{
+		Yellog& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.config_mutex);
+		return logger_instance.filepath;
+	}
+
+	// Returns true is file output was enabled and file was successfully opened, false if it wasn't
+	static bool IsFileOutputEnabled()
+	{
+		Yellog& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.config_mutex);
+		return logger_instance.file_sink != 0;
+	}
+
+	// Stop writing to the file opened by Yellog::EnableFileOutput and close it
+	static void DisableFileOutput()
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.free_file(); });
+	}
+
+	// Console output is enabled by default
+	static void EnableConsoleOutput()
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.set_console_output(true); });
+	}
+
+	// Stop writing messages to stdout, other sinks are not affected
+	static void DisableConsoleOutput()
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.set_console_output(false); });
+	}
+
+	// Returns true if messages are written to stdout
+	static bool IsConsoleOutputEnabled()
+	{
+		Yellog& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.config_mutex);
+		return logger_instance.console_sink != 0;
+	}
+
+	// Add an output, every message that passes the logger and the sink priority will be written to it
+	static void AddSink(std::shared_ptr<Sink> sink)
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.sinks.push_back(std::move(sink)); });
+	}
+
+	// Remove an output added with Yellog::AddSink
+	// The logger releases the sink once no thread is writing to it
+	static void RemoveSink(const std::shared_ptr<Sink>& sink)
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.remove_sink(sink); });
+	}
+
+	// Set a log timestamp format
+	// Format follows <ctime> strftime format specification, plus %f for sub-second digits (see Yellog::SetTimestampPrecision)
+	// Default format is "%T  %d-%m-%Y" (e.g. 13:20:25  14-02-2021)
+	// 4 spaces are added automatically to the end of timestamp each time the message is logged
+	// The string is not copied, it must stay valid while the logger is used
+	static void SetTimestampFormat(const char* new_timestamp_format)
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.timestamp_format.store(new_timestamp_format, std::memory_order_relaxed); });
+	}
+
+	// Get the current log timestamp format
+	// Format follows <ctime> strftime format specification
+	// Default format is "%T  %d-%m-%Y" (e.g. 13:20:25  14-02-2021)
+	static const char* GetTimestampFormat()
+	{
+		return get_instance().timestamp_format.load(std::memory_order_relaxed);
+	}
+
+	// Set how many sub-second digits %f in the timestamp format is replaced with
+	// The default precision is Yellog::MillisecondPrecision (e.g. "%T.%f" gives 13:20:25.042)
+	static void SetTimestampPrecision(TimestampPrecision new_precision)
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.change_settings([&] { logger_instance.timestamp_digits.store(new_precision, std::memory_order_relaxed); });
+	}
+
+	// Get the current sub-second timestamp precision
+	static TimestampPrecision GetTimestampPrecision()
+	{
+		return (TimestampPrecision)get_instance().timestamp_digits.load(std::memory_order_relaxed);
+	}
+
+	// Enable async output
+	// Logging calls only put the formatted message in a bounded queue of the given capacity,
+	// a background thread writes queued messages to the sinks
+	// policy decides what happens when the queue is full (block the caller, drop the new message or drop the oldest queued one)
+	// Messages longer than YELLOG_ASYNC_MESSAGE_SIZE - 1 characters are truncated
+	// If deferred_formatting is true, logging calls only copy the format and the arguments (primitives, void pointers, C-strings)
+	// and the background thread does the printf formatting,
+	// C-strings printed with %s are copied and truncated so that all arguments fit in YELLOG_ASYNC_MESSAGE_SIZE bytes,
+	// other C-string arguments (e.g. printed with %p) only as pointers
+	// Messages whose format and arguments don't fit, or whose format uses positional arguments (%1$s), are formatted right away
+	// Should be called once, before using the logger, it can't be used together with batched output
+	// Returns true if async output was enabled, false if it (or batched output) is already enabled
+	static bool EnableAsyncOutput(std::size_t capacity = 8192, OverflowPolicy policy = BlockOnOverflow, bool deferred_formatting = false)
+	{
+		return get_instance().enable_async_output(capacity, policy, deferred_formatting);
+	}
+
+	// Returns true if async output was enabled
+	static bool IsAsyncOutputEnabled()
+	{
+		return get_instance().async_enabled.load(std::memory_order_acquire);
+	}
+
+	// Enable batched output
+	// Each thread formats its messages into its own buffer without taking any shared lock,
+	// a background thread collects the buffers, merges them in timestamp order and writes them to the sinks in batches
+	// Buffers are collected every interval_ms milliseconds, as soon as a buffer holds batch_size bytes,
+	// and right away after an Error or Critical message (the sinks are flushed after such a batch)
+	// A thread that logs more than 4 * batch_size bytes before its buffer is collected waits for the collector
+	// Messages of one thread keep their order, messages of different threads are in timestamp order within a batch,
+	// a message logged while a batch is being collected can go to the next batch, after messages with a later timestamp
+	// Messages left in the buffer of an exited thread are written with the next batch
+	// Should be called once, before using the logger, it can't be used together with async output
+	// Returns true if batched output was enabled, false if it (or async output) is already enabled
+	static bool EnableBatchedOutput(std::size_t batch_size = 64 * 1024, int interval_ms = 100)
+	{
+		return get_instance().enable_batched_output(batch_size, interval_ms);
+	}
+
+	// Returns true if batched output was enabled
+	static bool IsBatchedOutputEnabled()
+	{
+		return get_instance().batched_enabled.load(std::memory_order_acquire);
+	}
+
+	// Wait until every message logged before this call is written, then flush every sink
+	// Queued messages are also drained automatically when program stops
+	static void Flush()
+	{
+		get_instance().flush();
+	}
+
+	// Start counting emitted, filtered and dropped messages per priority, queue high water marks,
+	// time spent waiting for the logger lock or a full queue, and the duration of emitting logging calls
+	// Counters are kept per thread, so counting takes no shared lock or atomic read-modify-write
+	// If report_interval_seconds is not 0, a summary is logged with Info priority at most once per interval
+	static void EnableStats(int report_interval_seconds = 0)
+	{
+		Yellog& logger_instance = get_instance();
+		std::int64_t interval = (std::int64_t)report_interval_seconds * 1000000000;
+		logger_instance.stats_report_interval.store(interval, std::memory_order_relaxed);
+		logger_instance.next_stats_report.store(logger_instance.now() + interval, std::memory_order_relaxed);
+		logger_instance.stats_enabled.store(true, std::memory_order_relaxed);
+	}
+
+	// Stop counting, the counters keep their values
+	static void DisableStats()
+	{
+		get_instance().stats_enabled.store(false, std::memory_order_relaxed);
+	}
+
+	// Returns the counters summed over all threads (see Yellog::EnableStats) and the bytes written to each current sink
+	static Stats GetStats()
+	{
+		return get_instance().get_stats();
+	}
+
+	// Enable the flight recorder
+	// The last capacity messages of every priority, including the ones filtered out by priority, are kept in memory
+	// Logging calls only copy the format string and the arguments, messages are formatted when they are dumped with Yellog::DumpRecent
+	// C-strings printed with %s are copied, other C-string arguments (e.g. printed with %p) only as pointers
+	// If handle_signals is true, the messages are also dumped on SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL (POSIX only),
+	// then the previous handler is restored and the signal is raised again
+	// Calls removed by YELLOG_ACTIVE_LEVEL are not recorded
+	// The capacity of the first call is kept, capacity is rounded up to a power of two
+	// Returns true if the flight recorder was enabled, false if it is already enabled
+	static bool EnableFlightRecorder(std::size_t capacity = 1024, bool handle_signals = true)
+	{
+		return get_instance().enable_flight_recorder(capacity, handle_signals);
+	}
+
+	// Stop recording messages and remove the signal handlers, recorded messages can still be dumped
+	static void DisableFlightRecorder()
+	{
+		get_instance().disable_flight_recorder();
+	}
+
+	// Returns true if the flight recorder was enabled
+	static bool IsFlightRecorderEnabled()
+	{
+		return get_instance().recorder_enabled.load(std::memory_order_acquire);
+	}
+
+	// Flush the outputs, then write the messages kept by the flight recorder to the file output (stderr if it isn't enabled)
+	// The dump only uses async-signal-safe calls, the timestamp format supports %Y %y %m %d %H %M %S %T %F %R %f and %%
+	static void DumpRecent()
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.flush();
+
+		FlightRecorder* recorder;
+		{
+			std::scoped_lock lock(logger_instance.config_mutex);
+			recorder = logger_instance.flight_recorder.get();
+		}
+		if (recorder)
+		{
+			logger_instance.dump_recent(*recorder, 0);
+		}
+	}
+
+	// Apply a configuration file (see the readme for the format), only the settings present in the file are changed
+	// The whole file is checked and its sinks are opened before anything is changed, if something fails nothing is applied
+	// and the problem is logged as an error
+	// Sinks of the file are swapped in one step, logging threads keep reading the settings without taking a lock
+	// Returns true if the file was applied
+	static bool LoadConfig(const char* filepath)
+	{
+		return get_instance().load_config(filepath);
+	}
+
+	// Load a configuration file and apply it again whenever it changes (watched with inotify on Linux, polled every second elsewhere)
+	// Returns false if a file is already watched or if the first load failed, the file is watched anyway
+	static bool WatchConfig(const char* filepath)
+	{
+		Yellog& logger_instance = get_instance();
+		{
+			std::scoped_lock lock(logger_instance.config_file_mutex);
+			if (logger_instance.config_watcher.joinable())
+			{
+				return false;
+			}
+			logger_instance.config_watcher = std::thread([&logger_instance, path = std::string(filepath)] { logger_instance.watch_config(path); });
+		}
+		return logger_instance.load_config(filepath);
+	}
+
+	// Log a message (format + optional args, follow printf specification)
+	// with log priority level Yellog::TracePriority
+	template<typename... Args>
+	static void Trace(const char* message, Args... args)
+	{
+		if constexpr (TracePriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log<TracePriority>(0, "[Trace]    ", message, args...);
+		}
+	}
+
+	// Log a message (format + optional args, follow printf specification)
+	// with log priority level Yellog::DebugPriority
+	template<typename... Args>
+	static void Debug(const char* message, Args... args)
+	{
+		if constexpr (DebugPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log<DebugPriority>(0, "[Debug]    ", message, args...);
+		}
+	}
+
+	// Log a message (format + optional args, follow printf specification)
+	// with log priority level Yellog::InfoPriority
+	template<typename... Args>
+	static void Info(const char* message, Args... args)
+	{
+		if constexpr (InfoPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log<InfoPriority>(0, "[Info]     ", message, args...);
+		}
+	}
+
+	// Log a message (format + optional args, follow printf specification)
+	// with log priority level Yellog::WarnPriority
+	template<typename... Args>
+	static void Warn(const char* message, Args... args)
+	{
+		if constexpr (WarnPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log<WarnPriority>(0, "[Warn]     ", message, args...);
+		}
+	}
+
+	// Log a message (format + optional args, follow printf specification)
+	// with log priority level Yellog::ErrorPriority
+	template<typename... Args>
+	static void Error(const char* message, Args... args)
+	{
+		if constexpr (ErrorPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log<ErrorPriority>(0, "[Error]    ", message, args...);
+		}
+	}
+
+	// Log a message (format + optional args, follow printf specification)
+	// with log priority level Yellog::CriticalPriority
+	template<typename... Args>
+	static void Critical(const char* message, Args... args)
+	{
+		if constexpr (CriticalPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log<CriticalPriority>(0, "[Crit]     ", message, args...);
+		}
+	}
+
+	// Log a message ({} format made with YELLOG_FMT + args, checked at compile time)
+	// with log priority level Yellog::TracePriority
+	template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+	static void Trace(Format format, const Args&... args)
+	{
+		if constexpr (TracePriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log_format<TracePriority>(0, "[Trace]    ", format, args...);
+		}
+	}
+
+	// Log a message ({} format made with YELLOG_FMT + args, checked at compile time)
+	// with log priority level Yellog::DebugPriority
+	template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+	static void Debug(Format format, const Args&... args)
+	{
+		if constexpr (DebugPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log_format<DebugPriority>(0, "[Debug]    ", format, args...);
+		}
+	}
+
+	// Log a message ({} format made with YELLOG_FMT + args, checked at compile time)
+	// with log priority level Yellog::InfoPriority
+	template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+	static void Info(Format format, const Args&... args)
+	{
+		if constexpr (InfoPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log_format<InfoPriority>(0, "[Info]     ", format, args...);
+		}
+	}
+
+	// Log a message ({} format made with YELLOG_FMT + args, checked at compile time)
+	// with log priority level Yellog::WarnPriority
+	template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+	static void Warn(Format format, const Args&... args)
+	{
+		if constexpr (WarnPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log_format<WarnPriority>(0, "[Warn]     ", format, args...);
+		}
+	}
+
+	// Log a message ({} format made with YELLOG_FMT + args, checked at compile time)
+	// with log priority level Yellog::ErrorPriority
+	template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+	static void Error(Format format, const Args&... args)
+	{
+		if constexpr (ErrorPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log_format<ErrorPriority>(0, "[Error]    ", format, args...);
+		}
+	}
+
+	// Log a message ({} format made with YELLOG_FMT + args, checked at compile time)
+	// with log priority level Yellog::CriticalPriority
+	template<typename Format, typename... Args, typename = std::enable_if_t<std::is_base_of_v<FormatString, Format>>>
+	static void Critical(Format format, const Args&... args)
+	{
+		if constexpr (CriticalPriority >= YELLOG_ACTIVE_LEVEL)
+		{
+			get_instance().log_format<CriticalPriority>(0, "[Crit]     ", format, args...);
+		}
+	}
+
+private:
+	Yellog()
+	{
+		sync_clock(steady_nanoseconds());
+
+		console_sink = std::make_shared<ConsoleSink>();
+		sinks.push_back(console_sink);
+		publish_settings();
+	}
+
+	Yellog(const Yellog&) = delete;
+	Yellog& operator= (const Yellog&) = delete;
+
+	~Yellog()
+	{
+		stop_config_watcher.store(true, std::memory_order_relaxed);
+		if (config_watcher.joinable())
+		{
+			config_watcher.join();
+		}
+		disable_flight_recorder();
+		stop_async_output();
+		stop_batched_output();
+		flush_sinks();
+		sinks.clear();
+		console_sink.reset();
+		file_sink.reset();
+		settings.store(0);
+		published_settings.reset();
+	}
+
+	static Yellog& get_instance()
+	{
+		static Yellog instance;
+		
+		return instance;
+	}
+
+	// Priority override of a thread, removed when the thread exits
+	struct ThreadOverride
+	{
+		std::atomic<int> priority{ -1 };
+
+		~ThreadOverride()
+		{
+			if (priority.load(std::memory_order_relaxed) != -1)
+			{
+				get_instance().set_thread_priority(priority, -1);
+			}
+		}
+	};
+
+	static ThreadOverride& thread_override()
+	{
+		static thread_local ThreadOverride instance;
+		return instance;
+	}
+
+	void set_thread_priority(std::atomic<int>& thread_priority, int new_priority)
+	{
+		std::scoped_lock lock(config_mutex);
+		set_override(thread_priority, new_priority);
+		update_lowest_priority();
+	}
+
+	// A category override is part of the settings, the other threads see it with the next snapshot
+	void set_category_priority(Category& category, int new_priority)
+	{
+		change_settings([&] { set_override(category.priority, new_priority); });
+	}
+
+	// Called with config_mutex held, sets a thread or category override (-1 removes it)
+	// update_lowest_priority (or publish_settings) is called after it
+	void set_override(std::atomic<int>& override_priority, int new_priority)
+	{
+		int old_priority = override_priority.exchange(new_priority, std::memory_order_relaxed);
+		if (old_priority != -1)
+		{
+			override_counts[old_priority]--;
+		}
+		if (new_priority != -1)
+		{
+			override_counts[new_priority]++;
+		}
+	}
+
+	// Called with config_mutex held
+	void update_lowest_priority()
+	{
+		int lowest = priority.load(std::memory_order_relaxed);
+		int has_overrides = 0;
+
+		for (int level = CriticalPriority; level >= TracePriority; level--)
+		{
+			if (override_counts[level] != 0)
+			{
+				has_overrides = has_overrides_flag;
+				if (level < lowest)
+				{
+					lowest = level;
+				}
+			}
+		}
+
+		priority_state.store(lowest | has_overrides, std::memory_order_relaxed);
+	}
+
+	// Runtime priority check, skipped where the result is known at compile time
+	// Thread override is used first, then category override, then logger priority
+	// The category and logger priorities are read from the settings of guard, the message is then written with the same ones
+	template<LogPriority message_priority>
+	bool is_enabled(const Category* category, SettingsGuard& guard)
+	{
+		if constexpr (!runtime_priority || message_priority == CriticalPriority)
+		{
+			return true;
+		}
+		else
+		{
+			int state = priority_state.load(std::memory_order_relaxed);
+			if (message_priority < (state & ~has_overrides_flag))
+			{
+				return false;
+			}
+
+			// without overrides the lowest priority is the logger priority
+			if (!(state & has_overrides_flag))
+			{
+				return true;
+			}
+
+			int override_priority = thread_override().priority.load(std::memory_order_relaxed);
+			if (override_priority == -1)
+			{
+				const Settings& current = guard.get();
+				const Settings::CategorySettings* category_settings = current.find(category);
+				override_priority = category_settings ? category_settings->priority : -1;
+				if (override_priority == -1)
+				{
+					override_priority = current.priority;
+				}
+			}
+
+			return override_priority <= message_priority;
+		}
+	}
+
+	template<LogPriority message_priority, typename... Args>
+	void log(const Category* category, const char* message_priority_str, const char* message, Args... args)
+	{
+		if constexpr (sizeof...(Args) > 0 && (std::is_same_v<Args, Field> && ...))
+		{
+			const Field fields[] = { args... };
+			log_fields<message_priority>(category, message_priority_str, message, fields, sizeof...(Args));
+		}
+		else
+		{
+			static_assert(!(std::is_same_v<Args, Field> || ...), "Yellog: fields can't be mixed with printf arguments");
+
+			if (recorder_enabled.load(std::memory_order_acquire))
+			{
+				if constexpr (sizeof...(Args) == 0)
+				{
+					record_recent(message_priority, message_priority_str, RecentText, 0, [&](RecentRecord& recent)
+					{
+						std::size_t length = std::min(std::strlen(message), sizeof(recent.data));
+						std::memcpy(recent.data, message, length);
+						return length;
+					});
+				}
+				else
+				{
+					record_recent(message_priority, message_priority_str, RecentPrintf, 0, [&](RecentRecord& recent)
+					{
+						// the format is copied, it may not outlive the call, and a C-string only with its %s
+						std::size_t format_length = std::min(std::strlen(message), sizeof(recent.data) - 1);
+						std::memcpy(recent.data, message, format_length);
+						recent.data[format_length] = '\0';
+
+						std::uint64_t strings = 0;
+						if constexpr ((is_c_string<Args> || ...))
+						{
+							string_arguments(message, strings);
+						}
+
+						std::size_t index = 0;
+						RecentWriter out(recent.data + format_length + 1, sizeof(recent.data) - format_length - 1);
+						auto encode = [&](auto arg)
+						{
+							bool is_string = index < 64 && (strings >> index & 1) != 0;
+							index++;
+							if constexpr (is_c_string<decltype(arg)>)
+							{
+								if (!is_string)
+								{
+									encode_recent<false>(out, (const void*)arg);
+									return;
+								}
+							}
+							encode_recent<false>(out, arg);
+						};
+						(encode(args), ...);
+						return (std::size_t)(out.complete - recent.data);
+					});
+				}
+			}
+
+			SettingsGuard guard(*this);
+			if (is_enabled<message_priority>(category, guard))
+			{
+				CallStats call_stats(*this, message_priority);
+				std::int64_t current_time = now();
+
+				if (batched_enabled.load(std::memory_order_acquire))
+				{
+					push_batched(message_priority, category, message_priority_str, current_time,
+						[&](char* out, std::size_t size) { return std::snprintf(out, size, message, args...); });
+					return;
+				}
+
+				if (async_enabled.load(std::memory_order_acquire))
+				{
+					push_async(message_priority, category, message_priority_str, current_time,
+						[&](AsyncRecord& record)
+						{
+							if constexpr ((is_deferrable<Args> && ...) && min_packed_size<Args...>() <= YELLOG_ASYNC_MESSAGE_SIZE)
+							{
+								if (async_writer->deferred_formatting && pack_deferred(record.text, message, args...))
+								{
+									record.format = &format_deferred<Args...>;
+									record.encode = &encode_deferred<Args...>;
+									return;
+								}
+							}
+
+							std::snprintf(record.text, YELLOG_ASYNC_MESSAGE_SIZE, message, args...);
+						});
+					return;
+				}
+
+				Record record = make_record(guard.get(), message_priority, category, message_priority_str, current_time);
+				auto format_message = [&](char* out, std::size_t size) { return std::snprintf(out, size, message, args...); };
+
+				if constexpr ((is_deferrable<Args> && ...))
+				{
+					const std::tuple<Args...> arguments{ args... };
+					record.format = message;
+					record.encode_arguments = &encode_arguments<Args...>;
+					record.arguments = &arguments;
+					write_message(guard.get(), category, record, format_message);
+				}
+				else
+				{
+					write_message(guard.get(), category, record, format_message);
+				}
+			}
+			else
+			{
+				count_filtered(message_priority);
+			}
+		}
+	}
+
+	// Same as log(), with structured fields instead of printf arguments
+	template<LogPriority message_priority>
+	void log_fields(const Category* category, const char* message_priority_str, const char* message, const Field* fields, std::size_t field_count)
+	{
+		if (recorder_enabled.load(std::memory_order_acquire))
+		{
+			record_recent(message_priority, message_priority_str, RecentFields, 0, [&](RecentRecord& recent)
+			{
+				recent.field_count = pack_fields(recent.data, sizeof(recent.data), message, fields, field_count);
+				return sizeof(recent.data);
+			});
+		}
+
+		SettingsGuard guard(*this);
+		if (is_enabled<message_priority>(category, guard))
+		{
+			CallStats call_stats(*this, message_priority);
+			std::int64_t current_time = now();
+
+			if (batched_enabled.load(std::memory_order_acquire))
+			{
+				push_batched(message_priority, category, message_priority_str, current_time,
+					[&](char* out, std::size_t size) { return std::snprintf(out, size, "%s", message); },
+					fields, field_count);
+				return;
+			}
+
+			if (async_enabled.load(std::memory_order_acquire))
+			{
+				push_async(message_priority, category, message_priority_str, current_time,
+					[&](AsyncRecord& record) { record.field_count = pack_fields(record.text, YELLOG_ASYNC_MESSAGE_SIZE, message, fields, field_count); });
+				return;
+			}
+
+			Record record = make_record(guard.get(), message_priority, category, message_priority_str, current_time);
+			record.fields = fields;
+			record.field_count = field_count;
+			record.message_length = std::strlen(message);
+
+			write_message(guard.get(), category, record, [&](char* out, std::size_t size) { return format_fields_message(out, size, message, fields, field_count); });
+		}
+		else
+		{
+			count_filtered(message_priority);
+		}
+	}
+
+	// Same as log(), with a {} format string
+	template<LogPriority message_priority, typename Format, typename... Args>
+	void log_format(const Category* category, const char* message_priority_str, Format, const Args&... args)
+	{
+		check_format<Format, Args...>();
+
+		if (recorder_enabled.load(std::memory_order_acquire))
+		{
+			record_recent(message_priority, message_priority_str, RecentBraces, Format::value(), [&](RecentRecord& recent)
+			{
+				RecentWriter out(recent.data, sizeof(recent.data));
+				(encode_recent<true>(out, args), ...);
+				return (std::size_t)(out.complete - recent.data);
+			});
+		}
+
+		SettingsGuard guard(*this);
+		if (is_enabled<message_priority>(category, guard))
+		{
+			CallStats call_stats(*this, message_priority);
+			std::int64_t current_time = now();
+
+			auto format_message = [&](char* out, std::size_t size)
+			{
+				return format_to<Format>(out, size, std::index_sequence_for<Args...>(), args...);
+			};
+
+			if (batched_enabled.load(std::memory_order_acquire))
+			{
+				push_batched(message_priority, category, message_priority_str, current_time, format_message);
+				return;
+			}
+
+			if (async_enabled.load(std::memory_order_acquire))
+			{
+				push_async(message_priority, category, message_priority_str, current_time,
+					[&](AsyncRecord& record) { format_message(record.text, YELLOG_ASYNC_MESSAGE_SIZE); });
+				return;
+			}
+
+			Record record = make_record(guard.get(), message_priority, category, message_priority_str, current_time);
+			write_message(guard.get(), category, record, format_message);
+		}
+		else
+		{
+			count_filtered(message_priority);
+		}
+	}
+
+	// A record with the message and line not set yet
+	Record make_record(const Settings& current, LogPriority message_priority, const Category* category, const char* message_priority_str,
+		std::int64_t current_time)
+	{
+		Record record;
+		record.priority = message_priority;
+		record.time = current_time;
+		record.timestamp = format_timestamp(current, current_time);
+		record.priority_str = message_priority_str;
+		record.category = category ? category->GetName() : 0;
+		record.message = 0;
+		record.message_length = 0;
+		record.line = 0;
+		record.line_length = 0;
+		record.fields = 0;
+		record.field_count = 0;
+		record.format = 0;
+		record.encode_arguments = 0;
+		record.arguments = 0;
+		return record;
+	}
+
+	// Formats a message on the calling thread and writes the record to the sinks
+	// format_message(out, size) follows snprintf conventions
+	// For messages with fields, message_length is set by the caller to the length of the message without them
+	template<typename FormatMessage>
+	void write_message(const Settings& current, const Category* category, Record& record, FormatMessage&& format_message)
+	{
+		std::size_t fields_message_length = record.message_length;
+
+		std::vector<char>& line = line_buffer();
+		assemble_line(line, record, format_message);
+		if (record.fields)
+		{
+			record.message_length = fields_message_length;
+		}
+
+		const Settings::CategorySettings* category_settings = current.find(category);
+		if (!category_settings || category_settings->additive)
+		{
+			for (const std::shared_ptr<Sink>& sink : current.concurrent_sinks)
+			{
+				sink->consume(record);
+			}
+
+			if (!current.locked_sinks.empty())
+			{
+				std::unique_lock lock = lock_log_mutex();
+				write_locked_sinks(current, record);
+			}
+		}
+
+		write_category_sinks(category, category_settings, record);
+	}
+
+	// Hands a record to the sinks of its category, the ones without concurrent_writes are written with the category lock held
+	static void write_category_sinks(const Category* category, const Settings::CategorySettings* category_settings, const Record& record)
+	{
+		if (category_settings && !category_settings->sinks.empty())
+		{
+			for (const std::shared_ptr<Sink>& sink : category_settings->sinks)
+			{
+				if (sink->concurrent_writes)
+				{
+					sink->consume(record);
+				}
+			}
+
+			std::scoped_lock lock(category->sinks_mutex);
+			for (const std::shared_ptr<Sink>& sink : category_settings->sinks)
+			{
+				if (!sink->concurrent_writes)
+				{
+					sink->consume(record);
+				}
+			}
+		}
+	}
+
+	// {} format engine
+	// A format string is parsed at compile time into literal pieces and placeholders,
+	// format_to is instantiated per format string and argument types
+
+	enum FormatError
+	{
+		NoFormatError, UnmatchedOpenBrace, UnmatchedCloseBrace, InvalidFormatSpec
+	};
+
+	// {:[.precision][type]}
+	struct FormatSpec
+	{
+		char type = 0;
+		int precision = -1;
+	};
+
+	struct FormatPiece
+	{
+		std::size_t offset = 0;
+		std::size_t length = 0;
+	};
+
+	template<std::size_t Length>
+	struct ParsedFormat
+	{
+		FormatPiece pieces[Length + 1] = {};
+		std::size_t piece_count = 0;
+		// literal pieces before argument i are [boundaries[i], boundaries[i + 1]), the rest follow the last argument
+		std::size_t boundaries[Length + 2] = {};
+		FormatSpec specs[Length + 1] = {};
+		std::size_t arg_count = 0;
+		FormatError error = NoFormatError;
+	};
+
+	static YELLOG_CONSTEVAL std::size_t format_length(const char* format)
+	{
+		std::size_t length = 0;
+		while (format[length] != '\0')
+		{
+			length++;
+		}
+		return length;
+	}
+
+	template<std::size_t Length>
+	static YELLOG_CONSTEVAL ParsedFormat<Length> parse_format(const char* format)
+	{
+		ParsedFormat<Length> parsed{};
+		std::size_t literal_begin = 0;
+		std::size_t i = 0;
+
+		auto add_piece = [&](std::size_t begin, std::size_t end)
+		{
+			if (end > begin)
+			{
+				parsed.pieces[parsed.piece_count].offset = begin;
+				parsed.pieces[parsed.piece_count].length = end - begin;
+				parsed.piece_count++;
+			}
+		};
+
+		while (i < Length)
+		{
+			char c = format[i];
+
+			if ((c == '{' || c == '}') && i + 1 < Length && format[i + 1] == c)
+			{
+				// escaped brace, keep one of them
+				add_piece(literal_begin, i + 1);
+				i += 2;
+				literal_begin = i;
+			}
+			else if (c == '}')
+			{
+				parsed.error = UnmatchedCloseBrace;
+				return parsed;
+			}
+			else if (c == '{')
+			{
+				add_piece(literal_begin, i);
+
+				FormatSpec spec;
+				std::size_t j = i + 1;
+				if (j < Length && format[j] == ':')
+				{
+					j++;
+					if (j < Length && format[j] == '.')
+					{
+						j++;
+						if (j >= Length || format[j] < '0' || format[j] > '9')
+						{
+							parsed.error = InvalidFormatSpec;
+							return parsed;
+						}
+
+						spec.precision = 0;
+						while (j < Length && format[j] >= '0' && format[j] <= '9')
+						{
+							spec.precision = spec.precision * 10 + (format[j] - '0');
+							j++;
+						}
+					}
+					if (j < Length && format[j] != '}')
+					{
+						spec.type = format[j];
+						j++;
+					}
+				}
+
+				if (j >= Length)
+				{
+					parsed.error = UnmatchedOpenBrace;
+					return parsed;
+				}
+				if (format[j] != '}')
+				{
+					parsed.error = InvalidFormatSpec;
+					return parsed;
+				}
+
+				parsed.specs[parsed.arg_count] = spec;
+				parsed.arg_count++;
+				parsed.boundaries[parsed.arg_count] = parsed.piece_count;
+
+				i = j + 1;
+				literal_begin = i;
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		add_piece(literal_begin, Length);
+		return parsed;
+	}
+
+	template<typename Format>
+	struct FormatInfo
+	{
+		static constexpr std::size_t length = format_length(Format::value());
+		static constexpr ParsedFormat<length> parsed = parse_format<length>(Format::value());
+	};
+
+	template<typename T>
+	static constexpr bool is_string_like = std::is_same_v<T, const char*> || std::is_same_v<T, char*>
+		|| std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>;
+
+	template<typename T>
+	struct is_duration : std::false_type {};
+
+	template<typename Rep, typename Period>
+	struct is_duration<std::chrono::duration<Rep, Period>> : std::true_type {};
+
+	template<typename T, typename = void>
+	struct has_value_formatter : std::false_type {};
+
+	template<typename T>
+	struct has_value_formatter<T, std::void_t<decltype(ValueFormatter<T>::Format(std::declval<FormatBuffer&>(), std::declval<const T&>()))>> : std::true_type {};
+
+	// Whether a format spec can be used with an argument type
+	template<typename T>
+	static constexpr bool is_valid_spec(FormatSpec spec)
+	{
+		if constexpr (std::is_same_v<T, bool> || is_string_like<T>)
+		{
+			return spec.precision == -1 && (spec.type == 0 || spec.type == 's');
+		}
+		else if constexpr (std::is_same_v<T, char>)
+		{
+			return spec.precision == -1 && (spec.type == 0 || spec.type == 'c' || spec.type == 'd' || spec.type == 'x' || spec.type == 'X');
+		}
+		else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+		{
+			return spec.precision == -1 && (spec.type == 0 || spec.type == 'd' || spec.type == 'x' || spec.type == 'X' || spec.type == 'o' || spec.type == 'b');
+		}
+		else if constexpr (std::is_floating_point_v<T>)
+		{
+			return spec.type == 0 || spec.type == 'f' || spec.type == 'e' || spec.type == 'g';
+		}
+		else if constexpr (std::is_pointer_v<T> || std::is_null_pointer_v<T>)
+		{
+			return spec.precision == -1 && (spec.type == 0 || spec.type == 'p');
+		}
+		else if constexpr (is_duration<T>::value)
+		{
+			return spec.precision == -1 && spec.type == 0;
+		}
+		else
+		{
+			// user formatters get no spec
+			return spec.precision == -1 && spec.type == 0;
+		}
+	}
+
+	template<typename Format, typename... Args>
+	static constexpr void check_format()
+	{
+		constexpr const auto& parsed = FormatInfo<Format>::parsed;
+		static_assert(parsed.error != UnmatchedOpenBrace, "Yellog: unmatched '{' in format string");
+		static_assert(parsed.error != UnmatchedCloseBrace, "Yellog: unmatched '}' in format string, use '}}' for a literal brace");
+		static_assert(parsed.error != InvalidFormatSpec, "Yellog: invalid format spec, expected {} or {:[.precision][type]}");
+		static_assert(parsed.error != NoFormatError || parsed.arg_count == sizeof...(Args), "Yellog: number of {} placeholders doesn't match number of arguments");
+	}
+
+	template<typename T>
+	static void format_integer(FormatBuffer& out, T value, int base, bool upper)
+	{
+		char digits[72];
+		char* end = std::to_chars(digits, digits + sizeof(digits), value, base).ptr;
+		if (upper)
+		{
+			for (char* c = digits; c != end; c++)
+			{
+				if (*c >= 'a' && *c <= 'z')
+				{
+					*c = (char)(*c - 'a' + 'A');
+				}
+			}
+		}
+		out.Append(digits, (std::size_t)(end - digits));
+	}
+
+	template<char Type, int Precision, typename T>
+	static void format_value(FormatBuffer& out, const T& value)
+	{
+		if constexpr (std::is_same_v<T, bool>)
+		{
+			out.Append(value ? std::string_view("true") : std::string_view("false"));
+		}
+		else if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>)
+		{
+			out.Append(value ? std::string_view(value) : std::string_view("(null)"));
+		}
+		else if constexpr (is_string_like<T>)
+		{
+			out.Append(std::string_view(value));
+		}
+		else if constexpr (std::is_same_v<T, char>)
+		{
+			if constexpr (Type == 0 || Type == 'c')
+			{
+				out.Append(value);
+			}
+			else
+			{
+				format_value<Type, Precision>(out, (int)value);
+			}
+		}
+		else if constexpr (std::is_enum_v<T>)
+		{
+			format_value<Type, Precision>(out, (std::underlying_type_t<T>)value);
+		}
+		else if constexpr (std::is_integral_v<T>)
+		{
+			constexpr int base = Type == 'x' || Type == 'X' ? 16 : Type == 'o' ? 8 : Type == 'b' ? 2 : 10;
+			format_integer(out, value, base, Type == 'X');
+		}
+		else if constexpr (std::is_floating_point_v<T>)
+		{
+			char digits[128];
+			std::to_chars_result result;
+			if constexpr (Precision < 0 && Type == 0)
+			{
+				result = std::to_chars(digits, digits + sizeof(digits), value);
+			}
+			else
+			{
+				constexpr std::chars_format format = Type == 'e' ? std::chars_format::scientific
+					: Type == 'g' ? std::chars_format::general : std::chars_format::fixed;
+				result = std::to_chars(digits, digits + sizeof(digits), value, format, Precision < 0 ? 6 : Precision);
+			}
+
+			if (result.ec == std::errc())
+			{
+				out.Append(digits, (std::size_t)(result.ptr - digits));
+			}
+			else
+			{
+				out.Append(std::string_view("(out of range)"));
+			}
+		}
+		else if constexpr (std::is_null_pointer_v<T>)
+		{
+			out.Append(std::string_view("0x0"));
+		}
+		else if constexpr (std::is_pointer_v<T>)
+		{
+			out.Append(std::string_view("0x"));
+			format_integer(out, (std::uintptr_t)value, 16, false);
+		}
+		else if constexpr (is_duration<T>::value)
+		{
+			typedef typename T::period Period;
+			format_value<0, -1>(out, value.count());
+
+			if constexpr (std::is_same_v<Period, std::nano>)
+			{
+				out.Append(std::string_view("ns"));
+			}
+			else if constexpr (std::is_same_v<Period, std::micro>)
+			{
+				out.Append(std::string_view("us"));
+			}
+			else if constexpr (std::is_same_v<Period, std::milli>)
+			{
+				out.Append(std::string_view("ms"));
+			}
+			else if constexpr (std::is_same_v<Period, std::ratio<1>>)
+			{
+				out.Append(std::string_view("s"));
+			}
+			else if constexpr (std::is_same_v<Period, std::ratio<60>>)
+			{
+				out.Append(std::string_view("min"));
+			}
+			else if constexpr (std::is_same_v<Period, std::ratio<3600>>)
+			{
+				out.Append(std::string_view("h"));
+			}
+			else
+			{
+				out.Append('[');
+				format_value<0, -1>(out, (std::intmax_t)Period::num);
+				out.Append('/');
+				format_value<0, -1>(out, (std::intmax_t)Period::den);
+				out.Append(std::string_view("]s"));
+			}
+		}
+		else
+		{
+			static_assert(has_value_formatter<T>::value, "Yellog: no formatter for this argument type, specialize Yellog::ValueFormatter");
+			ValueFormatter<T>::Format(out, value);
+		}
+	}
+
+	// Literal pieces before argument Index, then the argument
+	template<typename Format, std::size_t Index, typename T>
+	static void format_argument(FormatBuffer& out, const T& arg)
+	{
+		constexpr const auto& parsed = FormatInfo<Format>::parsed;
+		constexpr FormatSpec spec = parsed.specs[Index];
+		typedef std::decay_t<const T> Decayed;
+
+		static_assert(is_valid_spec<Decayed>(spec), "Yellog: format spec doesn't match the argument type");
+
+		const char* format = Format::value();
+		for (std::size_t piece = parsed.boundaries[Index]; piece < parsed.boundaries[Index + 1]; piece++)
+		{
+			out.Append(format + parsed.pieces[piece].offset, parsed.pieces[piece].length);
+		}
+
+		// arrays (e.g. string literals) are formatted through the decayed pointer
+		const Decayed& value = arg;
+		format_value<spec.type, spec.precision>(out, value);
+	}
+
+	// Formats a {} message, follows snprintf conventions
+	template<typename Format, typename... Args, std::size_t... I>
+	static int format_to(char* out, std::size_t size, std::index_sequence<I...>, const Args&... args)
+	{
+		constexpr const auto& parsed = FormatInfo<Format>::parsed;
+
+		FormatBuffer buffer(out, size);
+		(format_argument<Format, I>(buffer, args), ...);
+
+		const char* format = Format::value();
+		for (std::size_t piece = parsed.boundaries[sizeof...(Args)]; piece < parsed.piece_count; piece++)
+		{
+			buffer.Append(format + parsed.pieces[piece].offset, parsed.pieces[piece].length);
+		}
+
+		return buffer.Finish();
+	}
+
+	// Structured fields
+
+	static const char* priority_name(LogPriority message_priority)
+	{
+		static const char* const names[] = { "trace", "debug", "info", "warn", "error", "critical" };
+		return names[message_priority];
+	}
+
+	template<typename T>
+	static void append_number(std::string& out, T value)
+	{
+		char digits[32];
+		std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			// JSON has no infinity or NaN
+			if (result.ec != std::errc() || value != value || value - value != 0)
+			{
+				out += "null";
+				return;
+			}
+		}
+		out.append(digits, result.ptr);
+	}
+
+	// True if any byte of word is a quote, a backslash or a control character
+	static bool has_json_special(std::uint64_t word)
+	{
+		const std::uint64_t ones = 0x0101010101010101ull;
+		const std::uint64_t highs = 0x8080808080808080ull;
+		std::uint64_t quotes = word ^ (ones * '"');
+		std::uint64_t backslashes = word ^ (ones * '\\');
+		std::uint64_t special = (word - ones * 0x20) | (quotes - ones) | (backslashes - ones);
+		return (special & ~word & highs) != 0;
+	}
+
+	// Appends text escaped for a JSON string, 8 bytes are checked at a time and runs that need no escaping are copied at once
+	static void append_json_escaped(std::string& out, const char* text, std::size_t length)
+	{
+		static const char hex_digits[] = "0123456789abcdef";
+		std::size_t copied = 0;
+		std::size_t i = 0;
+
+		while (i < length)
+		{
+			if (i + 8 <= length)
+			{
+				std::uint64_t word;
+				std::memcpy(&word, text + i, 8);
+				if (!has_json_special(word))
+				{
+					i += 8;
+					continue;
+				}
+			}
+
+			unsigned char c = (unsigned char)text[i];
+			if (c < 0x20 || c == '"' || c == '\\')
+			{
+				out.append(text + copied, i - copied);
+				out += '\\';
+				switch (c)
+				{
+				case '"': out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '\n': out += 'n'; break;
+				case '\r': out += 'r'; break;
+				case '\t': out += 't'; break;
+				case '\b': out += 'b'; break;
+				case '\f': out += 'f'; break;
+				default:
+					out += "u00";
+					out += hex_digits[c >> 4];
+					out += hex_digits[c & 0xf];
+				}
+				copied = i + 1;
+			}
+			i++;
+		}
+
+		out.append(text + copied, length - copied);
+	}
+
+	// Writes the low bytes of value little-endian, returns the position after them
+	static char* put_integer(char* pos, std::uint64_t value, int bytes)
+	{
+		for (int i = 0; i < bytes; i++)
+		{
+			*pos++ = (char)(value >> (i * 8));
+		}
+		return pos;
+	}
+
+	static std::uint64_t get_integer(const char* pos, int bytes)
+	{
+		std::uint64_t value = 0;
+		for (int i = 0; i < bytes; i++)
+		{
+			value |= (std::uint64_t)(unsigned char)pos[i] << (i * 8);
+		}
+		return value;
+	}
+
+	static std::size_t binary_field_size(const Field& field)
+	{
+		std::size_t size = 1 + 2 + std::strlen(field.key);
+		switch (field.type)
+		{
+		case BoolField:
+			return size + 1;
+		case StringField:
+			return size + 4 + field.string_value.size();
+		default:
+			return size + 8;
+		}
+	}
+
+	// Writes binary_field_size(field) bytes, see BinaryFormat
+	static char* encode_field(char* pos, const Field& field)
+	{
+		std::size_t key_length = std::strlen(field.key);
+		pos = put_integer(pos, field.type, 1);
+		pos = put_integer(pos, key_length, 2);
+		std::memcpy(pos, field.key, key_length);
+		pos += key_length;
+
+		switch (field.type)
+		{
+		case IntField:
+		case UnsignedField:
+			return put_integer(pos, field.unsigned_value, 8);
+		case DoubleField:
+		{
+			std::uint64_t bits;
+			std::memcpy(&bits, &field.double_value, 8);
+			return put_integer(pos, bits, 8);
+		}
+		case BoolField:
+			return put_integer(pos, field.bool_value ? 1 : 0, 1);
+		case StringField:
+			pos = put_integer(pos, field.string_value.size(), 4);
+			std::memcpy(pos, field.string_value.data(), field.string_value.size());
+			return pos + field.string_value.size();
+		}
+		return pos;
+	}
+
+	// Reads a field written by encode_field, key and string value point into the encoded data
+	// Keys are stored null-terminated for this, encode_field output is only decoded from async records
+	static const char* decode_field(const char* pos, Field& field)
+	{
+		field.type = (FieldType)get_integer(pos, 1);
+		std::size_t key_length = get_integer(pos + 1, 2);
+		field.key = pos + 3;
+		pos += 3 + key_length + 1;
+
+		switch (field.type)
+		{
+		case IntField:
+		case UnsignedField:
+			field.unsigned_value = get_integer(pos, 8);
+			return pos + 8;
+		case DoubleField:
+		{
+			std::uint64_t bits = get_integer(pos, 8);
+			std::memcpy(&field.double_value, &bits, 8);
+			return pos + 8;
+		}
+		case BoolField:
+			field.bool_value = *pos != 0;
+			return pos + 1;
+		case StringField:
+		{
+			std::size_t length = get_integer(pos, 4);
+			field.string_value = std::string_view(pos + 4, length);
+			return pos + 4 + length;
+		}
+		}
+		return pos;
+	}
+
+	// Writes binary_field_size(field) + 1 bytes, encode_field output with a terminator after the key so decode_field can be used
+	static char* pack_field(char* pos, const Field& field)
+	{
+		char* key_end = pos + 3 + std::strlen(field.key);
+		char* next = encode_field(pos, field);
+		// move the value one byte to make room for the key terminator
+		std::memmove(key_end + 1, key_end, (std::size_t)(next - key_end));
+		*key_end = '\0';
+		return next + 1;
+	}
+
+	// Copies the null-terminated message and as many fields as fit into out (an async record or a flight recorder slot)
+	// Returns the number of fields copied
+	static std::uint32_t pack_fields(char* out, std::size_t size, const char* message, const Field* fields, std::size_t field_count)
+	{
+		char* pos = out;
+		char* end = out + size;
+
+		std::size_t message_length = std::min(std::strlen(message), size - 1);
+		std::memcpy(pos, message, message_length);
+		pos[message_length] = '\0';
+		pos += message_length + 1;
+
+		std::uint32_t packed = 0;
+		for (std::size_t i = 0; i < field_count; i++)
+		{
+			std::size_t size = binary_field_size(fields[i]) + 1;
+			if (size > (std::size_t)(end - pos))
+			{
+				break;
+			}
+
+			pos = pack_field(pos, fields[i]);
+			packed++;
+		}
+
+		return packed;
+	}
+
+	// Writes "message key=value key=value", follows snprintf conventions
+	static int format_fields_message(char* out, std::size_t size, const char* message, const Field* fields, std::size_t field_count)
+	{
+		FormatBuffer buffer(out, size);
+		buffer.Append(std::string_view(message));
+
+		for (std::size_t i = 0; i < field_count; i++)
+		{
+			append_field(buffer, fields[i]);
+		}
+
+		return buffer.Finish();
+	}
+
+	// Appends " key=value"
+	static void append_field(FormatBuffer& buffer, const Field& field)
+	{
+		buffer.Append(' ');
+		buffer.Append(std::string_view(field.key));
+		buffer.Append('=');
+
+		switch (field.type)
+		{
+		case IntField:
+			format_value<0, -1>(buffer, field.int_value);
+			break;
+		case UnsignedField:
+			format_value<0, -1>(buffer, field.unsigned_value);
+			break;
+		case DoubleField:
+			format_value<0, -1>(buffer, field.double_value);
+			break;
+		case BoolField:
+			format_value<0, -1>(buffer, field.bool_value);
+			break;
+		case StringField:
+			append_quoted(buffer, field.string_value);
+			break;
+		}
+	}
+
+	// Strings with spaces, quotes, '=' or control characters are quoted, control characters are escaped so a message stays on one line
+	static void append_quoted(FormatBuffer& buffer, std::string_view text)
+	{
+		auto needs_quotes = [](char c) { return (unsigned char)c <= ' ' || c == '"' || c == '=' || c == '\\'; };
+		if (!text.empty() && std::none_of(text.begin(), text.end(), needs_quotes))
+		{
+			buffer.Append(text);
+			return;
+		}
+
+		static const char hex_digits[] = "0123456789abcdef";
+		buffer.Append('"');
+		for (char c : text)
+		{
+			unsigned char byte = (unsigned char)c;
+			if (c == '"' || c == '\\')
+			{
+				buffer.Append('\\');
+				buffer.Append(c);
+			}
+			else if (c == '\n')
+			{
+				buffer.Append(std::string_view("\\n"));
+			}
+			else if (c == '\t')
+			{
+				buffer.Append(std::string_view("\\t"));
+			}
+			else if (byte < 0x20)
+			{
+				buffer.Append(std::string_view("\\x"));
+				buffer.Append(hex_digits[byte >> 4]);
+				buffer.Append(hex_digits[byte & 0xf]);
+			}
+			else
+			{
+				buffer.Append(c);
+			}
+		}
+		buffer.Append('"');
+	}
+
+	static std::vector<char>& line_buffer()
+	{
+		static thread_local std::vector<char> buffer(YELLOG_LINE_BUFFER_SIZE);
+		return buffer;
+	}
+
+	// Writes "timestamp    [Priority] message\n" to line, growing it if needed, and points the record message and line into it
+	// format_message(out, size) follows snprintf conventions
+	template<typename FormatMessage>
+	static void assemble_line(std::vector<char>& line, Record& record, FormatMessage&& format_message)
+	{
+		const char* timestamp = record.timestamp;
+		const char* message_priority_str = record.priority_str;
+		std::size_t timestamp_length = std::strlen(timestamp);
+		std::size_t priority_length = std::strlen(message_priority_str);
+		std::size_t prefix_length = timestamp_length + 4 + priority_length;
+
+		if (line.size() < prefix_length + 2)
+		{
+			line.resize(prefix_length + YELLOG_LINE_BUFFER_SIZE);
+		}
+
+		char* out = line.data();
+		std::memcpy(out, timestamp, timestamp_length);
+		std::memcpy(out + timestamp_length, "    ", 4);
+		std::memcpy(out + timestamp_length + 4, message_priority_str, priority_length);
+
+		// one byte is kept for the newline, snprintf terminator goes where the newline will be
+		int message_length = format_message(line.data() + prefix_length, line.size() - prefix_length - 1);
+		if (message_length < 0)
+		{
+			message_length = 0;
+		}
+		else if ((std::size_t)message_length >= line.size() - prefix_length - 1)
+		{
+			line.resize(prefix_length + (std::size_t)message_length + 2);
+			format_message(line.data() + prefix_length, line.size() - prefix_length - 1);
+		}
+
+		std::size_t length = prefix_length + (std::size_t)message_length;
+		line[length] = '\n';
+
+		record.message = line.data() + prefix_length;
+		record.message_length = (std::size_t)message_length;
+		record.line = line.data();
+		record.line_length = length + 1;
+	}
+
+	// Hands a record to the sinks that are written with log_mutex held, called with log_mutex held
+	static void write_locked_sinks(const Settings& current, const Record& record)
+	{
+		for (const std::shared_ptr<Sink>& sink : current.locked_sinks)
+		{
+			sink->consume(record);
+		}
+	}
+
+	// Hands a record to every sink, called with log_mutex held
+	static void write_record(const Settings& current, const Category* category, const Record& record)
+	{
+		const Settings::CategorySettings* category_settings = current.find(category);
+		if (!category_settings || category_settings->additive)
+		{
+			for (const std::shared_ptr<Sink>& sink : current.concurrent_sinks)
+			{
+				sink->consume(record);
+			}
+
+			write_locked_sinks(current, record);
+		}
+
+		write_category_sinks(category, category_settings, record);
+	}
+
+	// Called with log_mutex held
+	void flush_sinks()
+	{
+		SettingsGuard guard(*this);
+		const Settings& current = guard.get();
+		for (const std::shared_ptr<Sink>& sink : current.concurrent_sinks)
+		{
+			sink->flush_output();
+		}
+
+		for (const std::shared_ptr<Sink>& sink : current.locked_sinks)
+		{
+			sink->flush_output();
+		}
+
+		for (const Settings::CategorySettings& category_settings : current.categories)
+		{
+			if (!category_settings.sinks.empty())
+			{
+				std::scoped_lock category_lock(category_settings.category->sinks_mutex);
+				for (const std::shared_ptr<Sink>& sink : category_settings.sinks)
+				{
+					sink->flush_output();
+				}
+			}
+		}
+	}
+
+	// Called with config_mutex held
+	void remove_sink(const std::shared_ptr<Sink>& sink)
+	{
+		sinks.erase(std::remove(sinks.begin(), sinks.end(), sink), sinks.end());
+	}
+
+	// Called with config_mutex held
+	Category& get_category(const char* name)
+	{
+		std::unique_ptr<Category>& category = categories[name];
+		if (!category)
+		{
+			category.reset(new Category(name, categories.size() - 1));
+		}
+
+		return *category;
+	}
+
+	// Settings snapshots
+
+	SettingsReader& settings_reader()
+	{
+		static thread_local ThreadSettingsReaderHandle handle;
+		if (!handle.reader)
+		{
+			handle.reader = std::make_shared<SettingsReader>();
+			std::scoped_lock lock(settings_readers_mutex);
+			settings_readers.push_back(handle.reader);
+		}
+		return *handle.reader;
+	}
+
+	// Marks the current settings as read by reader and returns them
+	const Settings* read_settings(SettingsReader& reader)
+	{
+		const Settings* current = settings.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			// the check after the store sees every snapshot published before free_settings looked at the reader
+			reader.settings.store(current, std::memory_order_seq_cst);
+			const Settings* latest = settings.load(std::memory_order_seq_cst);
+			if (latest == current)
+			{
+				return current;
+			}
+			current = latest;
+		}
+	}
+
+	// Runs change() with config_mutex held and publishes the changed settings as one snapshot
+	template<typename Change>
+	void change_settings(Change&& change)
+	{
+		std::unique_ptr<Settings> replaced;
+		{
+			std::scoped_lock lock(config_mutex);
+			change();
+			replaced = publish_settings();
+		}
+		free_settings(std::move(replaced));
+	}
+
+	// Called with config_mutex held, returns the replaced snapshot
+	std::unique_ptr<Settings> publish_settings()
+	{
+		std::unique_ptr<Settings> next(new Settings());
+		next->priority = priority.load(std::memory_order_relaxed);
+		next->timestamp_format = timestamp_format.load(std::memory_order_relaxed);
+		next->timestamp_digits = timestamp_digits.load(std::memory_order_relaxed);
+		for (const std::shared_ptr<Sink>& sink : sinks)
+		{
+			(sink->concurrent_writes ? next->concurrent_sinks : next->locked_sinks).push_back(sink);
+		}
+
+		next->categories.resize(categories.size());
+		for (const auto& [name, category] : categories)
+		{
+			Settings::CategorySettings& category_settings = next->categories[category->index];
+			category_settings.category = category.get();
+			category_settings.priority = category->priority.load(std::memory_order_relaxed);
+			category_settings.additive = category->additive.load(std::memory_order_relaxed);
+			category_settings.sinks = category->sinks;
+		}
+
+		update_lowest_priority();
+		settings.store(next.get(), std::memory_order_seq_cst);
+		std::swap(published_settings, next);
+		return next;
+	}
+
+	// Waits until no thread reads the replaced settings and frees them, so removed sinks are released here
+	// (their threads stopped and files closed) unless someone else holds them
+	// Called without locks, a thread reading the settings may be waiting for log_mutex or a sink lock
+	void free_settings(std::unique_ptr<Settings> replaced)
+	{
+		if (!replaced)
+		{
+			return;
+		}
+
+		std::vector<std::shared_ptr<SettingsReader>> readers;
+		{
+			std::scoped_lock lock(settings_readers_mutex);
+			for (std::size_t i = 0; i < settings_readers.size();)
+			{
+				if (settings_readers[i]->exited.load(std::memory_order_acquire))
+				{
+					settings_readers[i] = std::move(settings_readers.back());
+					settings_readers.pop_back();
+				}
+				else
+				{
+					i++;
+				}
+			}
+			readers = settings_readers;
+		}
+
+		for (const std::shared_ptr<SettingsReader>& reader : readers)
+		{
+			while (reader->settings.load(std::memory_order_seq_cst) == replaced.get())
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	static std::int64_t steady_nanoseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Re-anchors steady clock to wall clock
+	void sync_clock(std::int64_t steady_now)
+	{
+		std::int64_t wall_now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		clock_offset.store(wall_now - steady_now, std::memory_order_relaxed);
+		clock_synced_at.store(steady_now, std::memory_order_relaxed);
+	}
+
+	// Current wall clock time in nanoseconds since epoch
+	std::int64_t now()
+	{
+		return steady_nanoseconds() + clock_offset.load(std::memory_order_relaxed);
+	}
+
+	static TimestampCache& timestamp_cache()
+	{
+		static thread_local TimestampCache cache;
+		return cache;
+	}
+
+	// Returns the timestamp formatted with the timestamp format of the settings, the string is valid until the next call on the same thread
+	const char* format_timestamp(const Settings& current, std::int64_t time)
+	{
+		TimestampCache& cache = timestamp_cache();
+
+		std::int64_t second = time / 1000000000;
+		const char* format = current.timestamp_format;
+		int digits = current.timestamp_digits;
+
+		if (second != cache.second || format != cache.format || digits != cache.digits)
+		{
+			refresh_timestamp_cache(cache, second, format, digits);
+		}
+
+		if (cache.fraction_offset != no_fraction)
+		{
+			std::int64_t fraction = time % 1000000000;
+			for (int i = digits; i < 9; i++)
+			{
+				fraction /= 10;
+			}
+
+			for (char* pos = cache.text + cache.fraction_offset + digits; pos != cache.text + cache.fraction_offset; fraction /= 10)
+			{
+				*--pos = (char)('0' + fraction % 10);
+			}
+		}
+
+		return cache.text;
+	}
+
+	static std::tm local_time(std::int64_t second)
+	{
+		std::time_t current_time = (std::time_t)second;
+		std::tm timestamp;
+#if defined(_MSC_VER)
+		localtime_s(&timestamp, &current_time);
+#else
+		localtime_r(&current_time, &timestamp);
+#endif
+		return timestamp;
+	}
+
+	// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+	static std::int64_t days_from_civil(std::int64_t year, int month, int day)
+	{
+		year -= month <= 2;
+		std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+		std::int64_t year_of_era = year - era * 400;
+		std::int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+		std::int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+		return era * 146097 + day_of_era - 719468;
+	}
+
+	// Inverse of days_from_civil
+	static void civil_from_days(std::int64_t days, std::int64_t& year, int& month, int& day)
+	{
+		days += 719468;
+		std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+		std::int64_t day_of_era = days - era * 146097;
+		std::int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+		std::int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+		std::int64_t month_index = (5 * day_of_year + 2) / 153;
+		day = (int)(day_of_year - (153 * month_index + 2) / 5 + 1);
+		month = (int)(month_index < 10 ? month_index + 3 : month_index - 9);
+		year = year_of_era + era * 400 + (month <= 2);
+	}
+
+	// Local time minus UTC in seconds, local is the local time of second
+	static std::int64_t utc_offset_of(const std::tm& local, std::int64_t second)
+	{
+		std::int64_t local_second = days_from_civil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday) * 86400
+			+ local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+		return local_second - second;
+	}
+
+	void refresh_timestamp_cache(TimestampCache& cache, std::int64_t second, const char* format, int digits)
+	{
+		std::int64_t steady_now = steady_nanoseconds();
+		std::int64_t synced_at = clock_synced_at.load(std::memory_order_relaxed);
+		if (steady_now - synced_at > clock_sync_interval
+			&& clock_synced_at.compare_exchange_strong(synced_at, steady_now, std::memory_order_relaxed))
+		{
+			sync_clock(steady_now);
+		}
+
+		cache.second = second;
+		cache.format = format;
+		cache.digits = digits;
+
+		std::tm timestamp = local_time(second);
+		// kept for the flight recorder dump, which can't call localtime
+		utc_offset.store(utc_offset_of(timestamp, second), std::memory_order_relaxed);
+
+		const char* fraction = std::strstr(format, "%f");
+		if (fraction == 0)
+		{
+			cache.fraction_offset = no_fraction;
+			std::strftime(cache.text, 80, format, &timestamp);
+			return;
+		}
+
+		// format the parts before and after %f separately, leaving room for the digits in between
+		char head_format[80];
+		std::size_t head_length = (std::size_t)(fraction - format);
+		if (head_length >= sizeof(head_format))
+		{
+			head_length = sizeof(head_format) - 1;
+		}
+		std::memcpy(head_format, format, head_length);
+		head_format[head_length] = '\0';
+
+		std::size_t head = head_length == 0 ? 0 : std::strftime(cache.text, 80, head_format, &timestamp);
+		cache.fraction_offset = head;
+		std::memset(cache.text + head, '0', (std::size_t)digits);
+
+		char* tail = cache.text + head + digits;
+		if (fraction[2] == '\0' || std::strftime(tail, timestamp_size - 80, fraction + 2, &timestamp) == 0)
+		{
+			*tail = '\0';
+		}
+	}
+
+	// Queues a record, fill_text(record) writes the formatted message (or sets format and packs the arguments)
+	template<typename FillText>
+	void push_async(LogPriority message_priority, const Category* category, const char* message_priority_str, std::int64_t current_time, FillText&& fill_text)
+	{
+		AsyncWriter& writer = *async_writer;
+
+		auto fill = [&](AsyncRecord& record)
+		{
+			record.priority = message_priority;
+			record.category = category;
+			record.priority_str = message_priority_str;
+			record.time = current_time;
+			record.format = 0;
+			record.encode = 0;
+			record.field_count = 0;
+			fill_text(record);
+		};
+
+		std::int64_t wait_start = 0;
+		while (!writer.queue.try_push(fill))
+		{
+			if (writer.policy == DropNewestOnOverflow)
+			{
+				writer.dropped.fetch_add(1, std::memory_order_relaxed);
+				count_dropped(message_priority);
+				return;
+			}
+
+			if (writer.policy == DropOldestOnOverflow)
+			{
+				LogPriority dropped_priority = TracePriority;
+				if (writer.queue.try_pop([&](AsyncRecord& record) { dropped_priority = record.priority; }))
+				{
+					writer.dropped.fetch_add(1, std::memory_order_relaxed);
+					writer.done.fetch_add(1, std::memory_order_release);
+					count_dropped(dropped_priority);
+					continue;
+				}
+				// nothing left to drop, the slot still taken is the record the writer is writing, wait for it
+			}
+
+			if (wait_start == 0 && stats_enabled.load(std::memory_order_relaxed))
+			{
+				wait_start = steady_nanoseconds();
+			}
+			writer.wake_writer();
+			std::this_thread::yield();
+		}
+
+		std::uint64_t pushed = writer.pushed.fetch_add(1) + 1;
+		writer.wake_writer();
+
+		if (stats_enabled.load(std::memory_order_relaxed))
+		{
+			StatsShard& stats = thread_stats();
+			std::uint64_t done = writer.done.load(std::memory_order_relaxed);
+			StatsShard::raise_to(stats.async_queue_high_water, pushed > done ? pushed - done : 0);
+			if (wait_start != 0)
+			{
+				StatsShard::add(stats.queue_wait, steady_nanoseconds() - wait_start);
+			}
+		}
+	}
+
+	template<typename T>
+	static constexpr bool is_c_string = std::is_same_v<T, const char*> || std::is_same_v<T, char*>;
+
+	// Types that can be copied into a deferred record as they are
+	// Other pointers (e.g. wchar_t* for %ls or unsigned char* for %s) may point to data that is gone when the record is formatted,
+	// so messages with them are formatted right away, only void pointers are kept for %p
+	template<typename T>
+	static constexpr bool is_deferrable = is_c_string<T> || std::is_arithmetic_v<T> || std::is_enum_v<T>
+		|| std::is_same_v<T, void*> || std::is_same_v<T, const void*> || std::is_null_pointer_v<T>;
+
+	// Sets bit i of strings if the i-th argument of a printf format is printed with %s (a * width or precision takes an argument)
+	// Returns false if the format uses positional arguments (%1$s) or %s past the 64th argument
+	static bool string_arguments(const char* format, std::uint64_t& strings)
+	{
+		strings = 0;
+		std::size_t index = 0;
+
+		for (const char* pos = std::strchr(format, '%'); pos; pos = std::strchr(pos, '%'))
+		{
+			pos++;
+			if (*pos == '%')
+			{
+				pos++;
+				continue;
+			}
+
+			// flags, width, precision and length modifiers
+			while (*pos != '\0' && std::strchr("-+ #0'123456789.*hljztLq", *pos))
+			{
+				if (*pos == '*')
+				{
+					index++;
+				}
+				pos++;
+			}
+
+			if (*pos == '$')
+			{
+				return false;
+			}
+			if (*pos == '\0')
+			{
+				break;
+			}
+			if (*pos == 's')
+			{
+				if (index >= 64)
+				{
+					return false;
+				}
+				strings |= std::uint64_t(1) << index;
+			}
+
+			index++;
+			pos++;
+		}
+
+		return true;
+	}
+
+	// Bytes an argument takes in a deferred record at least
+	// C-strings take a tag and then either the pointer or the string (only the terminator when truncated to nothing)
+	template<typename T>
+	static constexpr std::size_t min_packed_size_of()
+	{
+		if constexpr (is_c_string<T>)
+		{
+			return 1 + sizeof(T);
+		}
+		else
+		{
+			return sizeof(T);
+		}
+	}
+
+	template<typename... Args>
+	static constexpr std::size_t min_packed_size()
+	{
+		return (std::size_t(0) + ... + min_packed_size_of<Args>());
+	}
+
+	// Copies arg to pos, leaving at least reserved bytes before end for the arguments that follow
+	// A C-string is copied if as_string is true (it is printed with %s), otherwise only the pointer is kept (e.g. for %p)
+	// Returns the position after the packed argument
+	template<typename T>
+	static char* pack_argument(char* pos, const char* end, std::size_t reserved, T arg, [[maybe_unused]] bool as_string)
+	{
+		if constexpr (is_c_string<T>)
+		{
+			*pos++ = as_string ? 's' : 'p';
+			if (!as_string)
+			{
+				std::memcpy(pos, &arg, sizeof(T));
+				return pos + sizeof(T);
+			}
+
+			const char* str = arg ? arg : "(null)";
+			std::size_t room = (std::size_t)(end - pos) - reserved - 1;
+			std::size_t length = std::strlen(str);
+			if (length > room)
+			{
+				length = room;
+			}
+
+			std::memcpy(pos, str, length);
+			pos[length] = '\0';
+			return pos + length + 1;
+		}
+		else
+		{
+			std::memcpy(pos, &arg, sizeof(T));
+			return pos + sizeof(T);
+		}
+	}
+
+	template<typename... Args, std::size_t... I>
+	static void pack_arguments([[maybe_unused]] char* pos, [[maybe_unused]] const char* end, [[maybe_unused]] std::uint64_t strings,
+		std::index_sequence<I...>, Args... args)
+	{
+		constexpr std::size_t sizes[] = { min_packed_size_of<Args>()..., 0 };
+
+		// bytes that have to stay free for the arguments after the i-th one
+		[[maybe_unused]] auto reserved_after = [&](std::size_t i)
+		{
+			std::size_t reserved = 0;
+			for (std::size_t j = i + 1; j < sizeof...(Args); j++)
+			{
+				reserved += sizes[j];
+			}
+			return reserved;
+		};
+
+		((pos = pack_argument(pos, end, reserved_after(I), args, I < 64 && (strings >> (I % 64) & 1) != 0)), ...);
+	}
+
+	// Copies the format and the arguments of a deferred record to text, the format is followed by the packed arguments
+	// Returns false if they don't fit in YELLOG_ASYNC_MESSAGE_SIZE bytes or the C-strings can't be told apart from pointers,
+	// the message is then formatted right away
+	template<typename... Args>
+	static bool pack_deferred(char* text, const char* message, Args... args)
+	{
+		std::uint64_t strings;
+		std::size_t format_size = std::strlen(message) + 1;
+		if (format_size + min_packed_size<Args...>() > YELLOG_ASYNC_MESSAGE_SIZE || !string_arguments(message, strings))
+		{
+			return false;
+		}
+
+		std::memcpy(text, message, format_size);
+		pack_arguments(text + format_size, text + YELLOG_ASYNC_MESSAGE_SIZE, strings, std::index_sequence_for<Args...>(), args...);
+		return true;
+	}
+
+	template<typename T>
+	static T unpack_argument(const char*& pos)
+	{
+		if constexpr (is_c_string<T>)
+		{
+			if (*pos++ == 's')
+			{
+				T str = const_cast<T>(pos);
+				pos += std::strlen(pos) + 1;
+				return str;
+			}
+
+			T pointer;
+			std::memcpy(&pointer, pos, sizeof(T));
+			pos += sizeof(T);
+			return pointer;
+		}
+		else
+		{
+			T arg;
+			std::memcpy(&arg, pos, sizeof(T));
+			pos += sizeof(T);
+			return arg;
+		}
+	}
+
+	// Instantiated per argument list, a pointer to it is stored in each deferred record
+	template<typename... Args>
+	static int format_deferred(char* out, std::size_t size, const char* format, [[maybe_unused]] const char* packed_args)
+	{
+		// braced initialization unpacks the arguments left to right
+		std::tuple<Args...> unpacked{ unpack_argument<Args>(packed_args)... };
+
+		return std::apply([&](Args... args) { return std::snprintf(out, size, format, args...); }, unpacked);
+	}
+
+	// Binary argument encoding, used by BinaryFileSink
+	// Each argument is a type tag followed by the value, arguments are stored as printf receives them (after default promotions):
+	//	'i' int, 'l' long, 'q' long long (zigzag varint)
+	//	'u' unsigned int, 'm' unsigned long, 'Q' unsigned long long (varint)
+	//	'd' double (8 bytes little-endian, IEEE 754 bits), 'D' long double (stored as a double)
+	//	's' C-string (varint length, then the bytes), 'p' pointer (8 bytes little-endian, also C-strings not printed with %s)
+	// Varints store 7 bits per byte, lowest first, the high bit is set on all but the last byte
+
+	template<typename Out>
+	static void put_varint(Out& out, std::uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out += (char)(value | 0x80);
+			value >>= 7;
+		}
+		out += (char)value;
+	}
+
+	template<typename Out>
+	static void put_fixed(Out& out, std::uint64_t value, int bytes)
+	{
+		char data[8];
+		put_integer(data, value, bytes);
+		out.append(data, (std::size_t)bytes);
+	}
+
+	// Longest string that encode_argument writes whole
+	static std::size_t string_room(const std::string&)
+	{
+		return (std::size_t)-1;
+	}
+
+	// out is a std::string or a RecentWriter
+	template<typename Out, typename T>
+	static void encode_argument(Out& out, T arg)
+	{
+		if constexpr (is_c_string<T>)
+		{
+			const char* str = arg ? arg : "(null)";
+			std::size_t length = std::min(std::strlen(str), string_room(out));
+			out += 's';
+			put_varint(out, length);
+			out.append(str, length);
+		}
+		else if constexpr (std::is_pointer_v<T> || std::is_null_pointer_v<T>)
+		{
+			out += 'p';
+			put_fixed(out, (std::uintptr_t)(const void*)arg, 8);
+		}
+		else if constexpr (std::is_enum_v<T>)
+		{
+			encode_argument(out, (std::underlying_type_t<T>)arg);
+		}
+		else if constexpr (std::is_floating_point_v<T>)
+		{
+			double value = (double)arg;
+			std::uint64_t bits;
+			std::memcpy(&bits, &value, 8);
+			out += std::is_same_v<T, long double> ? 'D' : 'd';
+			put_fixed(out, bits, 8);
+		}
+		else
+		{
+			// integer promotions, smaller types are passed to printf as int
+			typedef decltype(+arg) Promoted;
+
+			if constexpr (std::is_signed_v<Promoted>)
+			{
+				out += std::is_same_v<Promoted, int> ? 'i' : std::is_same_v<Promoted, long> ? 'l' : 'q';
+				std::int64_t value = (std::int64_t)arg;
+				put_varint(out, ((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63));
+			}
+			else
+			{
+				out += std::is_same_v<Promoted, unsigned int> ? 'u' : std::is_same_v<Promoted, unsigned long> ? 'm' : 'Q';
+				put_varint(out, (std::uint64_t)arg);
+			}
+		}
+	}
+
+	// Same as encode_argument, a C-string is stored as a pointer unless as_string is true
+	template<typename Out, typename T>
+	static void encode_printf_argument(Out& out, T arg, [[maybe_unused]] bool as_string)
+	{
+		if constexpr (is_c_string<T>)
+		{
+			if (!as_string)
+			{
+				encode_argument(out, (const void*)arg);
+				return;
+			}
+		}
+		encode_argument(out, arg);
+	}
+
+	// Instantiated per argument list, arguments points to a std::tuple<Args...>
+	template<typename... Args>
+	static void encode_arguments([[maybe_unused]] const char* format, const void* arguments, [[maybe_unused]] std::string& out)
+	{
+		std::uint64_t strings = 0;
+		if constexpr ((is_c_string<Args> || ...))
+		{
+			string_arguments(format, strings);
+		}
+
+		[[maybe_unused]] std::size_t index = 0;
+		[[maybe_unused]] auto next_is_string = [&]
+		{
+			bool is_string = index < 64 && (strings >> index & 1) != 0;
+			index++;
+			return is_string;
+		};
+		std::apply([&](const Args&... args) { (encode_printf_argument(out, args, next_is_string()), ...); }, *(const std::tuple<Args...>*)arguments);
+	}
+
+	template<typename T>
+	static void encode_packed(std::string& out, const char*& pos)
+	{
+		bool as_string = is_c_string<T> && *pos == 's';
+		encode_printf_argument(out, unpack_argument<T>(pos), as_string);
+	}
+
+	// Same as encode_arguments, for the packed arguments of a deferred async record (the packed C-strings are tagged)
+	template<typename... Args>
+	static void encode_deferred(const char*, const void* packed_args, [[maybe_unused]] std::string& out)
+	{
+		[[maybe_unused]] const char* pos = (const char*)packed_args;
+		(encode_packed<Args>(out, pos), ...);
+	}
+
+	bool enable_async_output(std::size_t capacity, OverflowPolicy policy, bool deferred_formatting)
+	{
+		std::scoped_lock lock(log_mutex);
+
+		if (async_writer || batch_collector)
+		{
+			return false;
+		}
+
+		async_writer.reset(new AsyncWriter(capacity, policy, deferred_formatting));
+		async_writer->thread = std::thread([this] { run_async_writer(); });
+		async_enabled.store(true, std::memory_order_release);
+
+		return true;
+	}
+
+	// Body of the background writer thread
+	void run_async_writer()
+	{
+		AsyncWriter& writer = *async_writer;
+
+		for (;;)
+		{
+			std::uint64_t written = 0;
+			{
+				std::scoped_lock lock(log_mutex);
+				while (writer.queue.try_pop([this](AsyncRecord& record) { write_async_record(record); }))
+				{
+					written++;
+				}
+			}
+
+			if (written != 0)
+			{
+				writer.done.fetch_add(written, std::memory_order_release);
+				std::scoped_lock lock(writer.wake_mutex);
+				writer.drained.notify_all();
+				continue;
+			}
+
+			std::unique_lock lock(writer.wake_mutex);
+			writer.drained.notify_all();
+
+			if (writer.stop.load(std::memory_order_acquire)
+				&& writer.done.load(std::memory_order_acquire) == writer.pushed.load(std::memory_order_acquire))
+			{
+				return;
+			}
+
+			// producers only notify when they see writer_waiting, so check the queue once more after setting it
+			writer.writer_waiting.store(true);
+			if (writer.done.load(std::memory_order_acquire) >= writer.pushed.load())
+			{
+				writer.wake.wait_for(lock, std::chrono::milliseconds(50));
+			}
+			writer.writer_waiting.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	// Called by the writer thread with log_mutex held
+	void write_async_record(const AsyncRecord& async_record)
+	{
+		SettingsGuard guard(*this);
+		Record record = make_record(guard.get(), async_record.priority, async_record.category, async_record.priority_str, async_record.time);
+		const char* packed_args = 0;
+		if (async_record.format)
+		{
+			packed_args = async_record.text + std::strlen(async_record.text) + 1;
+			record.format = async_record.text;
+			record.encode_arguments = async_record.encode;
+			record.arguments = packed_args;
+		}
+
+		// the smallest packed field takes 4 bytes
+		Field fields[YELLOG_ASYNC_MESSAGE_SIZE / 4];
+		const char* message = async_record.text;
+		if (async_record.field_count)
+		{
+			const char* pos = message + std::strlen(message) + 1;
+			for (std::size_t i = 0; i < async_record.field_count; i++)
+			{
+				pos = decode_field(pos, fields[i]);
+			}
+			record.fields = fields;
+			record.field_count = async_record.field_count;
+		}
+
+		std::vector<char>& line = line_buffer();
+		assemble_line(line, record,
+			[&](char* out, std::size_t size)
+			{
+				if (record.fields)
+				{
+					return format_fields_message(out, size, message, record.fields, record.field_count);
+				}
+				if (async_record.format)
+				{
+					return async_record.format(out, size, async_record.text, packed_args);
+				}
+				return std::snprintf(out, size, "%s", async_record.text);
+			});
+		if (record.fields)
+		{
+			record.message_length = std::strlen(message);
+		}
+
+		write_record(guard.get(), async_record.category, record);
+	}
+
+	void flush()
+	{
+		if (async_enabled.load(std::memory_order_acquire))
+		{
+			AsyncWriter& writer = *async_writer;
+			std::uint64_t target = writer.pushed.load(std::memory_order_acquire);
+
+			std::unique_lock lock(writer.wake_mutex);
+			writer.wake.notify_one();
+			writer.drained.wait(lock, [&] { return writer.done.load(std::memory_order_acquire) >= target; });
+		}
+
+		if (batched_enabled.load(std::memory_order_acquire))
+		{
+			BatchCollector& collector = *batch_collector;
+			std::uint64_t ticket = collector.flush_requests.fetch_add(1) + 1;
+			collector.wake_collector();
+
+			std::unique_lock lock(collector.wake_mutex);
+			collector.drained.wait(lock, [&] { return collector.flushes_done.load(std::memory_order_acquire) >= ticket; });
+		}
+
+		std::scoped_lock lock(log_mutex);
+		flush_sinks();
+	}
+
+	bool enable_batched_output(std::size_t batch_size, int interval_ms)
+	{
+		std::scoped_lock lock(log_mutex);
+
+		if (async_writer || batch_collector)
+		{
+			return false;
+		}
+
+		batch_collector.reset(new BatchCollector(batch_size, interval_ms));
+		batch_collector->thread = std::thread([this] { run_batch_collector(); });
+		batched_enabled.store(true, std::memory_order_release);
+
+		return true;
+	}
+
+	// Buffer of the calling thread, registered with the collector on first use
+	ThreadBuffer& thread_buffer()
+	{
+		static thread_local ThreadBufferHandle handle;
+
+		if (!handle.buffer)
+		{
+			handle.buffer = std::make_shared<ThreadBuffer>();
+
+			BatchCollector& collector = *batch_collector;
+			std::scoped_lock lock(collector.buffers_mutex);
+			collector.buffers.push_back(handle.buffer);
+		}
+
+		return *handle.buffer;
+	}
+
+	// Formats a message into the buffer of the calling thread, format_message(out, size) follows snprintf conventions
+	template<typename FormatMessage>
+	void push_batched(LogPriority message_priority, const Category* category, const char* message_priority_str, std::int64_t current_time, FormatMessage&& format_message,
+		const Field* fields = 0, std::size_t field_count = 0)
+	{
+		BatchCollector& collector = *batch_collector;
+		ThreadBuffer& buffer = thread_buffer();
+		bool wake = message_priority >= ErrorPriority;
+
+		{
+			std::scoped_lock lock(buffer.mutex);
+			std::string& data = buffer.data;
+
+			std::size_t offset = data.size();
+			std::size_t room = YELLOG_ASYNC_MESSAGE_SIZE;
+			data.resize(offset + room);
+			int length = format_message(&data[offset], room);
+			if (length < 0)
+			{
+				length = 0;
+			}
+			else if ((std::size_t)length >= room)
+			{
+				data.resize(offset + (std::size_t)length + 1);
+				format_message(&data[offset], (std::size_t)length + 1);
+			}
+			data.resize(offset + (std::size_t)length + 1);
+
+			for (std::size_t i = 0; i < field_count; i++)
+			{
+				std::size_t position = data.size();
+				data.resize(position + binary_field_size(fields[i]) + 1);
+				pack_field(&data[position], fields[i]);
+			}
+
+			buffer.records.push_back({ current_time, message_priority, (std::uint32_t)field_count, message_priority_str, category, offset });
+			buffer.size.store(data.size(), std::memory_order_relaxed);
+
+			if (data.size() >= collector.batch_size && !buffer.wake_sent)
+			{
+				buffer.wake_sent = true;
+				wake = true;
+			}
+		}
+
+		if (wake)
+		{
+			collector.wake_collector();
+		}
+
+		bool count = stats_enabled.load(std::memory_order_relaxed);
+		std::size_t size = buffer.size.load(std::memory_order_relaxed);
+		if (count)
+		{
+			StatsShard::raise_to(thread_stats().batch_buffer_high_water, size);
+		}
+
+		// the collector is behind, wait for it instead of growing the buffer
+		if (size >= 4 * collector.batch_size)
+		{
+			std::int64_t wait_start = count ? steady_nanoseconds() : 0;
+			while (buffer.size.load(std::memory_order_relaxed) >= 4 * collector.batch_size)
+			{
+				collector.wake_collector();
+				std::this_thread::yield();
+			}
+			if (count)
+			{
+				StatsShard::add(thread_stats().queue_wait, steady_nanoseconds() - wait_start);
+			}
+		}
+	}
+
+	// Body of the batch collector thread
+	void run_batch_collector()
+	{
+		BatchCollector& collector = *batch_collector;
+
+		for (;;)
+		{
+			// requests made after this are seen before the collector waits again
+			collector.wake_requested.store(false);
+
+			// everything logged before these were read is in the buffers collected below
+			std::uint64_t requested = collector.flush_requests.load(std::memory_order_acquire);
+			bool stopping = collector.stop.load(std::memory_order_acquire);
+
+			write_batch();
+
+			{
+				std::scoped_lock lock(collector.wake_mutex);
+				collector.flushes_done.store(requested, std::memory_order_release);
+				collector.drained.notify_all();
+			}
+
+			if (stopping)
+			{
+				return;
+			}
+
+			std::unique_lock lock(collector.wake_mutex);
+			collector.collector_waiting.store(true);
+			if (!collector.wake_requested.load() && !collector.stop.load())
+			{
+				collector.wake.wait_for(lock, collector.interval);
+			}
+			collector.collector_waiting.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	// Takes the messages of every thread, merges them by timestamp and writes them, called by the collector thread
+	void write_batch()
+	{
+		BatchCollector& collector = *batch_collector;
+
+		{
+			std::scoped_lock lock(collector.buffers_mutex);
+			collector.collected = collector.buffers;
+
+			// buffers of exited threads are dropped once the last of their messages is taken below
+			collector.buffers.erase(std::remove_if(collector.buffers.begin(), collector.buffers.end(),
+				[](const std::shared_ptr<ThreadBuffer>& buffer)
+				{
+					std::scoped_lock buffer_lock(buffer->mutex);
+					return buffer->exited;
+				}),
+				collector.buffers.end());
+		}
+
+		if (collector.batches.size() < collector.collected.size())
+		{
+			collector.batches = std::vector<ThreadBuffer>(collector.collected.size());
+		}
+
+		// swapping keeps the allocated memory of both sides
+		std::size_t count = collector.collected.size();
+		bool urgent = false;
+		for (std::size_t i = 0; i < count; i++)
+		{
+			ThreadBuffer& buffer = *collector.collected[i];
+			ThreadBuffer& batch = collector.batches[i];
+
+			std::scoped_lock lock(buffer.mutex);
+			std::swap(buffer.records, batch.records);
+			std::swap(buffer.data, batch.data);
+			buffer.records.clear();
+			buffer.data.clear();
+			buffer.size.store(0, std::memory_order_relaxed);
+			buffer.wake_sent = false;
+		}
+		collector.collected.clear();
+
+		// k-way merge, records of each thread are already in timestamp order
+		typedef std::pair<std::int64_t, std::size_t> Head;	// time of the next record, batch index
+		std::vector<Head> heads;
+		std::vector<std::size_t> positions(count, 0);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			if (!collector.batches[i].records.empty())
+			{
+				heads.emplace_back(collector.batches[i].records[0].time, i);
+			}
+		}
+		std::make_heap(heads.begin(), heads.end(), std::greater<Head>());
+
+		if (!heads.empty())
+		{
+			std::scoped_lock lock(log_mutex);
+
+			while (!heads.empty())
+			{
+				std::pop_heap(heads.begin(), heads.end(), std::greater<Head>());
+				std::size_t i = heads.back().second;
+				ThreadBuffer& batch = collector.batches[i];
+				const BufferedRecord& buffered = batch.records[positions[i]++];
+
+				write_buffered_record(buffered, batch.data.data() + buffered.offset, collector.fields);
+				urgent = urgent || buffered.priority >= ErrorPriority;
+
+				if (positions[i] < batch.records.size())
+				{
+					heads.back().first = batch.records[positions[i]].time;
+					std::push_heap(heads.begin(), heads.end(), std::greater<Head>());
+				}
+				else
+				{
+					heads.pop_back();
+				}
+			}
+
+			if (urgent)
+			{
+				flush_sinks();
+			}
+		}
+
+		for (std::size_t i = 0; i < count; i++)
+		{
+			collector.batches[i].records.clear();
+			collector.batches[i].data.clear();
+		}
+	}
+
+	// Called by the collector thread with log_mutex held
+	void write_buffered_record(const BufferedRecord& buffered, const char* message, std::vector<Field>& fields)
+	{
+		SettingsGuard guard(*this);
+		Record record = make_record(guard.get(), buffered.priority, buffered.category, buffered.priority_str, buffered.time);
+
+		if (buffered.field_count)
+		{
+			fields.resize(buffered.field_count);
+			const char* pos = message + std::strlen(message) + 1;
+			for (Field& field : fields)
+			{
+				pos = decode_field(pos, field);
+			}
+			record.fields = fields.data();
+			record.field_count = fields.size();
+		}
+
+		std::vector<char>& line = line_buffer();
+		assemble_line(line, record,
+			[&](char* out, std::size_t size)
+			{
+				if (record.fields)
+				{
+					return format_fields_message(out, size, message, record.fields, record.field_count);
+				}
+				return std::snprintf(out, size, "%s", message);
+			});
+		if (record.fields)
+		{
+			record.message_length = std::strlen(message);
+		}
+
+		write_record(guard.get(), buffered.category, record);
+	}
+
+	// Writes what is left in the thread buffers and joins the collector thread
+	void stop_batched_output()
+	{
+		if (!batch_collector)
+		{
+			return;
+		}
+
+		batch_collector->stop.store(true, std::memory_order_release);
+		{
+			std::scoped_lock lock(batch_collector->wake_mutex);
+			batch_collector->wake.notify_one();
+		}
+
+		batch_collector->thread.join();
+		batched_enabled.store(false, std::memory_order_release);
+	}
+
+	// Drains the queue and joins the writer thread
+	void stop_async_output()
+	{
+		if (!async_writer)
+		{
+			return;
+		}
+
+		{
+			std::scoped_lock lock(async_writer->wake_mutex);
+			async_writer->stop.store(true, std::memory_order_release);
+			async_writer->wake.notify_one();
+		}
+
+		async_writer->thread.join();
+		async_enabled.store(false, std::memory_order_release);
+	}
+
+	// Stats
+
+	StatsShard& thread_stats()
+	{
+		static thread_local ThreadStatsHandle handle;
+		if (!handle.shard)
+		{
+			handle.shard = std::make_shared<StatsShard>();
+			std::scoped_lock lock(stats_mutex);
+			stats_shards.push_back(handle.shard);
+		}
+		return *handle.shard;
+	}
+
+	// Counts an emitting logging call and measures its duration when stats are enabled
+	struct CallStats
+	{
+		Yellog& logger;
+		LogPriority priority;
+		std::int64_t start = 0;
+
+		CallStats(Yellog& logger_instance, LogPriority message_priority) : logger(logger_instance), priority(message_priority)
+		{
+			if (logger.stats_enabled.load(std::memory_order_relaxed))
+			{
+				start = steady_nanoseconds();
+			}
+		}
+
+		~CallStats()
+		{
+			if (start != 0)
+			{
+				logger.finish_call(priority, steady_nanoseconds() - start);
+			}
+		}
+	};
+
+	void finish_call(LogPriority message_priority, std::int64_t duration)
+	{
+		StatsShard& stats = thread_stats();
+		StatsShard::add(stats.emitted[message_priority], (std::uint64_t)1);
+		StatsShard::add(stats.latency[latency_bucket((std::uint64_t)duration)], (std::uint64_t)1);
+
+		std::int64_t interval = stats_report_interval.load(std::memory_order_relaxed);
+		if (interval != 0)
+		{
+			std::int64_t current_time = now();
+			std::int64_t next_report = next_stats_report.load(std::memory_order_relaxed);
+			if (current_time >= next_report
+				&& next_stats_report.compare_exchange_strong(next_report, current_time + interval, std::memory_order_relaxed))
+			{
+				report_stats();
+			}
+		}
+	}
+
+	void count_filtered(LogPriority message_priority)
+	{
+		if (stats_enabled.load(std::memory_order_relaxed))
+		{
+			StatsShard::add(thread_stats().filtered[message_priority], (std::uint64_t)1);
+		}
+	}
+
+	void count_dropped(LogPriority message_priority)
+	{
+		if (stats_enabled.load(std::memory_order_relaxed))
+		{
+			StatsShard::add(thread_stats().dropped[message_priority], (std::uint64_t)1);
+		}
+	}
+
+	// Takes log_mutex, the time spent waiting for it is counted when stats are enabled
+	std::unique_lock<std::mutex> lock_log_mutex()
+	{
+		std::unique_lock<std::mutex> lock(log_mutex, std::try_to_lock);
+		if (!lock.owns_lock())
+		{
+			std::int64_t wait_start = stats_enabled.load(std::memory_order_relaxed) ? steady_nanoseconds() : 0;
+			lock.lock();
+			if (wait_start != 0)
+			{
+				StatsShard::add(thread_stats().lock_wait, steady_nanoseconds() - wait_start);
+			}
+		}
+		return lock;
+	}
+
+	static void add_stats(Stats& stats, const StatsShard& shard)
+	{
+		for (int level = TracePriority; level <= CriticalPriority; level++)
+		{
+			stats.emitted[level] += shard.emitted[level].load(std::memory_order_relaxed);
+			stats.filtered[level] += shard.filtered[level].load(std::memory_order_relaxed);
+			stats.dropped[level] += shard.dropped[level].load(std::memory_order_relaxed);
+		}
+		stats.async_queue_high_water = std::max(stats.async_queue_high_water, shard.async_queue_high_water.load(std::memory_order_relaxed));
+		stats.batch_buffer_high_water = std::max(stats.batch_buffer_high_water, shard.batch_buffer_high_water.load(std::memory_order_relaxed));
+		stats.lock_wait_ns += shard.lock_wait.load(std::memory_order_relaxed);
+		stats.queue_wait_ns += shard.queue_wait.load(std::memory_order_relaxed);
+
+		stats.latency.resize(latency_bucket_count);
+		for (std::size_t i = 0; i < latency_bucket_count; i++)
+		{
+			stats.latency[i] += shard.latency[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	Stats get_stats()
+	{
+		Stats stats;
+		{
+			std::scoped_lock lock(stats_mutex);
+
+			// counters of exited threads are kept in exited_stats, their shards are dropped
+			for (std::size_t i = 0; i < stats_shards.size();)
+			{
+				if (stats_shards[i]->exited.load(std::memory_order_acquire))
+				{
+					add_stats(exited_stats, *stats_shards[i]);
+					stats_shards[i] = std::move(stats_shards.back());
+					stats_shards.pop_back();
+				}
+				else
+				{
+					i++;
+				}
+			}
+
+			stats = exited_stats;
+			stats.latency.resize(latency_bucket_count);
+			for (const std::shared_ptr<StatsShard>& shard : stats_shards)
+			{
+				add_stats(stats, *shard);
+			}
+		}
+
+		SettingsGuard guard(*this);
+		const Settings& current = guard.get();
+		for (const std::shared_ptr<Sink>& sink : current.concurrent_sinks)
+		{
+			stats.sinks.push_back({ sink, sink->GetBytesWritten() });
+		}
+		for (const std::shared_ptr<Sink>& sink : current.locked_sinks)
+		{
+			stats.sinks.push_back({ sink, sink->GetBytesWritten() });
+		}
+		for (const Settings::CategorySettings& category_settings : current.categories)
+		{
+			for (const std::shared_ptr<Sink>& sink : category_settings.sinks)
+			{
+				stats.sinks.push_back({ sink, sink->GetBytesWritten() });
+			}
+		}
+
+		return stats;
+	}
+
+	// Logs a summary of the counters, called by the logging call that finds the report due
+	void report_stats()
+	{
+		Stats stats = get_stats();
+
+		std::uint64_t bytes = 0;
+		for (const Stats::SinkStats& sink : stats.sinks)
+		{
+			bytes += sink.bytes_written;
+		}
+
+		log<InfoPriority>(0, "[Info]     ", "Yellog stats: emitted %llu, filtered %llu, dropped %llu, written %llu bytes, "
+			"async queue high water %llu, lock wait %.3f ms, queue wait %.3f ms, call p50 %llu ns, p99 %llu ns, p99.9 %llu ns",
+			(unsigned long long)Stats::Total(stats.emitted), (unsigned long long)Stats::Total(stats.filtered),
+			(unsigned long long)Stats::Total(stats.dropped), (unsigned long long)bytes, (unsigned long long)stats.async_queue_high_water,
+			stats.lock_wait_ns / 1e6, stats.queue_wait_ns / 1e6, (unsigned long long)stats.LatencyPercentile(0.5),
+			(unsigned long long)stats.LatencyPercentile(0.99), (unsigned long long)stats.LatencyPercentile(0.999));
+	}
+
+	// Flight recorder
+
+	// Takes the next slot of the ring, fill(slot) writes the data and returns its length
+	template<typename Fill>
+	void record_recent(LogPriority message_priority, const char* message_priority_str, RecentKind kind, const char* message, Fill&& fill)
+	{
+		FlightRecorder& recorder = *flight_recorder;
+		std::uint64_t number = recorder.next.fetch_add(1, std::memory_order_relaxed);
+		RecentRecord& recent = recorder.slots[number & recorder.mask];
+
+		// a dump skips the slot while its sequence belongs to another message,
+		// the message is dropped if another call is still writing the slot or a newer message is already in it
+		std::uint64_t sequence = recent.sequence.load(std::memory_order_relaxed);
+		if (sequence > number || !recent.sequence.compare_exchange_strong(sequence, recent_writing, std::memory_order_acquire))
+		{
+			return;
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+
+		recent.time = now();
+		recent.priority = message_priority;
+		recent.kind = kind;
+		recent.field_count = 0;
+		recent.priority_str = message_priority_str;
+		recent.message = message;
+		recent.length = (std::uint32_t)fill(recent);
+
+		recent.sequence.store(number + 1, std::memory_order_release);
+	}
+
+	static std::size_t string_room(const RecentWriter& out)
+	{
+		return out.room_for_string();
+	}
+
+	static void encode_recent_string(RecentWriter& out, std::string_view text)
+	{
+		std::size_t length = std::min(text.size(), out.room_for_string());
+		out += 's';
+		put_varint(out, length);
+		out.append(text.data(), length);
+	}
+
+	// Encodes a flight recorder argument like encode_argument, {} messages use two more tags:
+	//	'c' char (1 byte), 'f' float (stored as a double, printed with float precision when there is no spec)
+	// In {} messages bool is stored as a string, types with no tag (durations, ValueFormatter types) are formatted right away
+	// printf arguments with no tag are stored as '?'
+	template<bool Braces, typename T>
+	static void encode_recent(RecentWriter& out, const T& arg)
+	{
+		typedef std::decay_t<const T> Decayed;
+		const Decayed& value = arg;
+
+		if constexpr (Braces && std::is_same_v<Decayed, bool>)
+		{
+			encode_recent_string(out, value ? std::string_view("true") : std::string_view("false"));
+		}
+		else if constexpr (Braces && std::is_same_v<Decayed, char>)
+		{
+			out += 'c';
+			out += value;
+		}
+		else if constexpr (Braces && std::is_same_v<Decayed, float>)
+		{
+			double promoted = value;
+			std::uint64_t bits;
+			std::memcpy(&bits, &promoted, 8);
+			out += 'f';
+			put_fixed(out, bits, 8);
+		}
+		else if constexpr (is_deferrable<Decayed>)
+		{
+			encode_argument(out, value);
+		}
+		else if constexpr (std::is_pointer_v<Decayed> && !std::is_function_v<std::remove_pointer_t<Decayed>>)
+		{
+			// only the address, what it points to may be gone when the slot is dumped
+			encode_argument(out, (const void*)value);
+		}
+		else if constexpr (is_string_like<Decayed>)
+		{
+			encode_recent_string(out, std::string_view(value));
+		}
+		else if constexpr (Braces)
+		{
+			char text[128];
+			FormatBuffer buffer(text, sizeof(text));
+			format_value<0, -1>(buffer, value);
+			encode_recent_string(out, std::string_view(text, std::min(buffer.Length(), sizeof(text) - 1)));
+		}
+		else
+		{
+			out += '?';
+		}
+
+		out.commit();
+	}
+
+	// An argument read back from a flight recorder slot
+	struct RecentArgument
+	{
+		char tag = 0;	// 0 when there are no more arguments
+		std::uint64_t bits = 0;	// integers (sign-extended), pointers and double bits
+		std::string_view text;
+	};
+
+	static std::uint64_t get_varint(const char*& pos, const char* end)
+	{
+		std::uint64_t value = 0;
+		for (int shift = 0; pos != end && shift < 64; shift += 7)
+		{
+			unsigned char byte = (unsigned char)*pos++;
+			value |= (std::uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+			{
+				break;
+			}
+		}
+		return value;
+	}
+
+	static RecentArgument read_recent_argument(const char*& pos, const char* end)
+	{
+		RecentArgument argument;
+		if (pos == end)
+		{
+			return argument;
+		}
+
+		argument.tag = *pos++;
+		switch (argument.tag)
+		{
+		case 'i':
+		case 'l':
+		case 'q':
+		{
+			std::uint64_t zigzag = get_varint(pos, end);
+			argument.bits = (zigzag >> 1) ^ (0 - (zigzag & 1));
+			break;
+		}
+		case 'u':
+		case 'm':
+		case 'Q':
+			argument.bits = get_varint(pos, end);
+			break;
+		case 'c':
+			argument.bits = pos != end ? (std::uint64_t)(std::int64_t)*pos++ : 0;
+			break;
+		case 'd':
+		case 'D':
+		case 'f':
+		case 'p':
+			if (end - pos < 8)
+			{
+				pos = end;
+				argument.tag = 0;
+				break;
+			}
+			argument.bits = get_integer(pos, 8);
+			pos += 8;
+			break;
+		case 's':
+		{
+			std::size_t length = (std::size_t)std::min<std::uint64_t>(get_varint(pos, end), (std::uint64_t)(end - pos));
+			argument.text = std::string_view(pos, length);
+			pos += length;
+			break;
+		}
+		}
+
+		return argument;
+	}
+
+	static bool is_integer_tag(char tag)
+	{
+		return tag == 'i' || tag == 'l' || tag == 'q' || tag == 'u' || tag == 'm' || tag == 'Q' || tag == 'c';
+	}
+
+	static bool is_double_tag(char tag)
+	{
+		return tag == 'd' || tag == 'D' || tag == 'f';
+	}
+
+	// Integer argument as printf reads it, cut to the size it was passed with
+	static std::uint64_t integer_bits(const RecentArgument& argument, bool as_signed)
+	{
+		int size = argument.tag == 'i' || argument.tag == 'u' || argument.tag == 'c' ? 32
+			: argument.tag == 'l' || argument.tag == 'm' ? (int)sizeof(long) * 8 : 64;
+
+		std::uint64_t value = argument.bits;
+		if (size < 64)
+		{
+			std::uint64_t mask = ((std::uint64_t)1 << size) - 1;
+			value &= mask;
+			if (as_signed && (value >> (size - 1)) != 0)
+			{
+				value |= ~mask;
+			}
+		}
+		return value;
+	}
+
+	static double double_value(const RecentArgument& argument)
+	{
+		double value;
+		std::memcpy(&value, &argument.bits, 8);
+		return value;
+	}
+
+	static void to_upper(char* begin, char* end)
+	{
+		for (char* c = begin; c != end; c++)
+		{
+			if (*c >= 'a' && *c <= 'z')
+			{
+				*c = (char)(*c - 'a' + 'A');
+			}
+		}
+	}
+
+	// printf for the dump, supports flags, width, precision (also *) and the conversions of the standard,
+	// length modifiers are skipped since arguments keep the size they were passed with
+	static void format_recent_printf(FormatBuffer& out, const char* format, const char* pos, const char* end)
+	{
+		for (const char* c = format; *c != '\0'; c++)
+		{
+			if (*c != '%')
+			{
+				out.Append(*c);
+				continue;
+			}
+
+			const char* spec = c++;
+			if (*c == '%')
+			{
+				out.Append('%');
+				continue;
+			}
+
+			bool left = false, zero = false, plus = false, space = false, alternate = false;
+			for (;; c++)
+			{
+				if (*c == '-') left = true;
+				else if (*c == '0') zero = true;
+				else if (*c == '+') plus = true;
+				else if (*c == ' ') space = true;
+				else if (*c == '#') alternate = true;
+				else break;
+			}
+
+			// a wider field or more digits than a line holds would be cut anyway, the limit keeps the padding loops short
+			constexpr std::int64_t max_field = YELLOG_LINE_BUFFER_SIZE;
+
+			std::int64_t width = 0;
+			if (*c == '*')
+			{
+				width = (std::int64_t)integer_bits(read_recent_argument(pos, end), true);
+				if (width < 0)
+				{
+					left = true;
+					width = width < -max_field ? max_field : -width;
+				}
+				width = std::min(width, max_field);
+				c++;
+			}
+			for (; *c >= '0' && *c <= '9'; c++)
+			{
+				width = std::min(width * 10 + (*c - '0'), max_field);
+			}
+
+			int precision = -1;
+			if (*c == '.')
+			{
+				c++;
+				precision = 0;
+				if (*c == '*')
+				{
+					std::int64_t value = (std::int64_t)integer_bits(read_recent_argument(pos, end), true);
+					precision = value < 0 ? -1 : (int)std::min(value, max_field);
+					c++;
+				}
+				for (; *c >= '0' && *c <= '9'; c++)
+				{
+					precision = (int)std::min<std::int64_t>(precision * 10 + (*c - '0'), max_field);
+				}
+			}
+
+			while (*c == 'h' || *c == 'l' || *c == 'L' || *c == 'q' || *c == 'j' || *c == 'z' || *c == 't')
+			{
+				c++;
+			}
+
+			char conversion = *c;
+			if (conversion == '\0')
+			{
+				out.Append(spec, (std::size_t)(c - spec));
+				break;
+			}
+			if (conversion == 'n')
+			{
+				read_recent_argument(pos, end);
+				continue;
+			}
+
+			RecentArgument argument = read_recent_argument(pos, end);
+			char text[512];
+			std::string_view body;
+			const char* prefix = "";
+			char sign = 0;
+			bool numeric = false;
+			int min_digits = 0;
+			bool upper = conversion >= 'A' && conversion <= 'Z';
+
+			switch (conversion)
+			{
+			case 'd':
+			case 'i':
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+			{
+				if (!is_integer_tag(argument.tag))
+				{
+					break;
+				}
+
+				bool is_signed = conversion == 'd' || conversion == 'i';
+				std::uint64_t value = integer_bits(argument, is_signed);
+				if (is_signed && (std::int64_t)value < 0)
+				{
+					sign = '-';
+					value = 0 - value;
+				}
+				else if (is_signed)
+				{
+					sign = plus ? '+' : space ? ' ' : 0;
+				}
+
+				int base = conversion == 'x' || conversion == 'X' ? 16 : conversion == 'o' ? 8 : 10;
+				char* digits_end = std::to_chars(text, text + sizeof(text), value, base).ptr;
+				if (precision == 0 && value == 0)
+				{
+					digits_end = text;
+				}
+				if (upper)
+				{
+					to_upper(text, digits_end);
+				}
+				body = std::string_view(text, (std::size_t)(digits_end - text));
+
+				if (alternate && value != 0)
+				{
+					prefix = base == 16 ? (upper ? "0X" : "0x") : base == 8 ? "0" : "";
+				}
+				numeric = true;
+				min_digits = precision;
+				if (precision >= 0)
+				{
+					zero = false;
+				}
+				break;
+			}
+			case 'c':
+				if (is_integer_tag(argument.tag))
+				{
+					text[0] = (char)argument.bits;
+					body = std::string_view(text, 1);
+				}
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+			{
+				if (!is_double_tag(argument.tag))
+				{
+					break;
+				}
+
+				double value = double_value(argument);
+				if (argument.bits >> 63)
+				{
+					sign = '-';
+					value = -value;
+				}
+				else
+				{
+					sign = plus ? '+' : space ? ' ' : 0;
+				}
+
+				char lower = (char)(conversion | 0x20);
+				std::chars_format chars_format = lower == 'e' ? std::chars_format::scientific
+					: lower == 'g' ? std::chars_format::general : lower == 'a' ? std::chars_format::hex : std::chars_format::fixed;
+				std::to_chars_result result = lower == 'a' && precision < 0
+					? std::to_chars(text, text + sizeof(text), value, chars_format)
+					: std::to_chars(text, text + sizeof(text), value, chars_format, precision < 0 ? 6 : precision);
+				if (result.ec != std::errc())
+				{
+					break;
+				}
+
+				if (lower == 'a' && text[0] >= '0' && text[0] <= '9')
+				{
+					prefix = upper ? "0X" : "0x";
+				}
+				if (upper)
+				{
+					to_upper(text, result.ptr);
+				}
+				body = std::string_view(text, (std::size_t)(result.ptr - text));
+				numeric = text[0] >= '0' && text[0] <= '9';
+				break;
+			}
+			case 's':
+				if (argument.tag == 's')
+				{
+					body = argument.text.substr(0, precision < 0 ? argument.text.size() : (std::size_t)precision);
+				}
+				break;
+			case 'p':
+				if (argument.tag == 'p' || is_integer_tag(argument.tag))
+				{
+					body = std::string_view(text, (std::size_t)(std::to_chars(text, text + sizeof(text), argument.bits, 16).ptr - text));
+					prefix = "0x";
+				}
+				break;
+			default:
+				// not a conversion, written as it is
+				out.Append(spec, (std::size_t)(c + 1 - spec));
+				continue;
+			}
+
+			if (body.data() == 0)
+			{
+				body = "(?)";
+				prefix = "";
+				sign = 0;
+				numeric = false;
+			}
+
+			std::size_t zeros = min_digits > (int)body.size() ? (std::size_t)min_digits - body.size() : 0;
+			std::size_t length = (sign ? 1 : 0) + std::strlen(prefix) + zeros + body.size();
+			std::size_t padding = (std::size_t)width > length ? (std::size_t)width - length : 0;
+			bool zero_padding = zero && numeric && !left;
+
+			for (std::size_t i = 0; !left && !zero_padding && i < padding; i++)
+			{
+				out.Append(' ');
+			}
+			if (sign)
+			{
+				out.Append(sign);
+			}
+			out.Append(std::string_view(prefix));
+			for (std::size_t i = 0; i < zeros + (zero_padding ? padding : 0); i++)
+			{
+				out.Append('0');
+			}
+			out.Append(body);
+			for (std::size_t i = 0; left && i < padding; i++)
+			{
+				out.Append(' ');
+			}
+		}
+	}
+
+	// Appends a {} argument of the dump, spec was checked against the argument type at compile time
+	static void append_recent_value(FormatBuffer& out, const RecentArgument& argument, char type, int precision)
+	{
+		char text[512];
+
+		if (argument.tag == 'c' && (type == 0 || type == 'c'))
+		{
+			out.Append((char)argument.bits);
+		}
+		else if (is_integer_tag(argument.tag))
+		{
+			int base = type == 'x' || type == 'X' ? 16 : type == 'o' ? 8 : type == 'b' ? 2 : 10;
+			bool is_signed = argument.tag == 'i' || argument.tag == 'l' || argument.tag == 'q' || argument.tag == 'c';
+			char* digits_end = is_signed ? std::to_chars(text, text + sizeof(text), (std::int64_t)argument.bits, base).ptr
+				: std::to_chars(text, text + sizeof(text), argument.bits, base).ptr;
+			if (type == 'X')
+			{
+				to_upper(text, digits_end);
+			}
+			out.Append(text, (std::size_t)(digits_end - text));
+		}
+		else if (is_double_tag(argument.tag))
+		{
+			double value = double_value(argument);
+			std::to_chars_result result;
+			if (precision < 0 && type == 0)
+			{
+				result = argument.tag == 'f' ? std::to_chars(text, text + sizeof(text), (float)value)
+					: std::to_chars(text, text + sizeof(text), value);
+			}
+			else
+			{
+				std::chars_format chars_format = type == 'e' ? std::chars_format::scientific
+					: type == 'g' ? std::chars_format::general : std::chars_format::fixed;
+				result = std::to_chars(text, text + sizeof(text), value, chars_format, precision < 0 ? 6 : precision);
+			}
+
+			if (result.ec == std::errc())
+			{
+				out.Append(text, (std::size_t)(result.ptr - text));
+			}
+			else
+			{
+				out.Append(std::string_view("(out of range)"));
+			}
+		}
+		else if (argument.tag == 's')
+		{
+			out.Append(argument.text);
+		}
+		else if (argument.tag == 'p')
+		{
+			out.Append(std::string_view("0x"));
+			out.Append(text, (std::size_t)(std::to_chars(text, text + sizeof(text), argument.bits, 16).ptr - text));
+		}
+		else
+		{
+			out.Append(std::string_view("(?)"));
+		}
+	}
+
+	// {} formatting for the dump, the format string was checked at compile time
+	static void format_recent_braces(FormatBuffer& out, const char* format, const char* pos, const char* end)
+	{
+		for (const char* c = format; *c != '\0'; c++)
+		{
+			if ((*c == '{' || *c == '}') && c[1] == *c)
+			{
+				out.Append(*c++);
+				continue;
+			}
+			if (*c != '{')
+			{
+				out.Append(*c);
+				continue;
+			}
+
+			char type = 0;
+			int precision = -1;
+			c++;
+			if (*c == ':')
+			{
+				c++;
+				if (*c == '.')
+				{
+					c++;
+					precision = 0;
+					for (; *c >= '0' && *c <= '9'; c++)
+					{
+						precision = precision * 10 + (*c - '0');
+					}
+				}
+				if (*c != '}')
+				{
+					type = *c++;
+				}
+			}
+
+			append_recent_value(out, read_recent_argument(pos, end), type, precision);
+		}
+	}
+
+	static void format_recent(FormatBuffer& out, const RecentRecord& recent)
+	{
+		const char* data_end = recent.data + recent.length;
+
+		switch (recent.kind)
+		{
+		case RecentText:
+			out.Append(recent.data, recent.length);
+			break;
+		case RecentPrintf:
+		{
+			const char* format_end = (const char*)std::memchr(recent.data, '\0', recent.length);
+			if (format_end)
+			{
+				format_recent_printf(out, recent.data, format_end + 1, data_end);
+			}
+			break;
+		}
+		case RecentBraces:
+			format_recent_braces(out, recent.message, recent.data, data_end);
+			break;
+		case RecentFields:
+		{
+			out.Append(std::string_view(recent.data));
+			const char* pos = recent.data + std::strlen(recent.data) + 1;
+			for (std::uint32_t i = 0; i < recent.field_count; i++)
+			{
+				Field field;
+				pos = decode_field(pos, field);
+				append_field(out, field);
+			}
+			break;
+		}
+		}
+	}
+
+	// strftime for the dump, supports %Y %y %m %d %H %M %S %T %F %R %f and %%, time is local time in nanoseconds since epoch
+	static void format_recent_timestamp(FormatBuffer& out, std::int64_t time, const char* format, int digits)
+	{
+		std::int64_t second = time / 1000000000;
+		std::int64_t fraction = time % 1000000000;
+		if (fraction < 0)
+		{
+			second--;
+			fraction += 1000000000;
+		}
+
+		std::int64_t days = second / 86400;
+		std::int64_t second_of_day = second % 86400;
+		if (second_of_day < 0)
+		{
+			days--;
+			second_of_day += 86400;
+		}
+
+		std::int64_t year;
+		int month, day;
+		civil_from_days(days, year, month, day);
+		int hour = (int)(second_of_day / 3600);
+		int minute = (int)(second_of_day / 60 % 60);
+		int seconds = (int)(second_of_day % 60);
+
+		auto two_digits = [&](int value)
+		{
+			out.Append((char)('0' + value / 10));
+			out.Append((char)('0' + value % 10));
+		};
+		auto append_year = [&]
+		{
+			char text[24];
+			out.Append(text, (std::size_t)(std::to_chars(text, text + sizeof(text), year).ptr - text));
+		};
+
+		for (const char* c = format; *c != '\0'; c++)
+		{
+			if (*c != '%' || c[1] == '\0')
+			{
+				out.Append(*c);
+				continue;
+			}
+
+			switch (*++c)
+			{
+			case 'Y':
+				append_year();
+				break;
+			case 'y':
+				two_digits((int)(((year % 100) + 100) % 100));
+				break;
+			case 'm':
+				two_digits(month);
+				break;
+			case 'd':
+				two_digits(day);
+				break;
+			case 'H':
+				two_digits(hour);
+				break;
+			case 'M':
+				two_digits(minute);
+				break;
+			case 'S':
+				two_digits(seconds);
+				break;
+			case 'T':
+				two_digits(hour);
+				out.Append(':');
+				two_digits(minute);
+				out.Append(':');
+				two_digits(seconds);
+				break;
+			case 'R':
+				two_digits(hour);
+				out.Append(':');
+				two_digits(minute);
+				break;
+			case 'F':
+				append_year();
+				out.Append('-');
+				two_digits(month);
+				out.Append('-');
+				two_digits(day);
+				break;
+			case 'f':
+			{
+				std::int64_t divisor = 100000000;
+				for (int i = 0; i < digits; i++, divisor /= 10)
+				{
+					out.Append((char)('0' + fraction / divisor % 10));
+				}
+				break;
+			}
+			case '%':
+				out.Append('%');
+				break;
+			default:
+				out.Append('%');
+				out.Append(*c);
+				break;
+			}
+		}
+	}
+
+	static void write_dump([[maybe_unused]] int descriptor, const char* data, std::size_t length)
+	{
+#if defined(YELLOG_POSIX)
+		if (descriptor < 0)
+		{
+			descriptor = STDERR_FILENO;
+		}
+
+		while (length > 0)
+		{
+			ssize_t written = ::write(descriptor, data, length);
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				return;
+			}
+			data += written;
+			length -= (std::size_t)written;
+		}
+#else
+		std::fwrite(data, 1, length, stderr);
+		std::fflush(stderr);
+#endif
+	}
+
+	// Writes the recorded messages oldest first, only async-signal-safe calls are used
+	// signal_number is the signal being handled, 0 for Yellog::DumpRecent
+	// A dump started while another one runs (e.g. a signal raised by the dump) only writes a line saying so
+	void dump_recent(FlightRecorder& recorder, int signal_number)
+	{
+		int saved_errno = errno;
+		int descriptor = dump_descriptor.load(std::memory_order_relaxed);
+		if (recorder.dumping.exchange(true, std::memory_order_acquire))
+		{
+			static constexpr char in_progress[] = "---- Yellog flight recorder dump already in progress ----\n";
+			write_dump(descriptor, in_progress, sizeof(in_progress) - 1);
+			errno = saved_errno;
+			return;
+		}
+
+		const char* format = timestamp_format.load(std::memory_order_relaxed);
+		int digits = timestamp_digits.load(std::memory_order_relaxed);
+		std::int64_t offset = utc_offset.load(std::memory_order_relaxed) * 1000000000;
+
+		std::uint64_t end = recorder.next.load(std::memory_order_acquire);
+		std::uint64_t capacity = recorder.mask + 1;
+		std::uint64_t begin = end > capacity ? end - capacity : 0;
+
+		char line[YELLOG_LINE_BUFFER_SIZE];
+		char number[24];
+		{
+			FormatBuffer buffer(line, sizeof(line));
+			buffer.Append(std::string_view("---- Yellog flight recorder, last "));
+			buffer.Append(number, (std::size_t)(std::to_chars(number, number + sizeof(number), end - begin).ptr - number));
+			buffer.Append(std::string_view(" messages"));
+			if (signal_number != 0)
+			{
+				buffer.Append(std::string_view(", signal "));
+				buffer.Append(number, (std::size_t)(std::to_chars(number, number + sizeof(number), signal_number).ptr - number));
+			}
+			buffer.Append(std::string_view(" ----\n"));
+			write_dump(descriptor, line, std::min(buffer.Length(), sizeof(line) - 1));
+		}
+
+		RecentRecord recent;
+		for (std::uint64_t i = begin; i < end; i++)
+		{
+			const RecentRecord& slot = recorder.slots[i & recorder.mask];
+			if (slot.sequence.load(std::memory_order_acquire) != i + 1)
+			{
+				continue;
+			}
+
+			recent.time = slot.time;
+			recent.priority = slot.priority;
+			recent.kind = slot.kind;
+			recent.field_count = slot.field_count;
+			recent.length = std::min<std::uint32_t>(slot.length, sizeof(recent.data));
+			recent.priority_str = slot.priority_str;
+			recent.message = slot.message;
+			std::memcpy(recent.data, slot.data, recent.length);
+
+			// the slot was overwritten while it was copied
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) != i + 1)
+			{
+				continue;
+			}
+
+			FormatBuffer buffer(line, sizeof(line));
+			format_recent_timestamp(buffer, recent.time + offset, format, digits);
+			buffer.Append(std::string_view("    "));
+			buffer.Append(std::string_view(recent.priority_str));
+			format_recent(buffer, recent);
+
+			std::size_t length = std::min(buffer.Length(), sizeof(line) - 1);
+			line[length] = '\n';
+			write_dump(descriptor, line, length + 1);
+		}
+
+		errno = saved_errno;
+		recorder.dumping.store(false, std::memory_order_release);
+	}
+
+#if defined(YELLOG_POSIX)
+	static constexpr int recorder_signals[] = { SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL };
+	static constexpr std::size_t recorder_signal_count = sizeof(recorder_signals) / sizeof(recorder_signals[0]);
+
+	// Handlers that were installed before the flight recorder ones
+	static struct sigaction* previous_signal_actions()
+	{
+		static struct sigaction actions[recorder_signal_count];
+		return actions;
+	}
+
+	static void recorder_signal_handler(int signal_number)
+	{
+		Yellog& logger_instance = get_instance();
+		logger_instance.dump_recent(*logger_instance.flight_recorder, signal_number);
+
+		// the previous handler (or the default action) gets the signal once this handler returns
+		for (std::size_t i = 0; i < recorder_signal_count; i++)
+		{
+			if (recorder_signals[i] == signal_number)
+			{
+				sigaction(signal_number, &previous_signal_actions()[i], 0);
+			}
+		}
+		raise(signal_number);
+	}
+#endif
+
+	// Called with config_mutex held
+	void install_signal_handlers()
+	{
+#if defined(YELLOG_POSIX)
+		struct sigaction action;
+		std::memset(&action, 0, sizeof(action));
+		action.sa_handler = &recorder_signal_handler;
+		sigemptyset(&action.sa_mask);
+		// runs on the alternate stack of the thread if it has one, so a stack overflow can still be dumped
+		action.sa_flags = SA_ONSTACK;
+
+		for (std::size_t i = 0; i < recorder_signal_count; i++)
+		{
+			sigaction(recorder_signals[i], &action, &previous_signal_actions()[i]);
+		}
+		flight_recorder->handles_signals = true;
+#endif
+	}
+
+	// Called with config_mutex held
+	void remove_signal_handlers()
+	{
+#if defined(YELLOG_POSIX)
+		if (flight_recorder->handles_signals)
+		{
+			for (std::size_t i = 0; i < recorder_signal_count; i++)
+			{
+				sigaction(recorder_signals[i], &previous_signal_actions()[i], 0);
+			}
+			flight_recorder->handles_signals = false;
+		}
+#endif
+	}
+
+	bool enable_flight_recorder(std::size_t capacity, bool handle_signals)
+	{
+		std::scoped_lock lock(config_mutex);
+
+		if (recorder_enabled.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+
+		if (!flight_recorder)
+		{
+			flight_recorder.reset(new FlightRecorder(capacity));
+		}
+
+		std::int64_t second = now() / 1000000000;
+		utc_offset.store(utc_offset_of(local_time(second), second), std::memory_order_relaxed);
+
+		if (handle_signals)
+		{
+			install_signal_handlers();
+		}
+		recorder_enabled.store(true, std::memory_order_release);
+
+		return true;
+	}
+
+	void disable_flight_recorder()
+	{
+		std::scoped_lock lock(config_mutex);
+
+		recorder_enabled.store(false, std::memory_order_release);
+		if (flight_recorder)
+		{
+			remove_signal_handlers();
+		}
+	}
+
+	// Configuration file
+
+	// A configuration file checked and ready to apply, settings missing from the file are not set
+	struct ParsedConfig
+	{
+		std::optional<LogPriority> priority;
+		std::optional<std::string> timestamp_format;
+		std::optional<TimestampPrecision> timestamp_precision;
+		std::optional<bool> console;
+		std::optional<std::string> file;	// empty to turn the file output off
+		std::shared_ptr<FileSink> file_sink;	// opened while checking the file
+		std::map<std::string, LogPriority> category_priorities;
+		std::map<std::string, bool> category_additive;
+		std::map<std::string, ConfigSink> sinks;
+		std::optional<bool> async;
+		std::optional<std::size_t> async_capacity;
+		std::optional<OverflowPolicy> async_overflow;
+		std::optional<bool> async_deferred;
+	};
+
+	static bool parse_config_priority(const std::string& text, LogPriority& out)
+	{
+		for (int i = TracePriority; i <= CriticalPriority; i++)
+		{
+			if (text == priority_name((LogPriority)i))
+			{
+				out = (LogPriority)i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static bool parse_config_bool(const std::string& text, bool& out)
+	{
+		if (text == "on" || text == "true" || text == "yes" || text == "1")
+		{
+			out = true;
+			return true;
+		}
+		if (text == "off" || text == "false" || text == "no" || text == "0")
+		{
+			out = false;
+			return true;
+		}
+		return false;
+	}
+
+	// A number with an optional K, M or G suffix (powers of 1024)
+	static bool parse_config_size(const std::string& text, std::size_t& out)
+	{
+		std::size_t value = 0;
+		const char* end = text.data() + text.size();
+		auto [last, error] = std::from_chars(text.data(), end, value);
+		if (error != std::errc() || last == text.data())
+		{
+			return false;
+		}
+		if (last != end)
+		{
+			if (last + 1 != end)
+			{
+				return false;
+			}
+			switch (*last)
+			{
+			case 'K': case 'k': value <<= 10; break;
+			case 'M': case 'm': value <<= 20; break;
+			case 'G': case 'g': value <<= 30; break;
+			default: return false;
+			}
+		}
+		out = value;
+		return true;
+	}
+
+	static bool parse_config_buffering(const std::string& text, BufferingPolicy& out)
+	{
+		static const char* const names[] = { "default", "none", "line", "full" };
+		for (int i = DefaultBuffering; i <= FullBuffering; i++)
+		{
+			if (text == names[i])
+			{
+				out = (BufferingPolicy)i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Opens the sink of a "sink.<name> = <type> [path] [option=value ...]" line, sets error if it can't
+	std::shared_ptr<Sink> open_config_sink(const std::string& definition, std::string& category, std::string& error)
+	{
+		std::istringstream words(definition);
+		std::string type;
+		std::string path;
+		std::map<std::string, std::string> options;
+		words >> type;
+		for (std::string word; words >> word;)
+		{
+			std::size_t equals = word.find('=');
+			if (equals == std::string::npos)
+			{
+				if (!path.empty())
+				{
+					error = "unexpected '" + word + "'";
+					return 0;
+				}
+				path = word;
+			}
+			else
+			{
+				options[word.substr(0, equals)] = word.substr(equals + 1);
+			}
+		}
+
+		// takes an option out of options, so the ones left at the end are unknown
+		auto take = [&](const char* name, std::string& value)
+			{
+				auto option = options.find(name);
+				if (option == options.end())
+				{
+					return false;
+				}
+				value = option->second;
+				options.erase(option);
+				return true;
+			};
+		std::string value;
+		auto take_size = [&](const char* name, std::size_t& out)
+			{
+				if (take(name, value) && !parse_config_size(value, out))
+				{
+					error = std::string("invalid ") + name + " '" + value + "'";
+				}
+			};
+
+		LogPriority sink_priority = TracePriority;
+		LogPriority flush_priority = CriticalPriority;
+		bool flush_set = false;
+		if (take("priority", value) && !parse_config_priority(value, sink_priority))
+		{
+			error = "invalid priority '" + value + "'";
+		}
+		if (take("flush", value) && !(flush_set = parse_config_priority(value, flush_priority)))
+		{
+			error = "invalid flush priority '" + value + "'";
+		}
+		take("category", category);
+		BufferingPolicy buffering = DefaultBuffering;
+		if (take("buffering", value) && !parse_config_buffering(value, buffering))
+		{
+			error = "invalid buffering '" + value + "'";
+		}
+		std::size_t buffer_size = type == "async_console" ? 1 << 20 : BUFSIZ;
+		take_size("buffer", buffer_size);
+
+		// options of the sink types
+		std::size_t max_size = 0;
+		std::size_t archives = 5;
+		std::size_t interval = type == "direct" ? 100 : 0;
+		std::size_t segment = 64 << 20;
+		std::size_t chunk = 64 * 1024;
+		std::string compress;
+		std::string sync = "none";
+		std::string color = "auto";
+		std::string overflow = "drop_newest";
+		if (type == "async_console")
+		{
+			interval = 20;
+			take_size("interval", interval);
+			take("color", color);
+			take("overflow", overflow);
+			if (color != "auto" && color != "on" && color != "off")
+			{
+				error = "invalid color '" + color + "'";
+			}
+			if (overflow != "block" && overflow != "drop_newest" && overflow != "drop_oldest")
+			{
+				error = "invalid overflow '" + overflow + "'";
+			}
+		}
+		else if (type == "rotating")
+		{
+			take_size("max_size", max_size);
+			take_size("archives", archives);
+			take_size("interval", interval);
+			take("compress", compress);
+#if defined(YELLOG_WITH_ZLIB)
+			if (!compress.empty() && compress != "gzip")
+#else
+			if (!compress.empty())
+#endif
+			{
+				error = "unsupported compressor '" + compress + "'";
+			}
+		}
+		else if (type == "mapped")
+		{
+			take_size("segment", segment);
+		}
+		else if (type == "direct")
+		{
+			take("sync", sync);
+			take_size("interval", interval);
+			take_size("chunk", chunk);
+			if (sync != "none" && sync != "periodic" && sync != "error")
+			{
+				error = "invalid sync '" + sync + "'";
+			}
+		}
+
+		if (!options.empty())
+		{
+			error = "unknown option '" + options.begin()->first + "'";
+		}
+		bool console = type == "console" || type == "async_console";
+		if (console ? !path.empty() && path != "stdout" && path != "stderr" : path.empty())
+		{
+			error = console ? "console writes to stdout or stderr" : "missing path";
+		}
+		if (!error.empty())
+		{
+			return 0;
+		}
+
+		std::shared_ptr<Sink> sink;
+		bool open = true;
+		if (type == "console")
+		{
+			sink = std::make_shared<ConsoleSink>(path == "stderr" ? stderr : stdout, buffering, buffer_size);
+		}
+		else if (type == "file")
+		{
+			auto file = std::make_shared<FileSink>(path.c_str(), buffering, buffer_size);
+			open = file->IsOpen();
+			sink = file;
+		}
+		else if (type == "rotating")
+		{
+			auto rotating = std::make_shared<RotatingFileSink>(path.c_str(), max_size, archives, (std::int64_t)interval, buffering, buffer_size);
+#if defined(YELLOG_WITH_ZLIB)
+			if (compress == "gzip")
+			{
+				rotating->SetCompressor(RotatingFileSink::GzipCompress, ".gz");
+			}
+#endif
+			open = rotating->IsOpen();
+			sink = rotating;
+		}
+		else if (type == "binary")
+		{
+			auto binary = std::make_shared<BinaryFileSink>(path.c_str(), buffer_size);
+			open = binary->IsOpen();
+			sink = binary;
+		}
+#if defined(YELLOG_POSIX)
+		else if (type == "async_console")
+		{
+			sink = std::make_shared<AsyncConsoleSink>(path == "stderr" ? STDERR_FILENO : STDOUT_FILENO,
+				color == "on" ? AlwaysColor : color == "off" ? NoColor : AutoColor,
+				overflow == "block" ? BlockOnOverflow : overflow == "drop_oldest" ? DropOldestOnOverflow : DropNewestOnOverflow,
+				buffer_size, (int)interval);
+		}
+		else if (type == "mapped")
+		{
+			auto mapped = std::make_shared<MappedFileSink>(path.c_str(), segment);
+			open = mapped->IsOpen();
+			sink = mapped;
+		}
+		else if (type == "direct")
+		{
+			SyncPolicy sync_policy = sync == "periodic" ? PeriodicSync : sync == "error" ? SyncOnError : NoSync;
+			auto direct = std::make_shared<DirectFileSink>(path.c_str(), sync_policy, (int)interval, chunk);
+			open = direct->IsOpen();
+			sink = direct;
+		}
+#endif
+		else
+		{
+			error = "unknown sink type '" + type + "'";
+			return 0;
+		}
 
-public:
-	// Set desired priority for the logger (messages with lower priority will not be recorded)
-	// The default priority is Yellog::InfoPriority
-	static void SetPriority(LogPriority new_priority)
-	{
-		get_instance().priority = new_priority;
-	}
+		if (!open)
+		{
+			error = "can't open '" + path + "'";
+			return 0;
+		}
 
-	// Get the current logger priority (messages with lower priority will not be recorded)
-	// The default priority is Yellog::InfoPriority
-	static LogPriority GetPriority()
-	{
-		return get_instance().priority;
+		sink->SetPriority(sink_priority);
+		if (flush_set)
+		{
+			sink->SetFlushPriority(flush_priority);
+		}
+		return sink;
 	}
 
-	// Enable file output
-	// Logs will be written to /log.txt
-	// If the file doesn't exist, it will create it automatically
-	// File will be closed when program stops
-	// Returns true if a file was successfully opened, false otherwise
-	static bool EnableFileOutput()
+	// Called with config_file_mutex held, returns false and sets error (with the line number) if the file is invalid
+	bool parse_config(const char* config_path, ParsedConfig& config, std::string& error)
 	{
-		Yellog& logger_instance = get_instance();
-		logger_instance.filepath = "log.txt";
-		return logger_instance.enable_file_output();
-	}
+		std::ifstream config_file(config_path);
+		if (!config_file)
+		{
+			error = "can't open the file";
+			return false;
+		}
 
-	// Enable file output
-	// Logs will be written to /filepath, provided the filepath is valid
-	// If the file doesn't exist, it will create it automatically
-	// File will be closed when program stops
-	// Returns true if a file was successfully opened, false otherwise
-	static bool EnableFileOutput(const char* new_filepath)
-	{
-		Yellog& logger_instance = get_instance();
-		logger_instance.filepath = new_filepath;
-		return logger_instance.enable_file_output();
-	}
+		int line_number = 0;
+		for (std::string line; std::getline(config_file, line);)
+		{
+			line_number++;
+			auto trim = [](const std::string& text)
+				{
+					std::size_t begin = text.find_first_not_of(" \t\r");
+					std::size_t end = text.find_last_not_of(" \t\r");
+					return begin == std::string::npos ? std::string() : text.substr(begin, end - begin + 1);
+				};
+			line = trim(line);
+			if (line.empty() || line[0] == '#')
+			{
+				continue;
+			}
 
-	// Returns the current filepath for file logging
-	// if Yellog::EnableFileOutput was called without specifying a filepath, the filepath will be "log.txt"
-	// if file output was not enabled, the filepath will contain NULL
-	static const char* GetFilepath()
-	{
-		return get_instance().filepath;
-	}
+			std::size_t equals = line.find('=');
+			if (equals == std::string::npos)
+			{
+				error = "line " + std::to_string(line_number) + ": expected <key> = <value>";
+				return false;
+			}
+			std::string key = trim(line.substr(0, equals));
+			std::string value = trim(line.substr(equals + 1));
 
-	// Returns true is file output was enabled and file was successfully opened, false if it wasn't
-	static bool IsFileOutputEnabled()
-	{
-		return get_instance().file != 0;
-	}
+			bool valid = true;
+			bool flag = false;
+			std::string line_error;
+			if (key == "priority")
+			{
+				LogPriority new_priority = InfoPriority;
+				valid = parse_config_priority(value, new_priority);
+				config.priority = new_priority;
+			}
+			else if (key == "timestamp_format")
+			{
+				config.timestamp_format = value;
+			}
+			else if (key == "timestamp_precision")
+			{
+				valid = value == "ms" || value == "us" || value == "ns";
+				config.timestamp_precision = value == "ms" ? MillisecondPrecision : value == "us" ? MicrosecondPrecision : NanosecondPrecision;
+			}
+			else if (key == "console")
+			{
+				valid = parse_config_bool(value, flag);
+				config.console = flag;
+			}
+			else if (key == "file")
+			{
+				config.file = value == "off" ? std::string() : value;
+				bool reopen = false;
+				{
+					std::scoped_lock lock(config_mutex);
+					reopen = !filepath || *config.file != filepath || !file_sink;
+				}
+				if (!config.file->empty() && reopen)
+				{
+					config.file_sink = std::make_shared<FileSink>(config.file->c_str());
+					if (!config.file_sink->IsOpen())
+					{
+						line_error = "can't open '" + value + "'";
+					}
+				}
+			}
+			else if (key == "async")
+			{
+				valid = parse_config_bool(value, flag);
+				config.async = flag;
+			}
+			else if (key == "async.capacity")
+			{
+				std::size_t capacity = 0;
+				valid = parse_config_size(value, capacity) && capacity > 0;
+				config.async_capacity = capacity;
+			}
+			else if (key == "async.overflow")
+			{
+				valid = value == "block" || value == "drop_newest" || value == "drop_oldest";
+				config.async_overflow = value == "block" ? BlockOnOverflow : value == "drop_newest" ? DropNewestOnOverflow : DropOldestOnOverflow;
+			}
+			else if (key == "async.deferred")
+			{
+				valid = parse_config_bool(value, flag);
+				config.async_deferred = flag;
+			}
+			else if (key.compare(0, 9, "category.") == 0 && key.size() > 9)
+			{
+				std::string name = key.substr(9);
+				if (name.size() > 9 && name.compare(name.size() - 9, 9, ".additive") == 0)
+				{
+					valid = parse_config_bool(value, flag);
+					config.category_additive[name.substr(0, name.size() - 9)] = flag;
+				}
+				else
+				{
+					LogPriority category_priority = InfoPriority;
+					valid = parse_config_priority(value, category_priority);
+					config.category_priorities[name] = category_priority;
+				}
+			}
+			else if (key.compare(0, 5, "sink.") == 0 && key.size() > 5)
+			{
+				std::string name = key.substr(5);
+				ConfigSink& sink = config.sinks[name];
+				sink.definition = value;
+				auto current = config_sinks.find(name);
+				if (current != config_sinks.end() && current->second.definition == value)
+				{
+					sink = current->second;
+				}
+				else
+				{
+					sink.sink = open_config_sink(value, sink.category, line_error);
+				}
+			}
+			else
+			{
+				line_error = "unknown setting '" + key + "'";
+			}
 
-	// Set a log timestamp format
-	// Format follows <ctime> strftime format specification
-	// Default format is "%T  %d-%m-%Y" (e.g. 13:20:25  14-02-2021)
-	// 4 spaces are added automatically to the end of timestamp each time the message is logged
-	static void SetTimestampFormat(const char* new_timestamp_format)
-	{
-		get_instance().timestamp_format = new_timestamp_format;
-	}
+			if (!valid)
+			{
+				line_error = "invalid value '" + value + "' for " + key;
+			}
+			if (!line_error.empty())
+			{
+				error = "line " + std::to_string(line_number) + ": " + line_error;
+				return false;
+			}
+		}
 
-	// Get the current log timestamp format
-	// Format follows <ctime> strftime format specification
-	// Default format is "%T  %d-%m-%Y" (e.g. 13:20:25  14-02-2021)
-	static const char* GetTimestampFormat()
-	{
-		return get_instance().timestamp_format;
+		return true;
 	}
 
-	// Log a message (format + optional args, follow printf specification)
-	// with log priority level Yellog::TracePriority
-	template<typename... Args>
-	static void Trace(const char* message, Args... args)
+	// Strings handed to the logger without copying (timestamp format, file path) are kept until it is destroyed
+	// Called with config_file_mutex held
+	const char* keep_config_string(const std::string& text)
 	{
-		get_instance().log("[Trace]    ", TracePriority, message, args...);
+		if (config_strings.empty() || config_strings.back() != text)
+		{
+			config_strings.push_back(text);
+		}
+		return config_strings.back().c_str();
 	}
 
-	// Log a message (format + optional args, follow printf specification)
-	// with log priority level Yellog::DebugPriority
-	template<typename... Args>
-	static void Debug(const char* message, Args... args)
+	// Async output can't be turned off or resized while it runs, a file asking for it is rejected
+	bool check_async_config(const ParsedConfig& config, std::string& error)
 	{
-		get_instance().log("[Debug]    ", DebugPriority, message, args...);
-	}
+		std::scoped_lock lock(log_mutex);
+		if (!async_writer)
+		{
+			if (config.async.value_or(false) && batch_collector)
+			{
+				error = "async output can't be enabled together with batched output";
+			}
+			return error.empty();
+		}
 
-	// Log a message (format + optional args, follow printf specification)
-	// with log priority level Yellog::InfoPriority
-	template<typename... Args>
-	static void Info(const char* message, Args... args)
-	{
-		get_instance().log("[Info]     ", InfoPriority, message, args...);
+		const AsyncWriter& writer = *async_writer;
+		std::size_t queue_size = writer.queue.slot_count();
+		if (config.async && !*config.async)
+		{
+			error = "async output can't be turned off once enabled";
+		}
+		else if (config.async_capacity && (*config.async_capacity > queue_size || *config.async_capacity <= queue_size / 2))
+		{
+			error = "async.capacity can't be changed while async output runs";
+		}
+		else if (config.async_overflow && *config.async_overflow != writer.policy)
+		{
+			error = "async.overflow can't be changed while async output runs";
+		}
+		else if (config.async_deferred && *config.async_deferred != writer.deferred_formatting)
+		{
+			error = "async.deferred can't be changed while async output runs";
+		}
+		return error.empty();
 	}
 
-	// Log a message (format + optional args, follow printf specification)
-	// with log priority level Yellog::WarnPriority
-	template<typename... Args>
-	static void Warn(const char* message, Args... args)
+	bool load_config(const char* config_path)
 	{
-		get_instance().log("[Warn]     ", WarnPriority, message, args...);
-	}
+		std::scoped_lock config_file_lock(config_file_mutex);
 
-	// Log a message (format + optional args, follow printf specification)
-	// with log priority level Yellog::ErrorPriority
-	template<typename... Args>
-	static void Error(const char* message, Args... args)
-	{
-		get_instance().log("[Error]    ", ErrorPriority, message, args...);
+		ParsedConfig config;
+		std::string error;
+		if (!parse_config(config_path, config, error) || !check_async_config(config, error))
+		{
+			Error("Configuration %s not applied, %s", config_path, error.c_str());
+			return false;
+		}
+
+		// sinks, priorities and the timestamp change in one settings snapshot
+		change_settings([&] { apply_config(config); });
+
+		// async output is started once, before the first message if possible
+		if (config.async.value_or(false) && !async_enabled.load(std::memory_order_acquire)
+			&& !enable_async_output(config.async_capacity.value_or(8192), config.async_overflow.value_or(BlockOnOverflow), config.async_deferred.value_or(false)))
+		{
+			Warn("Configuration %s: async output can't be enabled together with batched output", config_path);
+		}
+
+		return true;
 	}
 
-	// Log a message (format + optional args, follow printf specification)
-	// with log priority level Yellog::CriticalPriority
-	template<typename... Args>
-	static void Critical(const char* message, Args... args)
+	// Called with config_file_mutex and config_mutex held, change_settings publishes the result
+	void apply_config(ParsedConfig& config)
 	{
-		get_instance().log("[Crit]     ", CriticalPriority, message, args...);
-	}
+		for (const auto& [name, current] : config_sinks)
+		{
+			auto kept = config.sinks.find(name);
+			if (kept == config.sinks.end() || kept->second.sink != current.sink)
+			{
+				std::vector<std::shared_ptr<Sink>>& owner = current.category.empty() ? sinks : get_category(current.category.c_str()).sinks;
+				owner.erase(std::remove(owner.begin(), owner.end(), current.sink), owner.end());
+			}
+		}
+		for (const auto& [name, sink] : config.sinks)
+		{
+			auto current = config_sinks.find(name);
+			if (current == config_sinks.end() || current->second.sink != sink.sink)
+			{
+				(sink.category.empty() ? sinks : get_category(sink.category.c_str()).sinks).push_back(sink.sink);
+			}
+		}
+		config_sinks = std::move(config.sinks);
 
-private:
-	Yellog() {}
+		if (config.console)
+		{
+			set_console_output(*config.console);
+		}
 
-	Yellog(const Yellog&) = delete;
-	Yellog& operator= (const Yellog&) = delete;
+		if (config.file)
+		{
+			if (config.file->empty())
+			{
+				free_file();
+			}
+			else if (config.file_sink)
+			{
+				free_file();
+				filepath = keep_config_string(*config.file);
+				use_file_sink(std::move(config.file_sink));
+			}
+		}
 
-	~Yellog()
-	{
-		free_file();
-	}
+		if (config.priority)
+		{
+			priority.store(*config.priority, std::memory_order_relaxed);
+		}
+		for (const std::string& name : config_categories)
+		{
+			Category& category = get_category(name.c_str());
+			if (!config.category_priorities.count(name))
+			{
+				set_override(category.priority, -1);
+			}
+			if (!config.category_additive.count(name))
+			{
+				category.additive.store(true, std::memory_order_relaxed);
+			}
+		}
+		config_categories.clear();
+		for (const auto& [name, category_priority] : config.category_priorities)
+		{
+			set_override(get_category(name.c_str()).priority, category_priority);
+			config_categories.insert(name);
+		}
+		for (const auto& [name, additive] : config.category_additive)
+		{
+			get_category(name.c_str()).additive.store(additive, std::memory_order_relaxed);
+			config_categories.insert(name);
+		}
 
-	static Yellog& get_instance()
-	{
-		static Yellog instance;
-		
-		return instance;
+		if (config.timestamp_format)
+		{
+			timestamp_format.store(keep_config_string(*config.timestamp_format), std::memory_order_relaxed);
+		}
+		if (config.timestamp_precision)
+		{
+			timestamp_digits.store(*config.timestamp_precision, std::memory_order_relaxed);
+		}
 	}
 
-	template<typename... Args>
-	void log(const char* message_priority_str, LogPriority message_priority, const char* message, Args... args)
+	// Runs on config_watcher, reloads the file when it is written or replaced
+	void watch_config(const std::string& config_path)
 	{
-		if (priority <= message_priority)
+#if defined(__linux__)
+		// editors often write a new file and rename it over the old one, so the directory is watched
+		std::size_t slash = config_path.rfind('/');
+		std::string directory = slash == std::string::npos ? "." : config_path.substr(0, slash + 1);
+		std::string name = slash == std::string::npos ? config_path : config_path.substr(slash + 1);
+
+		int watch_descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (watch_descriptor >= 0 && inotify_add_watch(watch_descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0)
 		{
-			std::time_t current_time = std::time(0);
-			std::tm* timestamp = std::localtime(&current_time);
+			alignas(inotify_event) char events[4096];
+			while (!stop_config_watcher.load(std::memory_order_relaxed))
+			{
+				pollfd watched = { watch_descriptor, POLLIN, 0 };
+				if (::poll(&watched, 1, 200) <= 0)
+				{
+					continue;
+				}
 
-			std::scoped_lock lock(log_mutex);
-			std::strftime(buffer, 80, timestamp_format, timestamp);
-			std::printf("%s    ", buffer);
-			std::printf(message_priority_str);
-			std::printf(message, args...);
-			std::printf("\n");
+				bool changed = false;
+				ssize_t length;
+				while ((length = ::read(watch_descriptor, events, sizeof(events))) > 0)
+				{
+					for (char* event = events; event < events + length;)
+					{
+						inotify_event* watch_event = (inotify_event*)event;
+						if (watch_event->len && name == watch_event->name)
+						{
+							changed = true;
+						}
+						event += sizeof(inotify_event) + watch_event->len;
+					}
+				}
+				if (changed)
+				{
+					load_config(config_path.c_str());
+				}
+			}
+			::close(watch_descriptor);
+			return;
+		}
+		if (watch_descriptor >= 0)
+		{
+			::close(watch_descriptor);
+		}
+#endif
+		// polling, the modification time is checked every second
+		std::error_code error;
+		std::filesystem::file_time_type last_time = std::filesystem::last_write_time(config_path, error);
+		int waited_ms = 0;
+		while (!stop_config_watcher.load(std::memory_order_relaxed))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			waited_ms += 200;
+			if (waited_ms < 1000)
+			{
+				continue;
+			}
+			waited_ms = 0;
 
-			if (file)
+			std::filesystem::file_time_type time = std::filesystem::last_write_time(config_path, error);
+			if (!error && time != last_time)
 			{
-				std::fprintf(file, "%s    ", buffer);
-				std::fprintf(file, message_priority_str);
-				std::fprintf(file, message, args...);
-				std::fprintf(file, "\n");
+				last_time = time;
+				load_config(config_path.c_str());
 			}
 		}
 	}
 
-	bool enable_file_output()
+	bool enable_file_output(const char* new_filepath)
 	{
-		free_file();
+		std::shared_ptr<FileSink> new_file_sink = std::make_shared<FileSink>(new_filepath);
+		bool open = new_file_sink->IsOpen();
 
-		file = std::fopen(filepath, "a");
+		change_settings([&]
+			{
+				free_file();
+				filepath = new_filepath;
+				if (open)
+				{
+					use_file_sink(std::move(new_file_sink));
+				}
+			});
+		return open;
+	}
+
+	// Called with config_mutex held, after free_file
+	void use_file_sink(std::shared_ptr<FileSink> new_file_sink)
+	{
+		file_sink = std::move(new_file_sink);
+		sinks.push_back(file_sink);
+		dump_descriptor.store(file_sink->GetDescriptor(), std::memory_order_relaxed);
+	}
 
-		if (file == 0)
+	// Called with config_mutex held
+	void free_file()
+	{
+		if (file_sink)
 		{
-			return false;
+			dump_descriptor.store(-1, std::memory_order_relaxed);
+			remove_sink(file_sink);
+			file_sink.reset();
 		}
-
-		return true;
 	}
 
-	void free_file()
+	// Called with config_mutex held
+	void set_console_output(bool enabled)
 	{
-		if (file)
+		if (enabled && !console_sink)
+		{
+			console_sink = std::make_shared<ConsoleSink>();
+			sinks.push_back(console_sink);
+		}
+		else if (!enabled && console_sink)
 		{
-			std::fclose(file);
-			file = 0;
+			remove_sink(console_sink);
+			console_sink.reset();
 		}
 	}
-};
\ No newline at end of file
+};
+
+
+// Logging macros, calls below YELLOG_ACTIVE_LEVEL expand to nothing and their arguments are not evaluated
+#if YELLOG_ACTIVE_LEVEL <= 0
+#define YELLOG_TRACE(...) (Yellog::Trace(__VA_ARGS__))
+#else
+#define YELLOG_TRACE(...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 1
+#define YELLOG_DEBUG(...) (Yellog::Debug(__VA_ARGS__))
+#else
+#define YELLOG_DEBUG(...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 2
+#define YELLOG_INFO(...) (Yellog::Info(__VA_ARGS__))
+#else
+#define YELLOG_INFO(...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 3
+#define YELLOG_WARN(...) (Yellog::Warn(__VA_ARGS__))
+#else
+#define YELLOG_WARN(...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 4
+#define YELLOG_ERROR(...) (Yellog::Error(__VA_ARGS__))
+#else
+#define YELLOG_ERROR(...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 5
+#define YELLOG_CRITICAL(...) (Yellog::Critical(__VA_ARGS__))
+#else
+#define YELLOG_CRITICAL(...) ((void)0)
+#endif
+
+
+// Makes a {} format string that is checked at compile time
+//	Yellog::Info(YELLOG_FMT("{} logged in from {}"), name, address);
+#define YELLOG_FMT(format_string) ([] { struct YellogFormat : Yellog::FormatString { static constexpr const char* value() { return format_string; } }; return YellogFormat{}; }())
@@ -3,25 +3,497 @@
 #include <stdio.h>
 #include <mutex>
 #include <ctime>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <charconv>
 
+// Lowest priority compiled into the program, LOG_* calls with lower priority expand to nothing
+// 0 - Trace, 1 - Debug, 2 - Info, 3 - Warn, 4 - Error, 5 - Critical, 6 - nothing is logged
+#ifndef YELLOG_ACTIVE_LEVEL
+#define YELLOG_ACTIVE_LEVEL 0
+#endif
 
 enum LogPriority
 {
 	TracePriority, DebugPriority, InfoPriority, WarnPriority, ErrorPriority, CriticalPriority
 };
 
+// Token bucket of a single call site, lets through rate messages a second on average and bursts of up to burst messages
+// Used by the LOG_*_RATE_LIMITED macros, which keep one in a static at each call site
+class LogRateLimiter
+{
+private:
+	std::int64_t interval;	// nanoseconds per token
+	std::int64_t burst_time;	// nanoseconds the bucket can run ahead
+	// time at which the bucket is full again, a single atomic so Allow() needs no lock
+	std::atomic<std::int64_t> full_time{ 0 };
+	std::atomic<unsigned long> dropped{ 0 };
+
+	static std::atomic<unsigned long long>& total_dropped()
+	{
+		static std::atomic<unsigned long long> count{ 0 };
+		return count;
+	}
+
+	friend class Logger;
+
+public:
+	LogRateLimiter(double rate, double burst)
+		: interval((std::int64_t)(1e9 / rate)), burst_time((std::int64_t)(1e9 / rate * burst))
+	{}
+
+	// Takes a token, returns false (and counts the message as dropped) if the bucket is empty
+	bool Allow()
+	{
+		std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		std::int64_t full = full_time.load(std::memory_order_relaxed);
+
+		for (;;)
+		{
+			std::int64_t next = (full > now ? full : now) + interval;
+			if (next - now > burst_time)
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				total_dropped().fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			if (full_time.compare_exchange_weak(full, next, std::memory_order_relaxed))
+			{
+				return true;
+			}
+		}
+	}
+
+	// Returns the number of messages dropped since the last call
+	unsigned long TakeDropped()
+	{
+		return dropped.exchange(0, std::memory_order_relaxed);
+	}
+};
+
+// Per-thread random numbers for LOG_*_SAMPLED, no shared state between threads
+class LogSampler
+{
+public:
+	// Returns true with the given probability (0 to 1)
+	static bool Sample(double probability)
+	{
+		// xorshift64*, seeded from the address of the thread's state so every thread gets its own sequence
+		static thread_local std::uint64_t state = (std::uint64_t)(std::uintptr_t)&state * 0x9E3779B97F4A7C15ull | 1;
+
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		std::uint64_t random = (state * 0x2545F4914F6CDD1Dull) >> 11;	// 53 random bits
+
+		return (double)random < probability * 9007199254740992.0;	// 2^53
+	}
+};
+
+// Returns the file name without directories, used on __FILE__ at compile time
+constexpr const char* log_basename(const char* path)
+{
+	const char* name = path;
+	for (const char* c = path; *c; c++)
+	{
+		if (*c == '/' || *c == '\\')
+		{
+			name = c + 1;
+		}
+	}
+	return name;
+}
+
+// Everything known about a call site at compile time, the LOG_* macros create one in a static at each call site
+// so the location text is formatted once, the format string is passed by every call as it can change between calls
+// Sites register themselves with the logger when first reached, so they can be turned on and off by Logger::SetSiteEnabled
+class LogSite
+{
+public:
+	const char* const source_file;	// file name without directories
+	const char* const function;
+	const int line;
+	const LogPriority priority;
+
+	enum State
+	{
+		FollowPriority, Enabled, Disabled
+	};
+
+	// Defined after Logger, registers the site
+	LogSite(const char* file, const char* function_name, int line_number, LogPriority site_priority);
+	~LogSite();
+
+	LogSite(const LogSite&) = delete;
+	LogSite& operator= (const LogSite&) = delete;
+
+	// Enabled sites log whatever the logger priority is, disabled sites never log
+	State GetState() const
+	{
+		return (State)state.load(std::memory_order_relaxed);
+	}
+
+	// " on line <line> in <file>", written after the message
+	const char* GetLocation() const
+	{
+		return location;
+	}
+
+	const char* GetPriorityString() const
+	{
+		static const char* const priority_strings[] = { "[Trace]\t", "[Debug]\t", "[Info]\t", "[Warn]\t", "[Error]\t", "[Critical]\t" };
+		return priority_strings[priority];
+	}
+
+private:
+	char location[96];
+	std::atomic<int> state{ FollowPriority };
+
+	friend class Logger;
+};
+
+// A rule of Logger::SetSiteEnabled, pattern is "<file>", "<file>:<line>" or "<function>()", file and function can contain * and ?
+class LogSiteRule
+{
+private:
+	std::string file = "*";
+	std::string function = "*";
+	int line = -1;	// -1 matches any line
+	bool valid = true;
+
+	static bool glob_match(const char* pattern, const char* text)
+	{
+		const char* star = 0;
+		const char* star_text = 0;
+		while (*text)
+		{
+			if (*pattern == '*')
+			{
+				star = pattern++;
+				star_text = text;
+			}
+			else if (*pattern == '?' || *pattern == *text)
+			{
+				pattern++;
+				text++;
+			}
+			else if (star)
+			{
+				pattern = star + 1;
+				text = ++star_text;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		while (*pattern == '*')
+		{
+			pattern++;
+		}
+		return *pattern == 0;
+	}
+
+public:
+	std::string pattern;
+	bool enabled;
+
+	LogSiteRule(const std::string& site_pattern, bool enable) : pattern(site_pattern), enabled(enable)
+	{
+		std::size_t colon = pattern.rfind(':');
+		if (pattern.size() > 2 && pattern.compare(pattern.size() - 2, 2, "()") == 0)
+		{
+			function = pattern.substr(0, pattern.size() - 2);
+		}
+		else if (colon != std::string::npos)
+		{
+			// the line has to be a number that fits in an int, anything else makes the rule invalid
+			file = pattern.substr(0, colon);
+			const char* end = pattern.data() + pattern.size();
+			auto [last, error] = std::from_chars(pattern.data() + colon + 1, end, line);
+			valid = error == std::errc() && last == end && line >= 0;
+		}
+		else
+		{
+			file = pattern;
+		}
+	}
+
+	// False if the pattern has a line that isn't a number, such a rule is ignored
+	bool IsValid() const
+	{
+		return valid;
+	}
+
+	bool Matches(const LogSite& site) const
+	{
+		return (line == -1 || line == site.line)
+			&& glob_match(file.c_str(), site.source_file)
+			&& glob_match(function.c_str(), site.function);
+	}
+};
+
+// A timed scope recorded by YELLOG_SCOPE, times are steady_clock nanoseconds
+struct LogSpan
+{
+	const LogSite* site;
+	const char* name;	// a string literal
+	std::int64_t start;
+	std::int64_t end;
+};
+
+// Spans of one thread, appended without a lock by that thread and read by Logger::WriteChromeTrace
+// Spans are stored in blocks that never move, the count of a block is published after the span is written
+class LogSpanBuffer
+{
+private:
+	static constexpr std::size_t block_size = 4096;
+
+	struct Block
+	{
+		LogSpan spans[block_size];
+		std::atomic<std::size_t> count{ 0 };
+		std::atomic<Block*> next{ 0 };
+	};
+
+	std::atomic<Block*> head{ 0 };
+	Block* tail = 0;	// only used by the owning thread
+	std::size_t size = 0;	// only used by the owning thread
+
+	friend class Logger;
+
+public:
+	explicit LogSpanBuffer(unsigned thread_number) : thread_id(thread_number) {}
+
+	LogSpanBuffer(const LogSpanBuffer&) = delete;
+	LogSpanBuffer& operator= (const LogSpanBuffer&) = delete;
+
+	~LogSpanBuffer()
+	{
+		Block* block = head.load(std::memory_order_relaxed);
+		while (block)
+		{
+			Block* next = block->next.load(std::memory_order_relaxed);
+			delete block;
+			block = next;
+		}
+	}
+
+	const unsigned thread_id;
+
+	// Called by the owning thread only
+	void Push(const LogSpan& span)
+	{
+		if (!tail || tail->count.load(std::memory_order_relaxed) == block_size)
+		{
+			Block* block = new Block;
+			if (tail)
+			{
+				tail->next.store(block, std::memory_order_release);
+			}
+			else
+			{
+				head.store(block, std::memory_order_release);
+			}
+			tail = block;
+		}
+
+		std::size_t index = tail->count.load(std::memory_order_relaxed);
+		tail->spans[index] = span;
+		tail->count.store(index + 1, std::memory_order_release);
+		size++;
+	}
+
+	// Calls function for every span pushed so far, can run while the owning thread pushes more
+	template<typename Function>
+	void ForEach(Function&& function) const
+	{
+		for (Block* block = head.load(std::memory_order_acquire); block; block = block->next.load(std::memory_order_acquire))
+		{
+			std::size_t count = block->count.load(std::memory_order_acquire);
+			for (std::size_t i = 0; i < count; i++)
+			{
+				function(block->spans[i]);
+			}
+		}
+	}
+};
+
 class Logger
 {
 private:
-	LogPriority priority = InfoPriority;
+	std::atomic<LogPriority> priority{ InfoPriority };	// read without log_mutex by every logging call
 	std::mutex log_mutex;
 	const char* filepath = 0;
 	FILE* file = 0;
 
+	// duplicate suppression, guarded by log_mutex
+	bool suppress_duplicates = false;
+	std::string last_message;
+	LogPriority last_priority = InfoPriority;
+	const char* last_priority_str = 0;
+	unsigned long repeated = 0;
+	std::atomic<unsigned long long> suppressed{ 0 };
+
+	// span recording
+	std::atomic<bool> record_spans{ false };
+	std::atomic<std::size_t> max_spans{ 0 };	// per thread
+	std::atomic<unsigned long long> dropped_spans{ 0 };
+	std::mutex spans_mutex;
+	std::vector<std::unique_ptr<LogSpanBuffer>> span_buffers;	// guarded by spans_mutex, one for every thread that recorded a span
+
+	// call site registry, guarded by sites_mutex
+	std::mutex sites_mutex;
+	std::vector<LogSite*> sites;
+	std::vector<LogSiteRule> site_rules;	// in the order they were set, later rules win
+
+	// control file watcher
+	std::thread control_watcher;
+	std::mutex watcher_mutex;
+	std::condition_variable watcher_wake;
+	bool stop_watcher = false;	// guarded by watcher_mutex
+
+	friend class LogScope;
+	friend class LogSite;
+
 public:
 	static void SetPriority(LogPriority new_priority)
 	{
-		get_instance().priority = new_priority;
+		get_instance().priority.store(new_priority, std::memory_order_relaxed);
+	}
+
+	// When enabled, a message identical to the previous one (same priority, text, line and file) is not written,
+	// "last message repeated N times" is written before the next different message instead
+	// Messages longer than 1023 characters (with the location) are always written
+	static void SetDuplicateSuppression(bool enabled)
+	{
+		Logger& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.log_mutex);
+		logger_instance.write_repeated();
+		logger_instance.suppress_duplicates = enabled;
+		logger_instance.last_message.clear();
+	}
+
+	// Number of messages not written because they repeated the previous one
+	static unsigned long long GetSuppressedCount()
+	{
+		return get_instance().suppressed.load(std::memory_order_relaxed);
+	}
+
+	// Number of messages dropped by the rate limits of all LOG_*_RATE_LIMITED call sites
+	static unsigned long long GetRateLimitedCount()
+	{
+		return LogRateLimiter::total_dropped().load(std::memory_order_relaxed);
+	}
+
+	// Start recording YELLOG_SCOPE spans, each thread keeps at most max_spans_per_thread of them, later ones are dropped and counted
+	// Recording a span takes no lock, only the first span of a thread registers its buffer
+	static void EnableSpans(std::size_t max_spans_per_thread = 1 << 20)
+	{
+		Logger& logger_instance = get_instance();
+		logger_instance.max_spans.store(max_spans_per_thread, std::memory_order_relaxed);
+		logger_instance.record_spans.store(true, std::memory_order_relaxed);
+	}
+
+	// Stop recording spans, the spans recorded so far are kept
+	static void DisableSpans()
+	{
+		get_instance().record_spans.store(false, std::memory_order_relaxed);
+	}
+
+	// Number of spans not recorded because their thread reached the limit set with EnableSpans
+	static unsigned long long GetDroppedSpanCount()
+	{
+		return get_instance().dropped_spans.load(std::memory_order_relaxed);
+	}
+
+	// Write the recorded spans to filepath as Chrome trace-event JSON, open it in chrome://tracing or Perfetto
+	// Can be called while spans are recorded, returns false if the file can't be opened
+	static bool WriteChromeTrace(const char* filepath)
+	{
+		FILE* trace_file = std::fopen(filepath, "w");
+		if (trace_file == 0)
+		{
+			return false;
+		}
+
+		Logger& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.spans_mutex);
+
+		fprintf(trace_file, "{\"traceEvents\":[");
+		bool first = true;
+		for (const std::unique_ptr<LogSpanBuffer>& buffer : logger_instance.span_buffers)
+		{
+			buffer->ForEach([&](const LogSpan& span)
+				{
+					fprintf(trace_file, first ? "\n" : ",\n");
+					first = false;
+
+					fprintf(trace_file, "{\"name\":");
+					write_json_string(trace_file, span.name);
+					fprintf(trace_file, ",\"cat\":\"scope\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"file\":",
+						span.start / 1000.0, (span.end - span.start) / 1000.0, buffer->thread_id);
+					write_json_string(trace_file, span.site->source_file);
+					fprintf(trace_file, ",\"line\":%d,\"function\":", span.site->line);
+					write_json_string(trace_file, span.site->function);
+					fprintf(trace_file, "}}");
+				});
+		}
+		fprintf(trace_file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+		return std::fclose(trace_file) == 0;
+	}
+
+	// Turn call sites on or off at runtime, an enabled site logs whatever the logger priority is, a disabled one never logs
+	// pattern is "<file>" (all sites of a file, without directories), "<file>:<line>" or "<function>()", * and ? are wildcards
+	// The rule also applies to sites reached for the first time later, returns the number of sites it changed so far
+	// A pattern with an invalid line (e.g. "file.cpp:abc") is ignored and changes nothing
+	// A LOG_* call checks its site with a single relaxed load
+	static std::size_t SetSiteEnabled(const char* pattern, bool enabled)
+	{
+		LogSiteRule rule(pattern, enabled);
+		if (!rule.IsValid())
+		{
+			return 0;
+		}
+
+		Logger& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.sites_mutex);
+		return logger_instance.add_site_rule(rule);
+	}
+
+	// Remove every SetSiteEnabled rule, all sites follow the logger priority again
+	static void ResetSites()
+	{
+		Logger& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.sites_mutex);
+		logger_instance.reset_sites();
+	}
+
+	// Read site rules from filepath now and whenever it changes, the file is checked every interval_ms milliseconds
+	// Every line is "+<pattern>" to enable or "-<pattern>" to disable sites, lines starting with # are comments
+	// Reloading removes all rules and applies the file again, returns false if a file is already watched
+	// Rules with an invalid line are skipped
+	static bool WatchSiteControlFile(const char* filepath, int interval_ms = 1000)
+	{
+		Logger& logger_instance = get_instance();
+		std::scoped_lock lock(logger_instance.watcher_mutex);
+		if (logger_instance.control_watcher.joinable())
+		{
+			return false;
+		}
+
+		logger_instance.control_watcher = std::thread(&Logger::watch_control_file, &logger_instance, std::string(filepath), interval_ms);
+		return true;
 	}
 
 	static void EnableFileOutput()
@@ -112,6 +584,19 @@ public:
 		get_instance().log(line, source_file, "[Critical]\t", CriticalPriority, message, args...);
 	}
 
+	// Log a message with the priority of its call site, used by the LOG_* macros
+	template<typename... Args>
+	static void Log(const LogSite& site, const char* message, Args... args)
+	{
+		get_instance().log(site, message, args...);
+	}
+
+	// Returns true if a message of the call site would be written, LOG_*_RATE_LIMITED spends tokens only on those
+	static bool IsEnabled(const LogSite& site)
+	{
+		return get_instance().is_wanted(site);
+	}
+
 private:
 	Logger() {}
 
@@ -120,6 +605,17 @@ private:
 
 	~Logger()
 	{
+		{
+			std::scoped_lock lock(watcher_mutex);
+			stop_watcher = true;
+		}
+		watcher_wake.notify_all();
+		if (control_watcher.joinable())
+		{
+			control_watcher.join();
+		}
+
+		write_repeated();
 		free_file();
 	}
 
@@ -132,14 +628,22 @@ private:
 	template<typename... Args>
 	void log(const char* message_priority_str, LogPriority message_priority, const char* message, Args... args)
 	{
-		if (priority <= message_priority)
+		if (priority.load(std::memory_order_relaxed) <= message_priority)
 		{
-			std::time_t current_time = std::time(0);
-			std::tm* timestamp = std::localtime(&current_time);
+			std::scoped_lock lock(log_mutex);
+			if (suppress_duplicates)
+			{
+				char text[1024];
+				int length = snprintf(text, sizeof(text), message, args...);
+				if (is_repeated(message_priority, message_priority_str, text, length >= 0 && (size_t)length < sizeof(text)))
+				{
+					return;
+				}
+			}
+
 			char buffer[80];
-			strftime(buffer, 80, "%c", timestamp);
+			format_timestamp(buffer);
 
-			std::scoped_lock lock(log_mutex);
 			printf("%s\t", buffer);
 			printf(message_priority_str);
 			printf(message, args...);
@@ -158,14 +662,28 @@ private:
 	template<typename... Args>
 	void log(int line_number, const char* source_file, const char* message_priority_str, LogPriority message_priority, const char* message, Args... args)
 	{
-		if (priority <= message_priority)
+		if (priority.load(std::memory_order_relaxed) <= message_priority)
 		{
-			std::time_t current_time = std::time(0);
-			std::tm* timestamp = std::localtime(&current_time);
+			std::scoped_lock lock(log_mutex);
+			if (suppress_duplicates)
+			{
+				char text[1024];
+				int length = snprintf(text, sizeof(text), message, args...);
+				bool complete = length >= 0 && (size_t)length < sizeof(text);
+				if (complete)
+				{
+					int location_length = snprintf(text + length, sizeof(text) - length, " on line %d in %s", line_number, source_file);
+					complete = location_length >= 0 && (size_t)(length + location_length) < sizeof(text);
+				}
+				if (is_repeated(message_priority, message_priority_str, text, complete))
+				{
+					return;
+				}
+			}
+
 			char buffer[80];
-			strftime(buffer, 80, "%c", timestamp);
+			format_timestamp(buffer);
 
-			std::scoped_lock lock(log_mutex);
 			printf("%s\t", buffer);
 			printf(message_priority_str);
 			printf(message, args...);
@@ -183,6 +701,281 @@ private:
 		}
 	}
 
+	static std::int64_t span_time()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// A scope is timed if spans are recorded or its end would be logged, unless its site is disabled
+	bool wants_span(const LogSite& site) const
+	{
+		return site.GetState() != LogSite::Disabled && (record_spans.load(std::memory_order_relaxed) || is_wanted(site));
+	}
+
+	// Records a span in the buffer of the calling thread and logs it with trace priority
+	void end_span(const LogSite& site, const char* name, std::int64_t start)
+	{
+		std::int64_t end = span_time();
+
+		if (record_spans.load(std::memory_order_relaxed))
+		{
+			LogSpanBuffer& buffer = thread_span_buffer();
+			if (buffer.size < max_spans.load(std::memory_order_relaxed))
+			{
+				buffer.Push({ &site, name, start, end });
+			}
+			else
+			{
+				dropped_spans.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		log(site, "%s took %.3f us", name, (end - start) / 1000.0);
+	}
+
+	// The buffer is owned by the logger, so spans of threads that exited can still be written
+	LogSpanBuffer& thread_span_buffer()
+	{
+		static thread_local LogSpanBuffer* buffer = 0;
+		if (!buffer)
+		{
+			std::scoped_lock lock(spans_mutex);
+			span_buffers.push_back(std::make_unique<LogSpanBuffer>((unsigned)span_buffers.size() + 1));
+			buffer = span_buffers.back().get();
+		}
+		return *buffer;
+	}
+
+	static void write_json_string(FILE* out, const char* text)
+	{
+		fputc('"', out);
+		for (; *text; text++)
+		{
+			unsigned char c = (unsigned char)*text;
+			if (c == '"' || c == '\\')
+			{
+				fputc('\\', out);
+				fputc(c, out);
+			}
+			else if (c < 0x20)
+			{
+				fprintf(out, "\\u%04x", c);
+			}
+			else
+			{
+				fputc(c, out);
+			}
+		}
+		fputc('"', out);
+	}
+
+	bool is_wanted(const LogSite& site) const
+	{
+		LogSite::State state = site.GetState();
+		return state == LogSite::Enabled || (state == LogSite::FollowPriority && priority.load(std::memory_order_relaxed) <= site.priority);
+	}
+
+	template<typename... Args>
+	void log(const LogSite& site, const char* message, Args... args)
+	{
+		if (is_wanted(site))
+		{
+			std::scoped_lock lock(log_mutex);
+			if (suppress_duplicates)
+			{
+				char text[1024];
+				int length = snprintf(text, sizeof(text), message, args...);
+				bool complete = length >= 0 && (size_t)length < sizeof(text);
+				if (complete)
+				{
+					int location_length = snprintf(text + length, sizeof(text) - length, "%s", site.GetLocation());
+					complete = location_length >= 0 && (size_t)(length + location_length) < sizeof(text);
+				}
+				if (is_repeated(site.priority, site.GetPriorityString(), text, complete))
+				{
+					return;
+				}
+			}
+
+			char buffer[80];
+			format_timestamp(buffer);
+
+			printf("%s\t", buffer);
+			printf(site.GetPriorityString());
+			printf(message, args...);
+			printf("%s\n", site.GetLocation());
+
+			if (file)
+			{
+				fprintf(file, "%s\t", buffer);
+				fprintf(file, site.GetPriorityString());
+				fprintf(file, message, args...);
+				fprintf(file, "%s\n", site.GetLocation());
+			}
+		}
+	}
+
+	// Called with sites_mutex held
+	std::size_t add_site_rule(const LogSiteRule& rule)
+	{
+		std::size_t changed = 0;
+		for (LogSite* site : sites)
+		{
+			if (rule.Matches(*site))
+			{
+				site->state.store(rule.enabled ? LogSite::Enabled : LogSite::Disabled, std::memory_order_relaxed);
+				changed++;
+			}
+		}
+		// a rule for the same pattern replaces the earlier one
+		site_rules.erase(std::remove_if(site_rules.begin(), site_rules.end(), [&](const LogSiteRule& old) { return old.pattern == rule.pattern; }), site_rules.end());
+		site_rules.push_back(rule);
+		return changed;
+	}
+
+	// Called with sites_mutex held
+	void reset_sites()
+	{
+		site_rules.clear();
+		for (LogSite* site : sites)
+		{
+			site->state.store(LogSite::FollowPriority, std::memory_order_relaxed);
+		}
+	}
+
+	void register_site(LogSite& site)
+	{
+		std::scoped_lock lock(sites_mutex);
+		for (const LogSiteRule& rule : site_rules)
+		{
+			if (rule.Matches(site))
+			{
+				site.state.store(rule.enabled ? LogSite::Enabled : LogSite::Disabled, std::memory_order_relaxed);
+			}
+		}
+		sites.push_back(&site);
+	}
+
+	void unregister_site(LogSite& site)
+	{
+		std::scoped_lock lock(sites_mutex);
+		sites.erase(std::remove(sites.begin(), sites.end(), &site), sites.end());
+	}
+
+	void load_control_file(const std::string& filepath)
+	{
+		std::ifstream control_file(filepath);
+		std::vector<LogSiteRule> rules;
+		std::string line;
+		while (std::getline(control_file, line))
+		{
+			std::size_t begin = line.find_first_not_of(" \t");
+			std::size_t end = line.find_last_not_of(" \t\r");
+			if (begin == std::string::npos || (line[begin] != '+' && line[begin] != '-') || end == begin)
+			{
+				continue;
+			}
+			LogSiteRule rule(line.substr(begin + 1, end - begin), line[begin] == '+');
+			if (rule.IsValid())
+			{
+				rules.push_back(rule);
+			}
+		}
+
+		std::scoped_lock lock(sites_mutex);
+		reset_sites();
+		for (const LogSiteRule& rule : rules)
+		{
+			add_site_rule(rule);
+		}
+	}
+
+	// Runs on control_watcher, reloads the file when its modification time or size changes
+	void watch_control_file(std::string filepath, int interval_ms)
+	{
+		std::filesystem::file_time_type last_time{};
+		std::uintmax_t last_size = 0;
+		bool loaded = false;
+
+		std::unique_lock lock(watcher_mutex);
+		while (!stop_watcher)
+		{
+			std::error_code error;
+			std::filesystem::file_time_type time = std::filesystem::last_write_time(filepath, error);
+			std::uintmax_t size = error ? 0 : std::filesystem::file_size(filepath, error);
+			if (!error && (!loaded || time != last_time || size != last_size))
+			{
+				last_time = time;
+				last_size = size;
+				loaded = true;
+				lock.unlock();
+				load_control_file(filepath);
+				lock.lock();
+			}
+
+			watcher_wake.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return stop_watcher; });
+		}
+	}
+
+	static void format_timestamp(char (&buffer)[80])
+	{
+		std::time_t current_time = std::time(0);
+		std::tm* timestamp = std::localtime(&current_time);
+		strftime(buffer, 80, "%c", timestamp);
+	}
+
+	// Called with log_mutex held, returns true if the message should not be written
+	// A different message first writes the repeat count of the previous one
+	// A message that didn't fit in text (complete is false) is never suppressed, as only its beginning could be compared
+	bool is_repeated(LogPriority message_priority, const char* message_priority_str, const char* text, bool complete)
+	{
+		if (complete && message_priority == last_priority && last_priority_str && last_message == text)
+		{
+			repeated++;
+			suppressed.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		write_repeated();
+		if (complete)
+		{
+			last_message = text;
+			last_priority = message_priority;
+			last_priority_str = message_priority_str;
+		}
+		else
+		{
+			last_message.clear();
+			last_priority_str = 0;
+		}
+		return false;
+	}
+
+	// Called with log_mutex held
+	void write_repeated()
+	{
+		if (repeated == 0)
+		{
+			return;
+		}
+
+		char buffer[80];
+		format_timestamp(buffer);
+
+		printf("%s\t", buffer);
+		printf(last_priority_str);
+		printf("last message repeated %lu times\n", repeated);
+
+		if (file)
+		{
+			fprintf(file, "%s\t", buffer);
+			fprintf(file, last_priority_str);
+			fprintf(file, "last message repeated %lu times\n", repeated);
+		}
+
+		repeated = 0;
+	}
+
 	bool enable_file_output()
 	{
 		free_file();
@@ -207,10 +1000,207 @@ private:
 	}
 };
 
+inline LogSite::LogSite(const char* file, const char* function_name, int line_number, LogPriority site_priority)
+	: source_file(file), function(function_name), line(line_number), priority(site_priority)
+{
+	snprintf(location, sizeof(location), " on line %d in %s", line, source_file);
+	Logger::get_instance().register_site(*this);
+}
+
+inline LogSite::~LogSite()
+{
+	Logger::get_instance().unregister_site(*this);
+}
+
+// Times the enclosing scope, see YELLOG_SCOPE
+class LogScope
+{
+private:
+	const LogSite& site;
+	const char* name;
+	std::int64_t start;	// -1 if the scope isn't timed
+
+public:
+	LogScope(const LogSite& scope_site, const char* scope_name)
+		: site(scope_site), name(scope_name), start(Logger::get_instance().wants_span(scope_site) ? Logger::span_time() : -1)
+	{}
+
+	LogScope(const LogScope&) = delete;
+	LogScope& operator= (const LogScope&) = delete;
+
+	~LogScope()
+	{
+		if (start != -1)
+		{
+			Logger::get_instance().end_span(site, name, start);
+		}
+	}
+};
+
+#define YELLOG_CONCAT_INNER(a, b) a##b
+#define YELLOG_CONCAT(a, b) YELLOG_CONCAT_INNER(a, b)
+
+// Times the rest of the enclosing scope, Name has to be a string literal as spans keep it until they are written
+// The span is recorded (see Logger::EnableSpans) and logged with trace priority when it ends,
+// when neither is on it costs a relaxed load and a priority check
+#if YELLOG_ACTIVE_LEVEL <= 0
+#define YELLOG_SCOPE(Name) \
+	static constexpr const char* YELLOG_CONCAT(yellog_scope_file_, __LINE__) = log_basename(__FILE__); \
+	static LogSite YELLOG_CONCAT(yellog_scope_site_, __LINE__)(YELLOG_CONCAT(yellog_scope_file_, __LINE__), __func__, __LINE__, TracePriority); \
+	LogScope YELLOG_CONCAT(yellog_scope_, __LINE__)(YELLOG_CONCAT(yellog_scope_site_, __LINE__), "" Name)
+#else
+#define YELLOG_SCOPE(Name) ((void)0)
+#endif
+
+// Declares log_site, the static descriptor of the enclosing call site, log_function has to hold the __func__ of the caller
+// The file name is shortened at compile time
+#define LOG_SITE(Name, Priority) \
+	static constexpr const char* Name##_file = log_basename(__FILE__); \
+	static LogSite Name(Name##_file, log_function, __LINE__, Priority)
+
+// Logs through the static descriptor of the call site, the call passes it instead of the line and the file
+#define LOG_AT(Priority, Message, ...) ([&](const char* log_function) \
+	{ \
+		LOG_SITE(log_site, Priority); \
+		Logger::Log(log_site, Message, __VA_ARGS__); \
+	}(__func__))
+
+// Like LOG_*, but the call site writes at most PerSecond (> 0) messages a second on average (and bursts of up to PerSecond),
+// the rest are dropped and counted, the next message written reports how many were dropped
+// The token bucket is a static of the call site, so checking it costs no lookup and no lock
+// Messages filtered out by priority or a site rule take no token and aren't counted as dropped
+#define LOG_RATE_LIMITED_AT(Priority, PerSecond, Message, ...) ([&](const char* log_function) \
+	{ \
+		static LogRateLimiter log_rate_limiter(PerSecond, PerSecond); \
+		LOG_SITE(log_site, Priority); \
+		if (Logger::IsEnabled(log_site) && log_rate_limiter.Allow()) \
+		{ \
+			if (unsigned long log_dropped = log_rate_limiter.TakeDropped()) \
+			{ \
+				LOG_SITE(log_dropped_site, WarnPriority); \
+				Logger::Log(log_dropped_site, "%lu messages dropped by the rate limit", log_dropped); \
+			} \
+			Logger::Log(log_site, Message, __VA_ARGS__); \
+		} \
+	}(__func__))
+
+// Like LOG_*, but only the 1st, (N+1)th, (2N+1)th... call of the call site logs, a skipped call is a single relaxed increment
+// Nothing is logged if N is 0 or negative
+#define LOG_EVERY_N_AT(Priority, N, Message, ...) ([&](const char* log_function) \
+	{ \
+		static std::atomic<unsigned long> log_occurrences{ 0 }; \
+		const long long log_every = (N); \
+		if (log_every > 0 && log_occurrences.fetch_add(1, std::memory_order_relaxed) % (unsigned long long)log_every == 0) \
+		{ \
+			LOG_SITE(log_site, Priority); \
+			Logger::Log(log_site, Message, __VA_ARGS__); \
+		} \
+	}(__func__))
+
+// Like LOG_*, but only the first N calls of the call site log, later calls are a single relaxed load
+// Nothing is logged if N is 0 or negative
+#define LOG_FIRST_N_AT(Priority, N, Message, ...) ([&](const char* log_function) \
+	{ \
+		static std::atomic<unsigned long> log_occurrences{ 0 }; \
+		const long long log_first = (N); \
+		if (log_first > 0 && log_occurrences.load(std::memory_order_relaxed) < (unsigned long long)log_first \
+			&& log_occurrences.fetch_add(1, std::memory_order_relaxed) < (unsigned long long)log_first) \
+		{ \
+			LOG_SITE(log_site, Priority); \
+			Logger::Log(log_site, Message, __VA_ARGS__); \
+		} \
+	}(__func__))
+
+// Like LOG_*, but each call logs with the given probability (0 to 1), decided by a thread-local random generator
+#define LOG_SAMPLED_AT(Priority, Probability, Message, ...) ([&](const char* log_function) \
+	{ \
+		if (LogSampler::Sample(Probability)) \
+		{ \
+			LOG_SITE(log_site, Priority); \
+			Logger::Log(log_site, Message, __VA_ARGS__); \
+		} \
+	}(__func__))
+
+#if YELLOG_ACTIVE_LEVEL <= 0
+#define LOG_TRACE(Message, ...) LOG_AT(TracePriority, Message, __VA_ARGS__)
+#define LOG_TRACE_RATE_LIMITED(PerSecond, Message, ...) LOG_RATE_LIMITED_AT(TracePriority, PerSecond, Message, __VA_ARGS__)
+#define LOG_TRACE_EVERY_N(N, Message, ...) LOG_EVERY_N_AT(TracePriority, N, Message, __VA_ARGS__)
+#define LOG_TRACE_FIRST_N(N, Message, ...) LOG_FIRST_N_AT(TracePriority, N, Message, __VA_ARGS__)
+#define LOG_TRACE_SAMPLED(Probability, Message, ...) LOG_SAMPLED_AT(TracePriority, Probability, Message, __VA_ARGS__)
+#else
+#define LOG_TRACE(Message, ...) ((void)0)
+#define LOG_TRACE_RATE_LIMITED(PerSecond, Message, ...) ((void)0)
+#define LOG_TRACE_EVERY_N(N, Message, ...) ((void)0)
+#define LOG_TRACE_FIRST_N(N, Message, ...) ((void)0)
+#define LOG_TRACE_SAMPLED(Probability, Message, ...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 1
+#define LOG_DEBUG(Message, ...) LOG_AT(DebugPriority, Message, __VA_ARGS__)
+#define LOG_DEBUG_RATE_LIMITED(PerSecond, Message, ...) LOG_RATE_LIMITED_AT(DebugPriority, PerSecond, Message, __VA_ARGS__)
+#define LOG_DEBUG_EVERY_N(N, Message, ...) LOG_EVERY_N_AT(DebugPriority, N, Message, __VA_ARGS__)
+#define LOG_DEBUG_FIRST_N(N, Message, ...) LOG_FIRST_N_AT(DebugPriority, N, Message, __VA_ARGS__)
+#define LOG_DEBUG_SAMPLED(Probability, Message, ...) LOG_SAMPLED_AT(DebugPriority, Probability, Message, __VA_ARGS__)
+#else
+#define LOG_DEBUG(Message, ...) ((void)0)
+#define LOG_DEBUG_RATE_LIMITED(PerSecond, Message, ...) ((void)0)
+#define LOG_DEBUG_EVERY_N(N, Message, ...) ((void)0)
+#define LOG_DEBUG_FIRST_N(N, Message, ...) ((void)0)
+#define LOG_DEBUG_SAMPLED(Probability, Message, ...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 2
+#define LOG_INFO(Message, ...) LOG_AT(InfoPriority, Message, __VA_ARGS__)
+#define LOG_INFO_RATE_LIMITED(PerSecond, Message, ...) LOG_RATE_LIMITED_AT(InfoPriority, PerSecond, Message, __VA_ARGS__)
+#define LOG_INFO_EVERY_N(N, Message, ...) LOG_EVERY_N_AT(InfoPriority, N, Message, __VA_ARGS__)
+#define LOG_INFO_FIRST_N(N, Message, ...) LOG_FIRST_N_AT(InfoPriority, N, Message, __VA_ARGS__)
+#define LOG_INFO_SAMPLED(Probability, Message, ...) LOG_SAMPLED_AT(InfoPriority, Probability, Message, __VA_ARGS__)
+#else
+#define LOG_INFO(Message, ...) ((void)0)
+#define LOG_INFO_RATE_LIMITED(PerSecond, Message, ...) ((void)0)
+#define LOG_INFO_EVERY_N(N, Message, ...) ((void)0)
+#define LOG_INFO_FIRST_N(N, Message, ...) ((void)0)
+#define LOG_INFO_SAMPLED(Probability, Message, ...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 3
+#define LOG_WARN(Message, ...) LOG_AT(WarnPriority, Message, __VA_ARGS__)
+#define LOG_WARN_RATE_LIMITED(PerSecond, Message, ...) LOG_RATE_LIMITED_AT(WarnPriority, PerSecond, Message, __VA_ARGS__)
+#define LOG_WARN_EVERY_N(N, Message, ...) LOG_EVERY_N_AT(WarnPriority, N, Message, __VA_ARGS__)
+#define LOG_WARN_FIRST_N(N, Message, ...) LOG_FIRST_N_AT(WarnPriority, N, Message, __VA_ARGS__)
+#define LOG_WARN_SAMPLED(Probability, Message, ...) LOG_SAMPLED_AT(WarnPriority, Probability, Message, __VA_ARGS__)
+#else
+#define LOG_WARN(Message, ...) ((void)0)
+#define LOG_WARN_RATE_LIMITED(PerSecond, Message, ...) ((void)0)
+#define LOG_WARN_EVERY_N(N, Message, ...) ((void)0)
+#define LOG_WARN_FIRST_N(N, Message, ...) ((void)0)
+#define LOG_WARN_SAMPLED(Probability, Message, ...) ((void)0)
+#endif
+
+#if YELLOG_ACTIVE_LEVEL <= 4
+#define LOG_ERROR(Message, ...) LOG_AT(ErrorPriority, Message, __VA_ARGS__)
+#define LOG_ERROR_RATE_LIMITED(PerSecond, Message, ...) LOG_RATE_LIMITED_AT(ErrorPriority, PerSecond, Message, __VA_ARGS__)
+#define LOG_ERROR_EVERY_N(N, Message, ...) LOG_EVERY_N_AT(ErrorPriority, N, Message, __VA_ARGS__)
+#define LOG_ERROR_FIRST_N(N, Message, ...) LOG_FIRST_N_AT(ErrorPriority, N, Message, __VA_ARGS__)
+#define LOG_ERROR_SAMPLED(Probability, Message, ...) LOG_SAMPLED_AT(ErrorPriority, Probability, Message, __VA_ARGS__)
+#else
+#define LOG_ERROR(Message, ...) ((void)0)
+#define LOG_ERROR_RATE_LIMITED(PerSecond, Message, ...) ((void)0)
+#define LOG_ERROR_EVERY_N(N, Message, ...) ((void)0)
+#define LOG_ERROR_FIRST_N(N, Message, ...) ((void)0)
+#define LOG_ERROR_SAMPLED(Probability, Message, ...) ((void)0)
+#endif
 
-#define LOG_TRACE(Message, ...) (Logger::Trace(__LINE__, __FILE__, Message, __VA_ARGS__))
-#define LOG_DEBUG(Message, ...) (Logger::Debug(__LINE__, __FILE__, Message, __VA_ARGS__))
-#define LOG_INFO(Message, ...) (Logger::Info(__LINE__, __FILE__, Message, __VA_ARGS__))
-#define LOG_WARN(Message, ...) (Logger::Warn(__LINE__, __FILE__, Message, __VA_ARGS__))
-#define LOG_ERROR(Message, ...) (Logger::Error(__LINE__, __FILE__, Message, __VA_ARGS__))
-#define LOG_CRITICAL(Message, ...) (Logger::Critical(__LINE__, __FILE__, Message, __VA_ARGS__))
\ No newline at end of file
+#if YELLOG_ACTIVE_LEVEL <= 5
+#define LOG_CRITICAL(Message, ...) LOG_AT(CriticalPriority, Message, __VA_ARGS__)
+#define LOG_CRITICAL_RATE_LIMITED(PerSecond, Message, ...) LOG_RATE_LIMITED_AT(CriticalPriority, PerSecond, Message, __VA_ARGS__)
+#define LOG_CRITICAL_EVERY_N(N, Message, ...) LOG_EVERY_N_AT(CriticalPriority, N, Message, __VA_ARGS__)
+#define LOG_CRITICAL_FIRST_N(N, Message, ...) LOG_FIRST_N_AT(CriticalPriority, N, Message, __VA_ARGS__)
+#define LOG_CRITICAL_SAMPLED(Probability, Message, ...) LOG_SAMPLED_AT(CriticalPriority, Probability, Message, __VA_ARGS__)
+#else
+#define LOG_CRITICAL(Message, ...) ((void)0)
+#define LOG_CRITICAL_RATE_LIMITED(PerSecond, Message, ...) ((void)0)
+#define LOG_CRITICAL_EVERY_N(N, Message, ...) ((void)0)
+#define LOG_CRITICAL_FIRST_N(N, Message, ...) ((void)0)
+#define LOG_CRITICAL_SAMPLED(Probability, Message, ...) ((void)0)
+#endif
\ No newline at end of file
@@ -0,0 +1,1185 @@
+/*
+	Tests for Yellog and the ep_4 Logger
+
+	Build and run (Linux):
+		g++ -std=c++17 -O2 yellog-decode.cpp -o yellog-decode
+		g++ -std=c++17 -pthread -Iinclude tests.cpp -o tests
+		./tests [yellog-decode path]
+
+	Every test runs in its own child process, as some of them turn on modes that can't be turned off (e.g. async output)
+	Prints every failed check and exits with 1 if there was one.
+*/
+
+#include "include/yelloger.h"
+#include "src/ep_4/logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+static int failures = 0;
+static std::string decoder = "./yellog-decode";
+
+#define CHECK(Condition) \
+	do \
+	{ \
+		if (!(Condition)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition); \
+			failures++; \
+		} \
+	} while (0)
+
+static std::string without_newline(std::string line)
+{
+	if (!line.empty() && line.back() == '\n')
+	{
+		line.pop_back();
+	}
+	return line;
+}
+
+static bool ends_with(const std::string& text, const std::string& end)
+{
+	return text.size() >= end.size() && text.compare(text.size() - end.size(), end.size(), end) == 0;
+}
+
+// Runs the decoder on a binary log, returns its output lines
+static std::vector<std::string> decode(const std::string& decoder, const char* path)
+{
+	std::vector<std::string> lines;
+	std::string command = decoder + " " + path;
+	std::FILE* output = popen(command.c_str(), "r");
+	if (output == 0)
+	{
+		return lines;
+	}
+
+	std::string line;
+	for (int c = std::fgetc(output); c != EOF; c = std::fgetc(output))
+	{
+		if (c == '\n')
+		{
+			lines.push_back(line);
+			line.clear();
+		}
+		else
+		{
+			line += (char)c;
+		}
+	}
+	pclose(output);
+	return lines;
+}
+
+// A message written by BinaryFileSink and decoded by yellog-decode reads the same as the text line
+static void test_binary_round_trip()
+{
+	const char* path = "tests_binary.log";
+	auto text = std::make_shared<Yellog::MemorySink>();
+	auto binary = std::make_shared<Yellog::BinaryFileSink>(path);
+	Yellog::AddSink(text);
+	Yellog::AddSink(binary);
+
+	char bytes[4] = { 'a', 'b', 'c', 'd' };	// not null-terminated, printed as a pointer only
+	int value = -42;
+	Yellog::Info("no arguments");
+	Yellog::Info("integers %d %u %ld %lld %llu", value, 7u, -123456789L, -9000000000LL, 18000000000000000000ULL);
+	Yellog::Warn("hex %x %08X, char %c", 255u, 48879u, 'y');
+	Yellog::Error("floating %.3f %e %g", 3.14159, -0.000125, 1e100);
+	Yellog::Debug("strings [%s] [%10s] [%-4s] [%.2s]", "text", "right", "l", "cut");
+	Yellog::Info("pointer %p, width %*d, percent %%", (void*)bytes, 6, value);
+	Yellog::Info("char pointer %p", bytes);
+	Yellog::Info(YELLOG_FMT("braces {} {:x} {:.2f}"), "text", 255, 2.5);
+	Yellog::Info("fields", Yellog::Field("count", 3), Yellog::Field("name", "value"), Yellog::Field("ok", true));
+	Yellog::Get("tests").Info("category %d", 1);
+
+	Yellog::RemoveSink(binary);
+	binary.reset();
+	Yellog::RemoveSink(text);
+
+	std::vector<std::string> expected = text->GetLines();
+	std::vector<std::string> decoded = decode(decoder, path);
+	CHECK(expected.size() == 10);
+	CHECK(decoded.size() == expected.size());
+	for (std::size_t i = 0; i < expected.size() && i < decoded.size(); i++)
+	{
+		if (decoded[i] != without_newline(expected[i]))
+		{
+			std::fprintf(stderr, "  text:    %s\n  decoded: %s\n", without_newline(expected[i]).c_str(), decoded[i].c_str());
+			failures++;
+		}
+	}
+
+	std::remove(path);
+}
+
+// Returns the message written by JsonFormat for a message logged as "%s" with text
+static std::string json_message(const char* text)
+{
+	auto json = std::make_shared<Yellog::MemorySink>();
+	json->SetFormatter(Yellog::JsonFormat);
+	Yellog::AddSink(json);
+	Yellog::Info("%s", text);
+	Yellog::RemoveSink(json);
+
+	std::vector<std::string> lines = json->GetLines();
+	if (lines.size() != 1)
+	{
+		return "";
+	}
+
+	const std::string key = ",\"message\":\"";
+	std::size_t begin = lines[0].find(key);
+	std::size_t end = lines[0].rfind("\"}");
+	if (begin == std::string::npos || end == std::string::npos || end < begin + key.size())
+	{
+		return "";
+	}
+	begin += key.size();
+	return lines[0].substr(begin, end - begin);
+}
+
+static void test_json_escaping()
+{
+	CHECK(json_message("plain text") == "plain text");
+	CHECK(json_message("quote \" backslash \\ slash /") == "quote \\\" backslash \\\\ slash /");
+	CHECK(json_message("new\nline\ttab\rreturn") == "new\\nline\\ttab\\rreturn");
+	CHECK(json_message("\x01\x1f") == "\\u0001\\u001f");
+	CHECK(json_message("utf-8 \xc3\xa9\xe2\x82\xac") == "utf-8 \xc3\xa9\xe2\x82\xac");
+
+	// escapes before, inside and after an 8 byte run
+	CHECK(json_message("\"0123456789abcdef\"0123456\n") == "\\\"0123456789abcdef\\\"0123456\\n");
+	CHECK(json_message("01234567\\") == "01234567\\\\");
+}
+
+static void test_site_rules()
+{
+	LogSite site("server.cpp", "handle_request", 120, InfoPriority);
+
+	LogSiteRule file("server.cpp", true);
+	CHECK(file.IsValid());
+	CHECK(file.Matches(site));
+
+	LogSiteRule glob("serv*.cpp", true);
+	CHECK(glob.IsValid());
+	CHECK(glob.Matches(site));
+	CHECK(!LogSiteRule("client*.cpp", true).Matches(site));
+	CHECK(LogSiteRule("server.c?p", true).Matches(site));
+
+	LogSiteRule line("server.cpp:120", false);
+	CHECK(line.IsValid());
+	CHECK(line.Matches(site));
+	CHECK(!LogSiteRule("server.cpp:121", false).Matches(site));
+	CHECK(LogSiteRule("*:120", false).Matches(site));
+
+	LogSiteRule function("handle_*()", true);
+	CHECK(function.IsValid());
+	CHECK(function.Matches(site));
+	CHECK(!LogSiteRule("main()", true).Matches(site));
+
+	// invalid lines are rejected instead of throwing
+	CHECK(!LogSiteRule("server.cpp:99999999999", true).IsValid());
+	CHECK(!LogSiteRule("server.cpp:12a", true).IsValid());
+	CHECK(!LogSiteRule("server.cpp:", true).IsValid());
+	CHECK(!LogSiteRule("server.cpp:-1", true).IsValid());
+	CHECK(Logger::SetSiteEnabled("server.cpp:99999999999", false) == 0);
+
+	CHECK(Logger::SetSiteEnabled("server.cpp:120", false) == 1);
+	CHECK(site.GetState() == LogSite::Disabled);
+	Logger::ResetSites();
+	CHECK(site.GetState() == LogSite::FollowPriority);
+}
+
+// Holds the first message it gets until Open() is called, so a test can let records wait in the async queue
+class GateSink : public Yellog::Sink
+{
+private:
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool open = false;
+	bool entered = false;
+
+public:
+	void Open()
+	{
+		std::scoped_lock lock(mutex);
+		open = true;
+		changed.notify_all();
+	}
+
+	// Waits until the writer holds a message in the gate
+	void WaitEntered()
+	{
+		std::unique_lock lock(mutex);
+		changed.wait(lock, [&] { return entered; });
+	}
+
+protected:
+	void write(const Yellog::Record&, const char*, std::size_t) override
+	{
+		std::unique_lock lock(mutex);
+		entered = true;
+		changed.notify_all();
+		changed.wait(lock, [&] { return open; });
+	}
+};
+
+static void log_stack_buffers()
+{
+	char chars[16] = "char text";
+	unsigned char bytes[16] = "unsigned text";
+	wchar_t wide[16] = L"wide text";
+	Yellog::Info("%s", chars);
+	Yellog::Info("%s", bytes);
+	Yellog::Info("%ls", wide);
+}
+
+static void overwrite_stack()
+{
+	volatile char junk[256];
+	for (std::size_t i = 0; i < sizeof(junk); i++)
+	{
+		junk[i] = '#';
+	}
+}
+
+// Deferred async records hold on to nothing on the stack of the logging call
+static void test_deferred_arguments()
+{
+	auto gate = std::make_shared<GateSink>();
+	auto text = std::make_shared<Yellog::MemorySink>();
+	Yellog::EnableAsyncOutput(64, Yellog::BlockOnOverflow, true);
+	Yellog::AddSink(gate);
+	Yellog::AddSink(text);
+
+	// the writer waits in the gate sink while the buffers go out of scope
+	Yellog::Info("gate");
+	log_stack_buffers();
+	overwrite_stack();
+	gate->Open();
+	Yellog::Flush();
+
+	std::vector<std::string> lines = text->GetLines();
+	CHECK(lines.size() == 4);
+	if (lines.size() == 4)
+	{
+		CHECK(ends_with(lines[1], " char text\n"));
+		CHECK(ends_with(lines[2], " unsigned text\n"));
+		CHECK(ends_with(lines[3], " wide text\n"));
+	}
+}
+
+// Logs 200 messages while the async writer is held in a gate sink, returns the numbers of the written ones
+static std::vector<int> log_through_full_queue(Yellog::OverflowPolicy policy)
+{
+	auto gate = std::make_shared<GateSink>();
+	auto text = std::make_shared<Yellog::MemorySink>();
+	Yellog::EnableStats();
+	CHECK(Yellog::EnableAsyncOutput(64, policy));
+	Yellog::AddSink(gate);
+	Yellog::AddSink(text);
+
+	Yellog::Info("gate");
+	gate->WaitEntered();
+
+	// a blocked logging call only returns once the gate is open
+	std::thread opener([&]
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		gate->Open();
+	});
+	for (int i = 0; i < 200; i++)
+	{
+		Yellog::Info("message %d", i);
+	}
+	opener.join();
+	Yellog::Flush();
+
+	std::vector<int> numbers;
+	std::vector<std::string> lines = text->GetLines();
+	CHECK(!lines.empty() && ends_with(lines[0], " gate\n"));
+	for (const std::string& line : lines)
+	{
+		std::size_t at = line.find("message ");
+		if (at != std::string::npos)
+		{
+			numbers.push_back(std::atoi(line.c_str() + at + 8));
+		}
+	}
+	CHECK(numbers.size() + Yellog::GetStats().dropped[Yellog::InfoPriority] == 200);
+	return numbers;
+}
+
+// BlockOnOverflow makes the logging call wait, no message is lost
+static void test_async_block()
+{
+	std::vector<int> numbers = log_through_full_queue(Yellog::BlockOnOverflow);
+	CHECK(numbers.size() == 200);
+	for (std::size_t i = 0; i < numbers.size(); i++)
+	{
+		CHECK(numbers[i] == (int)i);
+	}
+}
+
+// DropNewestOnOverflow keeps the queued messages and drops the new ones
+static void test_async_drop_newest()
+{
+	std::vector<int> numbers = log_through_full_queue(Yellog::DropNewestOnOverflow);
+	CHECK(!numbers.empty() && numbers.size() < 200);
+	CHECK(!numbers.empty() && numbers.front() == 0);
+	CHECK(std::is_sorted(numbers.begin(), numbers.end()) && std::adjacent_find(numbers.begin(), numbers.end()) == numbers.end());
+}
+
+// DropOldestOnOverflow drops queued messages to make room for the new ones
+static void test_async_drop_oldest()
+{
+	std::vector<int> numbers = log_through_full_queue(Yellog::DropOldestOnOverflow);
+	CHECK(!numbers.empty() && numbers.size() < 200);
+	CHECK(!numbers.empty() && numbers.back() == 199);
+	CHECK(std::is_sorted(numbers.begin(), numbers.end()) && std::adjacent_find(numbers.begin(), numbers.end()) == numbers.end());
+}
+
+// Keeps the time and the message of every record it gets
+class RecordingSink : public Yellog::Sink
+{
+public:
+	std::vector<std::pair<std::int64_t, std::string>> records;
+
+protected:
+	void write(const Yellog::Record& record, const char*, std::size_t) override
+	{
+		records.emplace_back(record.time, std::string(record.message, record.message_length));
+	}
+};
+
+// Batched output merges the buffers of all threads, including exited ones, in timestamp order
+static void test_batched_merge()
+{
+	auto sink = std::make_shared<RecordingSink>();
+	CHECK(Yellog::EnableBatchedOutput(1 << 20, 10000));
+	Yellog::AddSink(sink);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+	{
+		threads.emplace_back([t]
+		{
+			for (int i = 0; i < 500; i++)
+			{
+				Yellog::Info("thread %d message %d", t, i);
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	// the buffers are collected in one batch, as the interval and the batch size are not reached
+	Yellog::Flush();
+
+	CHECK(sink->records.size() == 2000);
+	int next[4] = {};
+	for (std::size_t i = 0; i < sink->records.size(); i++)
+	{
+		CHECK(i == 0 || sink->records[i - 1].first <= sink->records[i].first);
+		int t = 0, number = 0;
+		if (std::sscanf(sink->records[i].second.c_str(), "thread %d message %d", &t, &number) == 2 && t >= 0 && t < 4)
+		{
+			CHECK(number == next[t]);
+			next[t] = number + 1;
+		}
+	}
+	CHECK(next[0] == 500 && next[1] == 500 && next[2] == 500 && next[3] == 500);
+}
+
+// A sink written without the logger lock, counts its messages
+class CountingSink : public Yellog::Sink
+{
+public:
+	std::atomic<int> count{ 0 };
+
+	CountingSink()
+	{
+		concurrent_writes = true;
+	}
+
+protected:
+	void write(const Yellog::Record&, const char*, std::size_t) override
+	{
+		count.fetch_add(1, std::memory_order_relaxed);
+	}
+};
+
+// A removed concurrent sink is released by the logger while other threads keep logging
+static void test_concurrent_sink_release()
+{
+	std::atomic<bool> stop{ false };
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; i++)
+	{
+		threads.emplace_back([&] {
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				Yellog::Info("message %d", 1);
+			}
+		});
+	}
+
+	auto kept = std::make_shared<CountingSink>();
+	Yellog::AddSink(kept);
+	for (int i = 0; i < 100; i++)
+	{
+		auto sink = std::make_shared<CountingSink>();
+		std::weak_ptr<CountingSink> released = sink;
+		Yellog::AddSink(sink);
+		Yellog::RemoveSink(sink);
+		sink.reset();
+		CHECK(released.expired());
+	}
+
+	stop.store(true, std::memory_order_relaxed);
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+
+	int count = kept->count.load();
+	Yellog::Info("after");
+	CHECK(kept->count.load() == count + 1);
+	Yellog::RemoveSink(kept);
+	CHECK(kept.use_count() == 1);
+}
+
+static void write_file(const char* path, const char* text)
+{
+	std::FILE* file = std::fopen(path, "w");
+	if (file)
+	{
+		std::fputs(text, file);
+		std::fclose(file);
+	}
+}
+
+static std::vector<std::string> read_lines(const char* path)
+{
+	std::vector<std::string> lines;
+	std::FILE* file = std::fopen(path, "r");
+	if (file == 0)
+	{
+		return lines;
+	}
+
+	std::string line;
+	for (int c = std::fgetc(file); c != EOF; c = std::fgetc(file))
+	{
+		line += (char)c;
+		if (c == '\n')
+		{
+			lines.push_back(line);
+			line.clear();
+		}
+	}
+	std::fclose(file);
+	return lines;
+}
+
+// Logging threads see a reload all at once: a sink of one file only gets messages let through
+// by the priorities of that file, with its timestamp format
+static void test_config_reload()
+{
+	const char* path = "tests_config.conf";
+	const char* config_a = "priority = info\ncategory.db = error\ntimestamp_format = A\nsink.main = file tests_config_a.log\n";
+	const char* config_b = "priority = error\ncategory.db = info\ntimestamp_format = B\nsink.main = file tests_config_b.log\n";
+	std::remove("tests_config_a.log");
+	std::remove("tests_config_b.log");
+	write_file(path, config_a);
+	CHECK(Yellog::LoadConfig(path));
+
+	std::atomic<bool> stop{ false };
+	std::thread logging([&] {
+		Yellog::Category& db = Yellog::Get("db");
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			Yellog::Info("root");
+			db.Info("db");
+		}
+	});
+
+	for (int i = 0; i < 100; i++)
+	{
+		write_file(path, i % 2 == 0 ? config_b : config_a);
+		CHECK(Yellog::LoadConfig(path));
+	}
+	stop.store(true, std::memory_order_relaxed);
+	logging.join();
+	Yellog::Flush();
+
+	std::vector<std::string> a_lines = read_lines("tests_config_a.log");
+	std::vector<std::string> b_lines = read_lines("tests_config_b.log");
+	CHECK(!a_lines.empty() && !b_lines.empty());
+	for (const std::string& line : a_lines)
+	{
+		CHECK(line[0] == 'A' && ends_with(line, " root\n"));
+	}
+	for (const std::string& line : b_lines)
+	{
+		CHECK(line[0] == 'B' && ends_with(line, " db\n"));
+	}
+
+	// async output can't be changed once it runs
+	Yellog::EnableAsyncOutput(64, Yellog::BlockOnOverflow);
+	write_file(path, "async.capacity = 128\n");
+	CHECK(!Yellog::LoadConfig(path));
+	write_file(path, "async = off\n");
+	CHECK(!Yellog::LoadConfig(path));
+	write_file(path, "async = on\nasync.capacity = 64\nasync.overflow = block\n");
+	CHECK(Yellog::LoadConfig(path));
+
+	std::remove(path);
+	std::remove("tests_config_a.log");
+	std::remove("tests_config_b.log");
+}
+
+static void log_rate_limited(int i)
+{
+	LOG_INFO_RATE_LIMITED(1, "message %d", i);
+}
+
+static bool has_line(const std::vector<std::string>& lines, const std::string& text)
+{
+	for (const std::string& line : lines)
+	{
+		if (line.find(text) != std::string::npos)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Only messages that would be written take a token of the rate limit, the next written message reports the dropped ones
+static void test_rate_limit()
+{
+	const char* path = "tests_rate_limit.log";
+	std::remove(path);
+	std::freopen("/dev/null", "w", stdout);
+	Logger::EnableFileOutput(path);
+
+	Logger::SetPriority(ErrorPriority);
+	for (int i = 0; i < 10; i++)
+	{
+		log_rate_limited(i);
+	}
+	CHECK(Logger::GetRateLimitedCount() == 0);
+
+	Logger::SetPriority(InfoPriority);
+	for (int i = 10; i < 14; i++)
+	{
+		log_rate_limited(i);
+	}
+	CHECK(Logger::GetRateLimitedCount() == 3);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	log_rate_limited(14);
+	std::fflush(0);
+
+	std::vector<std::string> lines = read_lines(path);
+	CHECK(lines.size() == 3);
+	CHECK(!has_line(lines, "message 0 "));
+	CHECK(has_line(lines, "message 10 "));
+	CHECK(!has_line(lines, "message 11 "));
+	CHECK(has_line(lines, "3 messages dropped by the rate limit"));
+	CHECK(has_line(lines, "message 14 "));
+	std::remove(path);
+}
+
+static void log_text(const std::string& text)
+{
+	LOG_INFO("%s", text.c_str());
+}
+
+// Only messages that fit in the comparison buffer are suppressed, so long messages that differ at the end are all written
+static void test_duplicate_suppression()
+{
+	const char* path = "tests_duplicates.log";
+	std::remove(path);
+	std::freopen("/dev/null", "w", stdout);
+	Logger::EnableFileOutput(path);
+	Logger::SetDuplicateSuppression(true);
+
+	log_text("short");
+	log_text("short");
+	log_text("short");
+	CHECK(Logger::GetSuppressedCount() == 2);
+
+	std::string long_text(2000, 'x');
+	log_text(long_text + "1");
+	log_text(long_text + "2");
+	log_text(long_text + "2");
+	CHECK(Logger::GetSuppressedCount() == 2);
+	std::fflush(0);
+
+	std::vector<std::string> lines = read_lines(path);
+	CHECK(lines.size() == 5);
+	CHECK(has_line(lines, "last message repeated 2 times"));
+	CHECK(has_line(lines, long_text + "1 "));
+	CHECK(has_line(lines, long_text + "2 "));
+	std::remove(path);
+}
+
+// The flight recorder keeps messages filtered out by priority and formats them when they are dumped
+static void test_flight_recorder()
+{
+	const char* path = "tests_recorder.log";
+	std::remove(path);
+	Yellog::EnableFileOutput(path);
+	CHECK(Yellog::EnableFlightRecorder(16, false));
+	Yellog::SetPriority(Yellog::ErrorPriority);
+
+	for (int i = 0; i < 20; i++)
+	{
+		Yellog::Info("message %d", i);
+	}
+	Yellog::Info("star %*d|%-4s|", 5, 3, "ab");
+	Yellog::Info("wide %999999999d|", 7);
+	Yellog::DumpRecent();
+
+	std::vector<std::string> lines = read_lines(path);
+	CHECK(lines.size() == 17);
+	CHECK(!lines.empty() && lines[0].find("flight recorder, last 16 messages") != std::string::npos);
+	CHECK(!has_line(lines, "message 5\n"));
+	CHECK(has_line(lines, "message 6\n"));
+	CHECK(has_line(lines, "message 19\n"));
+	CHECK(has_line(lines, "star     3|ab  |\n"));
+	CHECK(has_line(lines, "wide        "));
+	for (const std::string& line : lines)
+	{
+		CHECK(line.size() <= YELLOG_LINE_BUFFER_SIZE);
+	}
+	std::remove(path);
+}
+
+// With SyncOnError an Error call returns once every message before it is in the file, messages of each thread stay in order
+static void test_direct_file_sink()
+{
+	const char* path = "tests_direct.log";
+	std::remove(path);
+	auto file = std::make_shared<Yellog::DirectFileSink>(path, Yellog::SyncOnError, 10000, 4096);
+	CHECK(file->IsOpen());
+	Yellog::AddSink(file);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+	{
+		threads.emplace_back([t]
+		{
+			for (int i = 0; i < 1000; i++)
+			{
+				Yellog::Info("thread %d message %d", t, i);
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	Yellog::Error("last");
+
+	// no flush, the Error call has waited for the writer
+	std::vector<std::string> lines = read_lines(path);
+	CHECK(lines.size() == 4001);
+	CHECK(!lines.empty() && ends_with(lines.back(), "last\n"));
+
+	int next[4] = {};
+	for (const std::string& line : lines)
+	{
+		int t = 0, i = 0;
+		std::size_t at = line.find("thread ");
+		if (at != std::string::npos && std::sscanf(line.c_str() + at, "thread %d message %d", &t, &i) == 2 && t >= 0 && t < 4)
+		{
+			CHECK(i == next[t]);
+			next[t] = i + 1;
+		}
+	}
+	CHECK(next[0] == 1000 && next[3] == 1000);
+	CHECK(file->GetFailedWrites() == 0);
+
+	Yellog::RemoveSink(file);
+	std::remove(path);
+}
+
+// Stands in for a compressor, copies the archive
+static bool copy_archive(const std::string& source_path, const std::string& target_path)
+{
+	std::vector<std::string> lines = read_lines(source_path.c_str());
+	std::FILE* target = std::fopen(target_path.c_str(), "w");
+	if (target == 0)
+	{
+		return false;
+	}
+	for (const std::string& line : lines)
+	{
+		std::fputs(line.c_str(), target);
+	}
+	return std::fclose(target) == 0;
+}
+
+// Returns the round numbers of the "round N" lines of a file
+static std::vector<int> read_rounds(const std::string& path)
+{
+	std::vector<int> rounds;
+	for (const std::string& line : read_lines(path.c_str()))
+	{
+		std::size_t at = line.find("round ");
+		if (at != std::string::npos)
+		{
+			rounds.push_back(std::atoi(line.c_str() + at + 6));
+		}
+	}
+	return rounds;
+}
+
+// The rotating sink keeps max_archives compressed archives, newest first, and every message is in one of the files
+static void test_rotating_file_sink()
+{
+	const std::string path = "tests_rotating.log";
+	for (const char* suffix : { "", ".1", ".2", ".3", ".1.z", ".2.z", ".3.z" })
+	{
+		std::remove((path + suffix).c_str());
+	}
+
+	auto sink = std::make_shared<Yellog::RotatingFileSink>(path.c_str(), 250, 2);
+	CHECK(sink->IsOpen());
+	sink->SetCompressor(copy_archive, ".z");
+	Yellog::AddSink(sink);
+
+	for (int round = 0; round < 30; round++)
+	{
+		Yellog::Info("round %d %s", round, std::string(60, '-').c_str());
+		// lets the background thread open the next file before it is needed
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	Yellog::RemoveSink(sink);
+	sink.reset();
+
+	std::vector<int> rounds = read_rounds(path + ".2.z");
+	std::vector<int> newer = read_rounds(path + ".1.z");
+	CHECK(!rounds.empty() && !newer.empty());
+	rounds.insert(rounds.end(), newer.begin(), newer.end());
+	// empty if the last message started a rotation
+	newer = read_rounds(path);
+	rounds.insert(rounds.end(), newer.begin(), newer.end());
+
+	// the archives and the file hold the last rounds, in order
+	CHECK(!rounds.empty() && rounds.back() == 29);
+	for (std::size_t i = 1; i < rounds.size(); i++)
+	{
+		CHECK(rounds[i] == rounds[i - 1] + 1);
+	}
+	CHECK(read_lines((path + ".1").c_str()).empty());
+	CHECK(read_lines((path + ".3.z").c_str()).empty());
+
+	for (const char* suffix : { "", ".1.z", ".2.z" })
+	{
+		std::remove((path + suffix).c_str());
+	}
+}
+
+// Messages written to a mapped file by many threads across segment boundaries are all there once the sink is destroyed,
+// appended to what the file held, with no zero bytes left of the preallocated segments
+static void test_mapped_file_sink()
+{
+	const char* path = "tests_mapped.log";
+	write_file(path, "existing\n");
+	auto sink = std::make_shared<Yellog::MappedFileSink>(path, 4096);
+	CHECK(sink->IsOpen());
+	Yellog::AddSink(sink);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+	{
+		threads.emplace_back([t]
+		{
+			for (int i = 0; i < 2000; i++)
+			{
+				Yellog::Info("thread %d message %d", t, i);
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+	{
+		thread.join();
+	}
+	Yellog::RemoveSink(sink);
+	sink.reset();
+
+	std::vector<std::string> lines = read_lines(path);
+	CHECK(lines.size() == 8001);
+	CHECK(!lines.empty() && lines[0] == "existing\n");
+
+	int next[4] = {};
+	for (std::size_t i = 1; i < lines.size(); i++)
+	{
+		CHECK(lines[i].find('\0') == std::string::npos);
+		int t = 0, number = 0;
+		std::size_t at = lines[i].find("thread ");
+		CHECK(at != std::string::npos && std::sscanf(lines[i].c_str() + at, "thread %d message %d", &t, &number) == 2 && t >= 0 && t < 4);
+		if (t >= 0 && t < 4)
+		{
+			CHECK(number == next[t]);
+			next[t] = number + 1;
+		}
+	}
+	CHECK(next[0] == 2000 && next[1] == 2000 && next[2] == 2000 && next[3] == 2000);
+
+	// the file was truncated to the written length
+	std::size_t length = 0;
+	for (const std::string& line : lines)
+	{
+		length += line.size();
+	}
+	std::FILE* file = std::fopen(path, "rb");
+	CHECK(file != 0 && std::fseek(file, 0, SEEK_END) == 0 && std::ftell(file) == (long)length);
+	if (file)
+	{
+		std::fclose(file);
+	}
+	std::remove(path);
+}
+
+// Reads a descriptor until end of file
+static std::string read_all(int descriptor)
+{
+	std::string text;
+	char chunk[4096];
+	for (;;)
+	{
+		ssize_t length = read(descriptor, chunk, sizeof(chunk));
+		if (length <= 0)
+		{
+			return text;
+		}
+		text.append(chunk, (std::size_t)length);
+	}
+}
+
+// AsyncConsoleSink colors lines by priority, the reset goes before the newline
+static void test_async_console_colors()
+{
+	int pipe_fds[2];
+	CHECK(pipe(pipe_fds) == 0);
+	auto sink = std::make_shared<Yellog::AsyncConsoleSink>(pipe_fds[1], Yellog::AlwaysColor, Yellog::BlockOnOverflow);
+	Yellog::AddSink(sink);
+	Yellog::Info("plain");
+	Yellog::Error("red");
+	Yellog::Flush();
+	Yellog::RemoveSink(sink);
+	sink.reset();
+	close(pipe_fds[1]);
+
+	std::string text = read_all(pipe_fds[0]);
+	close(pipe_fds[0]);
+	std::size_t error_line = text.find('\n') + 1;
+	std::string info = text.substr(0, error_line);
+	CHECK(ends_with(info, " plain\n") && info.find('\x1b') == std::string::npos);
+	CHECK(text.compare(error_line, 5, "\x1b[31m") == 0);
+	CHECK(ends_with(text, " red\x1b[0m\n"));
+}
+
+// When the console doesn't keep up, DropNewestOnOverflow drops messages and reports how many in the output
+static void test_async_console_drops()
+{
+	int pipe_fds[2];
+	CHECK(pipe(pipe_fds) == 0);
+
+	// fill the pipe so that the writer of the sink blocks
+	std::size_t filled = 0;
+	fcntl(pipe_fds[1], F_SETFL, O_NONBLOCK);
+	char junk[4096];
+	std::memset(junk, 'x', sizeof(junk));
+	for (ssize_t length; (length = write(pipe_fds[1], junk, sizeof(junk))) > 0; )
+	{
+		filled += (std::size_t)length;
+	}
+	fcntl(pipe_fds[1], F_SETFL, 0);
+
+	auto sink = std::make_shared<Yellog::AsyncConsoleSink>(pipe_fds[1], Yellog::NoColor, Yellog::DropNewestOnOverflow, 1024);
+	Yellog::AddSink(sink);
+	for (int i = 0; i < 100; i++)
+	{
+		Yellog::Info("message %d", i);
+	}
+	std::uint64_t dropped = sink->GetDroppedCount();
+	CHECK(dropped > 0);
+
+	std::string text;
+	std::thread reader([&] { text = read_all(pipe_fds[0]); });
+	Yellog::RemoveSink(sink);
+	sink.reset();
+	close(pipe_fds[1]);
+	reader.join();
+	close(pipe_fds[0]);
+
+	CHECK(text.size() > filled);
+	std::vector<int> numbers;
+	std::uint64_t reported = 0;
+	std::size_t begin = filled;
+	for (std::size_t end = text.find('\n', begin); end != std::string::npos; begin = end + 1, end = text.find('\n', begin))
+	{
+		std::string line = text.substr(begin, end - begin);
+		std::size_t at = line.find("message ");
+		unsigned long long count = 0;
+		if (at != std::string::npos)
+		{
+			numbers.push_back(std::atoi(line.c_str() + at + 8));
+		}
+		else if (std::sscanf(line.c_str(), "%llu messages dropped by the console sink", &count) == 1)
+		{
+			reported += count;
+		}
+	}
+	CHECK(reported == dropped);
+	CHECK(numbers.size() + dropped == 100);
+	CHECK(std::is_sorted(numbers.begin(), numbers.end()));
+}
+
+// Stats count emitted and filtered messages per priority (also of exited threads), the latency of emitting calls
+// and the bytes written to each sink
+static void test_stats()
+{
+	auto text = std::make_shared<Yellog::MemorySink>();
+	Yellog::AddSink(text);
+	Yellog::SetPriority(Yellog::WarnPriority);
+	Yellog::Info("not counted, stats are off");
+	Yellog::EnableStats();
+
+	for (int i = 0; i < 3; i++)
+	{
+		Yellog::Info("filtered %d", i);
+	}
+	Yellog::Error("emitted");
+	std::thread([] { Yellog::Warn("from a thread that exits"); }).join();
+
+	Yellog::Stats stats = Yellog::GetStats();
+	CHECK(stats.filtered[Yellog::InfoPriority] == 3);
+	CHECK(stats.emitted[Yellog::ErrorPriority] == 1);
+	CHECK(stats.emitted[Yellog::WarnPriority] == 1);
+	CHECK(Yellog::Stats::Total(stats.emitted) == 2);
+	CHECK(Yellog::Stats::Total(stats.dropped) == 0);
+
+	std::uint64_t latency_count = 0;
+	for (std::uint64_t count : stats.latency)
+	{
+		latency_count += count;
+	}
+	CHECK(latency_count == 2);
+	CHECK(stats.LatencyPercentile(0.5) > 0 && stats.LatencyPercentile(0.5) <= stats.LatencyPercentile(1.0));
+
+	std::uint64_t length = 0;
+	for (const std::string& line : text->GetLines())
+	{
+		length += line.size();
+	}
+	CHECK(stats.sinks.size() == 1);
+	CHECK(!stats.sinks.empty() && stats.sinks[0].sink == text && stats.sinks[0].bytes_written == length);
+
+	// counting stops, the counters keep their values
+	Yellog::DisableStats();
+	Yellog::Error("not counted");
+	CHECK(Yellog::GetStats().emitted[Yellog::ErrorPriority] == 1);
+}
+
+static void log_every_third(int i)
+{
+	LOG_INFO_EVERY_N(3, "every %d", i);
+}
+
+static void log_first_two(int i)
+{
+	LOG_INFO_FIRST_N(2, "first %d", i);
+}
+
+static void log_sampled(double probability, int i)
+{
+	LOG_INFO_SAMPLED(probability, "sampled %d", i);
+}
+
+// EVERY_N logs the 1st, (N+1)th... call of its site, FIRST_N the first N, SAMPLED with its probability
+static void test_sampling()
+{
+	const char* path = "tests_sampling.log";
+	std::remove(path);
+	std::freopen("/dev/null", "w", stdout);
+	Logger::EnableFileOutput(path);
+
+	for (int i = 0; i < 10; i++)
+	{
+		log_every_third(i);
+		log_first_two(i);
+		log_sampled(i < 5 ? 0.0 : 1.0, i);
+		LOG_INFO_EVERY_N(0, "never %d", i);
+		LOG_INFO_FIRST_N(-1, "never %d", i);
+	}
+	std::fflush(0);
+
+	std::vector<std::string> lines = read_lines(path);
+	CHECK(lines.size() == 4 + 2 + 5);
+	for (int i = 0; i < 10; i++)
+	{
+		std::string number = std::to_string(i) + " ";
+		CHECK(has_line(lines, "every " + number) == (i % 3 == 0));
+		CHECK(has_line(lines, "first " + number) == (i < 2));
+		CHECK(has_line(lines, "sampled " + number) == (i >= 5));
+	}
+	CHECK(!has_line(lines, "never "));
+	std::remove(path);
+}
+
+static void inner_scope()
+{
+	YELLOG_SCOPE("inner");
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+static void outer_scope()
+{
+	YELLOG_SCOPE("outer");
+	inner_scope();
+}
+
+// Reads "ts" and "dur" of the first trace event named name, false if there is none
+static bool read_span(const std::string& trace, const char* name, double& start, double& duration)
+{
+	std::size_t at = trace.find(std::string("{\"name\":\"") + name + "\"");
+	at = at == std::string::npos ? at : trace.find("\"ts\":", at);
+	return at != std::string::npos && std::sscanf(trace.c_str() + at, "\"ts\":%lf,\"dur\":%lf", &start, &duration) == 2;
+}
+
+// Spans are recorded up to the limit of each thread and written as Chrome trace events, ends of scopes are also logged
+static void test_spans()
+{
+	const char* log_path = "tests_spans.log";
+	const char* trace_path = "tests_spans.json";
+	std::remove(log_path);
+	std::freopen("/dev/null", "w", stdout);
+	Logger::EnableFileOutput(log_path);
+	Logger::SetPriority(TracePriority);
+
+	Logger::EnableSpans(3);
+	outer_scope();
+	outer_scope();
+	CHECK(Logger::GetDroppedSpanCount() == 1);
+	Logger::DisableSpans();
+	outer_scope();
+	CHECK(Logger::GetDroppedSpanCount() == 1);
+
+	CHECK(Logger::WriteChromeTrace(trace_path));
+	std::string trace;
+	for (const std::string& line : read_lines(trace_path))
+	{
+		trace += line;
+	}
+
+	std::size_t events = 0;
+	for (std::size_t at = trace.find("\"ph\":\"X\""); at != std::string::npos; at = trace.find("\"ph\":\"X\"", at + 1))
+	{
+		events++;
+	}
+	CHECK(events == 3);
+
+	// the first inner span is within the first outer one
+	double inner_start = 0, inner_duration = 0, outer_start = 0, outer_duration = 0;
+	CHECK(read_span(trace, "inner", inner_start, inner_duration));
+	CHECK(read_span(trace, "outer", outer_start, outer_duration));
+	CHECK(inner_duration >= 1000.0);
+	CHECK(outer_start <= inner_start && inner_start + inner_duration <= outer_start + outer_duration);
+
+	std::fflush(0);
+	std::vector<std::string> lines = read_lines(log_path);
+	std::size_t logged = 0;
+	for (const std::string& line : lines)
+	{
+		logged += line.find("outer took ") != std::string::npos ? 1 : 0;
+	}
+	CHECK(logged == 3);
+
+	std::remove(log_path);
+	std::remove(trace_path);
+}
+
+static int failed_tests = 0;
+
+// Runs test in a child process with console output off and every priority logged
+static void run_test(const char* name, void (*test)())
+{
+	std::fflush(0);
+	pid_t child = fork();
+	if (child == 0)
+	{
+		Yellog::DisableConsoleOutput();
+		Yellog::SetPriority(Yellog::TracePriority);
+		test();
+		std::fflush(0);
+		_exit(failures == 0 ? 0 : 1);
+	}
+
+	int status = 0;
+	if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		std::fprintf(stderr, "%s failed\n", name);
+		failed_tests++;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		decoder = argv[1];
+	}
+
+	run_test("binary round trip", test_binary_round_trip);
+	run_test("json escaping", test_json_escaping);
+	run_test("site rules", test_site_rules);
+	run_test("deferred arguments", test_deferred_arguments);
+	run_test("async block", test_async_block);
+	run_test("async drop newest", test_async_drop_newest);
+	run_test("async drop oldest", test_async_drop_oldest);
+	run_test("batched merge", test_batched_merge);
+	run_test("concurrent sink release", test_concurrent_sink_release);
+	run_test("config reload", test_config_reload);
+	run_test("rate limit", test_rate_limit);
+	run_test("duplicate suppression", test_duplicate_suppression);
+	run_test("sampling", test_sampling);
+	run_test("spans", test_spans);
+	run_test("stats", test_stats);
+	run_test("flight recorder", test_flight_recorder);
+	run_test("rotating file sink", test_rotating_file_sink);
+	run_test("mapped file sink", test_mapped_file_sink);
+	run_test("direct file sink", test_direct_file_sink);
+	run_test("async console colors", test_async_console_colors);
+	run_test("async console drops", test_async_console_drops);
+
+	if (failed_tests != 0)
+	{
+		std::fprintf(stderr, "%d tests failed\n", failed_tests);
+		return 1;
+	}
+
+	std::printf("all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,524 @@
+/*
+	Decoder for the binary logs written by Yellog::BinaryFileSink
+
+	Build (Linux):
+		g++ -std=c++17 -O2 yellog-decode.cpp -o yellog-decode
+
+	Usage:
+		yellog-decode [options] file
+			-p priority		only messages with this or higher priority (trace, debug, info, warn, error, critical)
+			-c category		only messages logged through this category
+			--from time		only messages logged at or after time (seconds since epoch, fractions allowed)
+			--to time		only messages logged before time
+			-t format		timestamp format (strftime, %f gives milliseconds), "%T  %d-%m-%Y" by default
+
+	Prints the lines the default Yellog format would have produced: "timestamp    [Priority] message"
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+
+static const char* const priority_names[] = { "trace", "debug", "info", "warn", "error", "critical" };
+static const char* const priority_strs[] = { "[Trace]    ", "[Debug]    ", "[Info]     ", "[Warn]     ", "[Error]    ", "[Crit]     " };
+
+static const std::uint8_t format_entry = 0x10;
+static const std::uint8_t category_entry = 0x11;
+
+// Reads from a bounded range, every read fails once the data runs out
+class Reader
+{
+private:
+	const char* pos;
+	const char* end;
+
+public:
+	Reader(const char* data, std::size_t size) : pos(data), end(data + size) {}
+
+	bool AtEnd() const
+	{
+		return pos == end;
+	}
+
+	bool Byte(std::uint8_t& value)
+	{
+		if (pos == end)
+		{
+			return false;
+		}
+		value = (std::uint8_t)*pos++;
+		return true;
+	}
+
+	bool Fixed(std::uint64_t& value, int bytes)
+	{
+		if (end - pos < bytes)
+		{
+			return false;
+		}
+		value = 0;
+		for (int i = 0; i < bytes; i++)
+		{
+			value |= (std::uint64_t)(unsigned char)pos[i] << (i * 8);
+		}
+		pos += bytes;
+		return true;
+	}
+
+	bool Varint(std::uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			std::uint8_t byte;
+			if (!Byte(byte))
+			{
+				return false;
+			}
+			value |= (std::uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Bytes(const char*& data, std::uint64_t length)
+	{
+		if ((std::uint64_t)(end - pos) < length)
+		{
+			return false;
+		}
+		data = pos;
+		pos += length;
+		return true;
+	}
+};
+
+// A printf argument as it was passed at the logging call
+struct Argument
+{
+	char tag;
+	std::uint64_t bits;
+	std::string text;
+};
+
+static bool read_arguments(Reader& reader, std::vector<Argument>& arguments)
+{
+	arguments.clear();
+	while (!reader.AtEnd())
+	{
+		Argument argument;
+		std::uint8_t tag;
+		reader.Byte(tag);
+		argument.tag = (char)tag;
+
+		switch (argument.tag)
+		{
+		case 'i':
+		case 'l':
+		case 'q':
+			if (!reader.Varint(argument.bits))
+			{
+				return false;
+			}
+			// zigzag decoding
+			argument.bits = (argument.bits >> 1) ^ (~(argument.bits & 1) + 1);
+			break;
+		case 'u':
+		case 'm':
+		case 'Q':
+			if (!reader.Varint(argument.bits))
+			{
+				return false;
+			}
+			break;
+		case 'd':
+		case 'D':
+		case 'p':
+			if (!reader.Fixed(argument.bits, 8))
+			{
+				return false;
+			}
+			break;
+		case 's':
+		{
+			std::uint64_t length;
+			const char* data;
+			if (!reader.Varint(length) || !reader.Bytes(data, length))
+			{
+				return false;
+			}
+			argument.text.assign(data, length);
+			break;
+		}
+		default:
+			return false;
+		}
+
+		arguments.push_back(std::move(argument));
+	}
+	return true;
+}
+
+static bool is_integer_tag(char tag)
+{
+	return tag == 'i' || tag == 'u' || tag == 'l' || tag == 'm' || tag == 'q' || tag == 'Q';
+}
+
+static long long integer_value(const Argument& argument)
+{
+	return (long long)argument.bits;
+}
+
+// Formats a single conversion spec with the argument, passing it as the type it had at the logging call
+static void format_argument(std::string& out, const std::string& spec, const Argument& argument)
+{
+	char conversion = spec.back();
+	bool matches = false;
+	if (std::strchr("diouxXc", conversion))
+	{
+		matches = is_integer_tag(argument.tag);
+	}
+	else if (std::strchr("fFeEgGaA", conversion))
+	{
+		matches = argument.tag == 'd' || argument.tag == 'D';
+	}
+	else if (conversion == 's')
+	{
+		matches = argument.tag == 's';
+	}
+	else if (conversion == 'p')
+	{
+		matches = argument.tag == 'p';
+	}
+
+	if (!matches)
+	{
+		out += "(bad argument)";
+		return;
+	}
+
+	double real;
+	std::memcpy(&real, &argument.bits, 8);
+
+	auto print = [&](char* buffer, std::size_t size)
+	{
+		const char* format = spec.c_str();
+		switch (argument.tag)
+		{
+		case 'i': return std::snprintf(buffer, size, format, (int)argument.bits);
+		case 'u': return std::snprintf(buffer, size, format, (unsigned int)argument.bits);
+		case 'l': return std::snprintf(buffer, size, format, (long)argument.bits);
+		case 'm': return std::snprintf(buffer, size, format, (unsigned long)argument.bits);
+		case 'q': return std::snprintf(buffer, size, format, (long long)argument.bits);
+		case 'Q': return std::snprintf(buffer, size, format, (unsigned long long)argument.bits);
+		case 'd': return std::snprintf(buffer, size, format, real);
+		case 'D': return std::snprintf(buffer, size, format, (long double)real);
+		case 's': return std::snprintf(buffer, size, format, argument.text.c_str());
+		default: return std::snprintf(buffer, size, format, (void*)(std::uintptr_t)argument.bits);
+		}
+	};
+
+	char text[256];
+	int length = print(text, sizeof(text));
+	if (length < 0)
+	{
+		return;
+	}
+	if ((std::size_t)length < sizeof(text))
+	{
+		out.append(text, (std::size_t)length);
+		return;
+	}
+
+	std::vector<char> long_text((std::size_t)length + 1);
+	print(long_text.data(), long_text.size());
+	out.append(long_text.data(), (std::size_t)length);
+}
+
+// printf with the decoded arguments
+static std::string format_message(const std::string& format, const std::vector<Argument>& arguments)
+{
+	std::string out;
+	std::size_t next = 0;
+	std::size_t i = 0;
+
+	auto take = [&]() -> const Argument*
+	{
+		return next < arguments.size() ? &arguments[next++] : 0;
+	};
+
+	while (i < format.size())
+	{
+		if (format[i] != '%')
+		{
+			out += format[i++];
+			continue;
+		}
+		if (i + 1 < format.size() && format[i + 1] == '%')
+		{
+			out += '%';
+			i += 2;
+			continue;
+		}
+
+		// %[flags][width][.precision][length]conversion, a '*' width or precision takes an int argument
+		std::string spec = "%";
+		i++;
+		while (i < format.size() && std::strchr("-+ #0", format[i]))
+		{
+			spec += format[i++];
+		}
+		for (int part = 0; part < 2; part++)
+		{
+			if (part == 1)
+			{
+				if (i >= format.size() || format[i] != '.')
+				{
+					break;
+				}
+				spec += format[i++];
+			}
+
+			if (i < format.size() && format[i] == '*')
+			{
+				const Argument* argument = take();
+				spec += std::to_string(argument && is_integer_tag(argument->tag) ? integer_value(*argument) : 0);
+				i++;
+			}
+			while (i < format.size() && format[i] >= '0' && format[i] <= '9')
+			{
+				spec += format[i++];
+			}
+		}
+		while (i < format.size() && std::strchr("hlLqjzt", format[i]))
+		{
+			spec += format[i++];
+		}
+		if (i >= format.size())
+		{
+			break;
+		}
+		spec += format[i++];
+
+		if (spec.back() == 'n')
+		{
+			take();
+			continue;
+		}
+
+		const Argument* argument = take();
+		if (argument == 0)
+		{
+			out += "(missing argument)";
+			continue;
+		}
+		format_argument(out, spec, *argument);
+	}
+
+	return out;
+}
+
+static std::string format_timestamp(std::int64_t time, const std::string& timestamp_format)
+{
+	std::time_t seconds = (std::time_t)(time >= 0 ? time / 1000000000 : (time + 1) / 1000000000 - 1);
+	int milliseconds = (int)((time - (std::int64_t)seconds * 1000000000) / 1000000);
+
+	// %f is replaced before strftime sees it
+	std::string format;
+	for (std::size_t i = 0; i < timestamp_format.size(); i++)
+	{
+		if (timestamp_format[i] == '%' && i + 1 < timestamp_format.size())
+		{
+			if (timestamp_format[i + 1] == 'f')
+			{
+				char digits[4];
+				std::snprintf(digits, sizeof(digits), "%03d", milliseconds);
+				format += digits;
+			}
+			else
+			{
+				format += timestamp_format[i];
+				format += timestamp_format[i + 1];
+			}
+			i++;
+		}
+		else
+		{
+			format += timestamp_format[i];
+		}
+	}
+
+	std::tm timestamp;
+	localtime_r(&seconds, &timestamp);
+
+	char text[256];
+	std::size_t length = std::strftime(text, sizeof(text), format.c_str(), &timestamp);
+	return std::string(text, length);
+}
+
+static std::int64_t parse_time(const char* text)
+{
+	return (std::int64_t)(std::strtod(text, 0) * 1e9);
+}
+
+static int usage()
+{
+	std::fprintf(stderr, "usage: yellog-decode [-p priority] [-c category] [--from seconds] [--to seconds] [-t timestamp_format] file\n");
+	return 2;
+}
+
+int main(int argc, char** argv)
+{
+	int min_priority = 0;
+	const char* category_filter = 0;
+	std::int64_t from = INT64_MIN;
+	std::int64_t to = INT64_MAX;
+	std::string timestamp_format = "%T  %d-%m-%Y";
+	const char* path = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (option == "-p" && has_value)
+		{
+			std::string name = argv[++i];
+			min_priority = -1;
+			for (int p = 0; p < 6; p++)
+			{
+				if (name == priority_names[p])
+				{
+					min_priority = p;
+				}
+			}
+			if (min_priority == -1)
+			{
+				std::fprintf(stderr, "unknown priority %s\n", name.c_str());
+				return 2;
+			}
+		}
+		else if (option == "-c" && has_value)
+		{
+			category_filter = argv[++i];
+		}
+		else if (option == "--from" && has_value)
+		{
+			from = parse_time(argv[++i]);
+		}
+		else if (option == "--to" && has_value)
+		{
+			to = parse_time(argv[++i]);
+		}
+		else if (option == "-t" && has_value)
+		{
+			timestamp_format = argv[++i];
+		}
+		else if (option[0] != '-' && path == 0)
+		{
+			path = argv[i];
+		}
+		else
+		{
+			return usage();
+		}
+	}
+
+	if (path == 0)
+	{
+		return usage();
+	}
+
+	std::FILE* file = std::fopen(path, "rb");
+	if (file == 0)
+	{
+		std::fprintf(stderr, "can't open %s\n", path);
+		return 1;
+	}
+
+	std::string data;
+	char chunk[1 << 16];
+	std::size_t read;
+	while ((read = std::fread(chunk, 1, sizeof(chunk), file)) != 0)
+	{
+		data.append(chunk, read);
+	}
+	std::fclose(file);
+
+	Reader reader(data.data(), data.size());
+	const char* magic;
+	std::uint64_t start_time;
+	if (!reader.Bytes(magic, 8) || std::memcmp(magic, "YELLOGB1", 8) != 0 || !reader.Fixed(start_time, 8))
+	{
+		std::fprintf(stderr, "%s is not a Yellog binary log\n", path);
+		return 1;
+	}
+
+	std::vector<std::string> formats;
+	std::vector<std::string> categories(1);
+	std::vector<Argument> arguments;
+	std::int64_t time = (std::int64_t)start_time;
+
+	while (!reader.AtEnd())
+	{
+		std::uint8_t kind;
+		reader.Byte(kind);
+
+		if (kind == format_entry || kind == category_entry)
+		{
+			std::uint64_t length;
+			const char* text;
+			if (!reader.Varint(length) || !reader.Bytes(text, length))
+			{
+				break;
+			}
+			(kind == format_entry ? formats : categories).emplace_back(text, length);
+			continue;
+		}
+
+		std::uint64_t format_id, delta, category_id, arguments_length;
+		const char* packed;
+		if (kind > 5 || !reader.Varint(format_id) || !reader.Varint(delta) || !reader.Varint(category_id)
+			|| !reader.Varint(arguments_length) || !reader.Bytes(packed, arguments_length))
+		{
+			std::fprintf(stderr, "corrupt entry\n");
+			return 1;
+		}
+
+		// zigzag decoding
+		time += (std::int64_t)((delta >> 1) ^ (~(delta & 1) + 1));
+
+		if ((int)kind < min_priority || time < from || time >= to)
+		{
+			continue;
+		}
+		if (category_filter && (category_id >= categories.size() || categories[category_id] != category_filter))
+		{
+			continue;
+		}
+
+		Reader argument_reader(packed, arguments_length);
+		if (format_id >= formats.size() || !read_arguments(argument_reader, arguments))
+		{
+			std::fprintf(stderr, "corrupt message\n");
+			return 1;
+		}
+
+		std::string line = format_timestamp(time, timestamp_format);
+		line += "    ";
+		line += priority_strs[kind];
+		line += format_message(formats[format_id], arguments);
+		line += '\n';
+		std::fwrite(line.data(), 1, line.size(), stdout);
+	}
+
+	return 0;
+}